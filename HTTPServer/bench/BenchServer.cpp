@@ -0,0 +1,135 @@
+// BenchServer：httpload各场景使用的示例服务端，只注册压测用的路由
+//
+//   bench_server --port 8080 --threads 4
+//   bench_server --port 8443 --tls cert.pem key.pem --threads 4
+//
+// 一个进程只服务一个端口（明文或者TLS），两种都要测时启动两个进程；收到SIGTERM/SIGINT时排空后退出
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <muduo/base/Logging.h>
+
+#include "../include/http/HttpServer.h"
+#include "../include/ssl/SslConfig.h"
+
+namespace{
+
+const std::string kHello = "Hello, world!";
+
+void reply(http::HttpResponse *resp, const std::string &body){
+    resp->setStatusCode(http::HttpResponse::k200Ok);
+    resp->setStatusMessage("OK");
+    resp->setContentType("text/plain");
+    resp->setContentLength(body.size());
+    resp->setBody(body);
+}
+
+void usage(const char *prog){
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -p, --port PORT         default 8080\n"
+            "  -t, --threads N         IO threads, default 4\n"
+            "      --tls CERT KEY      serve HTTPS with this certificate and key\n"
+            "      --http2             offer h2 via ALPN (with --tls)\n"
+            "      --routes N          routes registered for the routes scenario, default 500\n"
+            "      --listeners N       SO_REUSEPORT listener threads instead of one acceptor\n"
+            "      --io-uring N        plaintext HTTP/1.x on N io_uring threads\n",
+            prog);
+}
+
+}
+
+int main(int argc, char *argv[]){
+    enum{kTls = 256, kHttp2, kRoutes, kListeners, kIoUring};
+    static const struct option longOptions[] = {
+        {"port", required_argument, nullptr, 'p'},
+        {"threads", required_argument, nullptr, 't'},
+        {"tls", required_argument, nullptr, kTls},
+        {"http2", no_argument, nullptr, kHttp2},
+        {"routes", required_argument, nullptr, kRoutes},
+        {"listeners", required_argument, nullptr, kListeners},
+        {"io-uring", required_argument, nullptr, kIoUring},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int port = 8080;
+    int threads = 4;
+    std::string certFile, keyFile;
+    bool http2 = false;
+    int routes = 500;
+    int listeners = 0;
+    int ioUringThreads = 0;
+    int opt;
+    while((opt = getopt_long(argc, argv, "p:t:h", longOptions, nullptr)) != -1){
+        switch(opt){
+            case 'p': port = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case kTls:
+                // --tls带两个参数
+                if(optind >= argc){
+                    usage(argv[0]);
+                    return 2;
+                }
+                certFile = optarg;
+                keyFile = argv[optind++];
+                break;
+            case kHttp2: http2 = true; break;
+            case kRoutes: routes = atoi(optarg); break;
+            case kListeners: listeners = atoi(optarg); break;
+            case kIoUring: ioUringThreads = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    // 压测时每个请求的日志都会成为瓶颈
+    muduo::Logger::setLogLevel(muduo::Logger::WARN);
+
+    bool useSSL = !certFile.empty();
+    http::HttpServer server(port, "bench", useSSL,
+                            listeners > 0 ? muduo::net::TcpServer::kReusePort : muduo::net::TcpServer::kNoReusePort);
+    server.setThreadNum(threads);
+    if(useSSL){
+        ssl::SslConfig config;
+        config.setCertificateFile(certFile);
+        config.setPrivateKeyFile(keyFile);
+        config.setEnableHttp2(http2);
+        server.setSslConfig(config);
+        server.enableHttp2(http2);
+    }
+    if(listeners > 0){
+        server.setReusePortListeners(listeners);
+    }
+    if(ioUringThreads > 0){
+        server.enableIoUring(ioUringThreads);
+    }
+
+    // get、pipeline、handshake
+    server.Get("/bench/hello", [](const http::HttpRequest &, http::HttpResponse *resp){
+        reply(resp, kHello);
+    });
+    // post：请求体已经由HttpContext完整读入，只回复收到的长度
+    server.Post("/bench/echo", [](const http::HttpRequest &req, http::HttpResponse *resp){
+        reply(resp, std::to_string(req.getBody().size()));
+    });
+    // routes：静态路由走哈希表，带参数的路由逐个匹配正则
+    for(int i = 0; i < routes; ++i){
+        std::string name = std::to_string(i);
+        server.Get("/bench/route/" + name, [name](const http::HttpRequest &, http::HttpResponse *resp){
+            reply(resp, name);
+        });
+        server.addRoute(http::HttpRequest::kGet, "/bench/r" + name + "/:id",
+                        [](const http::HttpRequest &req, http::HttpResponse *resp){
+            reply(resp, req.getPathParameters("param1"));
+        });
+    }
+
+    server.stopOnSignals();
+    server.start();
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "Histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bench{
+
+namespace{
+
+int highestBit(uint64_t value){
+    return 63 - __builtin_clzll(value | 1);
+}
+
+}
+
+Histogram::Histogram()
+    : counts_(indexOf((uint64_t(1) << kMaxValueBits) - 1) + 1, 0)
+    , count_(0)
+    , min_(UINT64_MAX)
+    , max_(0)
+    , sum_(0)
+    , sumOfSquares_(0)
+{
+}
+
+// 小于kSubBuckets的数值每个一个桶；更大的数值右移shift位后落在[kSubBuckets/2, kSubBuckets)，
+// 每多一位占kSubBuckets/2个桶，相邻两段的下标首尾相接
+size_t Histogram::indexOf(uint64_t value){
+    int shift = std::max(0, highestBit(value) - (kSubBucketBits - 1));
+    return (static_cast<size_t>(shift) << (kSubBucketBits - 1)) + (value >> shift);
+}
+
+uint64_t Histogram::highestEquivalent(size_t index){
+    if(index < kSubBuckets){
+        return index;
+    }
+    int shift = static_cast<int>(index >> (kSubBucketBits - 1)) - 1;
+    uint64_t sub = index - (static_cast<uint64_t>(shift) << (kSubBucketBits - 1));
+    return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value){
+    value = std::min(value, (uint64_t(1) << kMaxValueBits) - 1);
+    ++counts_[indexOf(value)];
+    ++count_;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    double v = static_cast<double>(value);
+    sum_ += v;
+    sumOfSquares_ += v * v;
+}
+
+void Histogram::merge(const Histogram &other){
+    for(size_t i = 0; i < counts_.size(); ++i){
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    sum_ += other.sum_;
+    sumOfSquares_ += other.sumOfSquares_;
+}
+
+double Histogram::mean() const{
+    return count_ ? sum_ / static_cast<double>(count_) : 0;
+}
+
+double Histogram::stddev() const{
+    if(count_ == 0){
+        return 0;
+    }
+    double m = mean();
+    return std::sqrt(std::max(0.0, sumOfSquares_ / static_cast<double>(count_) - m * m));
+}
+
+uint64_t Histogram::percentile(double percentile) const{
+    if(count_ == 0){
+        return 0;
+    }
+    percentile = std::min(std::max(percentile, 0.0), 100.0);
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percentile / 100.0 * count_)));
+    uint64_t seen = 0;
+    for(size_t i = 0; i < counts_.size(); ++i){
+        seen += counts_[i];
+        if(seen >= target){
+            // 桶的上界可能超过实际出现过的最大值
+            return std::min(highestEquivalent(i), max_);
+        }
+    }
+    return max_;
+}
+
+}
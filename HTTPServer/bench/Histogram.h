@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bench{
+
+// HDR风格的延迟直方图（微秒）：数值按2的幂分段，每段再线性分成kSubBuckets/2个桶，
+// 任何数值的记录误差都不超过2/kSubBuckets（约0.1%），覆盖1微秒到约19小时；
+// 记录只是一次下标计算和自增，每个线程各用一个，结束后合并
+class Histogram{
+public:
+    Histogram();
+
+    void record(uint64_t value);
+    void merge(const Histogram &other);
+
+    uint64_t count() const {return count_;}
+    uint64_t min() const {return count_ ? min_ : 0;}
+    uint64_t max() const {return max_;}
+    double mean() const;
+    double stddev() const;
+    // percentile取0到100，返回不低于这个比例的记录所在桶的上界
+    uint64_t percentile(double percentile) const;
+
+private:
+    static size_t indexOf(uint64_t value);
+    static uint64_t highestEquivalent(size_t index);
+
+    static constexpr int kSubBucketBits = 11;
+    static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+    static constexpr int kMaxValueBits = 36;
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t min_;
+    uint64_t max_;
+    // 用于均值和标准差，double足够
+    double sum_;
+    double sumOfSquares_;
+};
+
+}
@@ -0,0 +1,671 @@
+#include "LoadGenerator.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace bench{
+
+namespace{
+
+const size_t kReadChunk = 64 * 1024;
+// 响应头的上限，超过时认为响应无法解析
+const size_t kMaxHeaderSize = 64 * 1024;
+const int kMaxEvents = 256;
+const int kMaxIov = 64;
+// 连接失败后的重试间隔，服务端不可用时不空转
+const int64_t kRetryInterval = 10 * 1000;
+
+int64_t nowMicros(){
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 各线程共享、只读
+struct Target{
+    const LoadOptions *options;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    SSL_CTX *sslCtx;
+    int64_t startTime;                  // warmup开始
+    int64_t measureStart;               // 开始计入结果
+    int64_t endTime;
+};
+
+struct Connection{
+    enum State{
+        kClosed,
+        kConnecting,
+        kHandshaking,
+        kOpen,
+    };
+
+    // 一个在途的请求：intended为延迟的起点（开环时为计划发送时刻），sent为实际交给socket的时刻，用于判断超时
+    struct Inflight{
+        int64_t intended;
+        int64_t sent;
+    };
+
+    struct Output{
+        const std::string *data;
+        size_t offset;
+    };
+
+    int fd = -1;
+    SSL *ssl = nullptr;
+    SSL_SESSION *session = nullptr;     // 用于下一次握手的会话复用
+    State state = kClosed;
+    int64_t connectStart = 0;
+    int64_t retryAt = 0;
+    // 每个请求新建连接时，这个连接上的请求的延迟起点；连接上已经发出过请求时为-1
+    int64_t requestStart = -1;
+
+    size_t nextRequest = 0;
+    int64_t nextIntended = 0;           // 开环：下一个请求的计划发送时刻
+
+    std::deque<Output> output;
+    std::deque<Inflight> inflight;
+
+    std::string input;
+    size_t inputOffset = 0;
+    bool inBody = false;
+    uint64_t bodyRemaining = 0;
+    int status = 0;
+    bool closeAfter = false;
+};
+
+bool headerIs(const char *begin, const char *end, const char *name){
+    size_t length = strlen(name);
+    return static_cast<size_t>(end - begin) == length && strncasecmp(begin, name, length) == 0;
+}
+
+bool containsToken(const char *begin, const char *end, const char *token){
+    size_t length = strlen(token);
+    for(const char *p = begin; p + length <= end; ++p){
+        if(strncasecmp(p, token, length) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+class Worker{
+public:
+    Worker(const Target &target, size_t firstConnection, size_t numConnections, size_t totalConnections)
+        : target_(target)
+        , options_(*target.options)
+        , epollFd_(::epoll_create1(EPOLL_CLOEXEC))
+        , connections_(numConnections)
+        , interval_(0)
+    {
+        if(options_.rate > 0){
+            interval_ = static_cast<int64_t>(1e6 * totalConnections / options_.rate);
+            interval_ = std::max<int64_t>(interval_, 1);
+        }
+        for(size_t i = 0; i < connections_.size(); ++i){
+            Connection &conn = connections_[i];
+            size_t global = firstConnection + i;
+            conn.nextRequest = global % options_.requests.size();
+            // 开环时各连接的计划错开，总体上均匀发送
+            conn.nextIntended = target_.startTime + (interval_ * static_cast<int64_t>(global)) / totalConnections;
+        }
+    }
+
+    ~Worker(){
+        for(Connection &conn : connections_){
+            close(&conn);
+            if(conn.session){
+                SSL_SESSION_free(conn.session);
+            }
+        }
+        ::close(epollFd_);
+    }
+
+    void run(){
+        int64_t now = nowMicros();
+        for(Connection &conn : connections_){
+            if(!openLoop() || !options_.connectionPerRequest){
+                connect(&conn, now);
+            }
+        }
+        // 开环时要按时发出请求，1毫秒检查一次计划
+        int tickMs = openLoop() ? 1 : 10;
+        struct epoll_event events[kMaxEvents];
+        int64_t lastTick = now;
+        while(now < target_.endTime){
+            int n = ::epoll_wait(epollFd_, events, kMaxEvents, tickMs);
+            now = nowMicros();
+            for(int i = 0; i < n; ++i){
+                onEvent(static_cast<Connection *>(events[i].data.ptr), events[i].events, now);
+            }
+            if(openLoop() || now - lastTick >= tickMs * 1000){
+                tick(now);
+                lastTick = now;
+            }
+        }
+        if(openLoop()){
+            for(const Connection &conn : connections_){
+                if(conn.nextIntended < target_.endTime){
+                    result_.backlogged += (target_.endTime - conn.nextIntended) / interval_ + 1;
+                }
+            }
+        }
+    }
+
+    const LoadResult &result() const {return result_;}
+
+private:
+    bool openLoop() const {return interval_ > 0;}
+    bool measuring(int64_t now) const {return now >= target_.measureStart && now < target_.endTime;}
+
+    void connect(Connection *conn, int64_t now){
+        const struct sockaddr *addr = reinterpret_cast<const struct sockaddr *>(&target_.addr);
+        conn->fd = ::socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if(conn->fd < 0){
+            connectFailed(conn, now);
+            return;
+        }
+        int one = 1;
+        ::setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->connectStart = now;
+        if(options_.connectionPerRequest){
+            // 延迟包括建立连接（和TLS握手）的时间；开环时从计划时刻算起
+            if(openLoop()){
+                conn->requestStart = conn->nextIntended;
+                conn->nextIntended += interval_;
+            }
+            else{
+                conn->requestStart = now;
+            }
+        }
+        if(::connect(conn->fd, addr, target_.addrLen) != 0 && errno != EINPROGRESS){
+            connectFailed(conn, now);
+            return;
+        }
+        conn->state = Connection::kConnecting;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        ::epoll_ctl(epollFd_, EPOLL_CTL_ADD, conn->fd, &event);
+    }
+
+    void connectFailed(Connection *conn, int64_t now){
+        if(measuring(now)){
+            ++result_.connectErrors;
+        }
+        close(conn);
+        conn->retryAt = now + kRetryInterval;
+    }
+
+    void connected(Connection *conn, int64_t now){
+        conn->state = Connection::kOpen;
+        if(measuring(now)){
+            ++result_.connects;
+            result_.connectLatency.record(now - conn->connectStart);
+        }
+    }
+
+    void close(Connection *conn){
+        if(conn->ssl){
+            if(options_.tlsResume && SSL_is_init_finished(conn->ssl)){
+                if(conn->session){
+                    SSL_SESSION_free(conn->session);
+                }
+                conn->session = SSL_get1_session(conn->ssl);
+            }
+            // 只发出close_notify，不等对端的
+            SSL_shutdown(conn->ssl);
+            SSL_free(conn->ssl);
+            conn->ssl = nullptr;
+        }
+        if(conn->fd >= 0){
+            ::close(conn->fd);
+            conn->fd = -1;
+        }
+        conn->state = Connection::kClosed;
+        conn->requestStart = -1;
+        conn->output.clear();
+        conn->inflight.clear();
+        conn->input.clear();
+        conn->inputOffset = 0;
+        conn->inBody = false;
+        conn->bodyRemaining = 0;
+        conn->closeAfter = false;
+    }
+
+    // 连接出错或者被关闭，其上在途的请求作废
+    void fail(Connection *conn, uint64_t *counter, int64_t now){
+        if(measuring(now)){
+            ++*counter;
+        }
+        close(conn);
+        reconnect(conn, now);
+    }
+
+    void reconnect(Connection *conn, int64_t now){
+        // 开环时每个请求新建连接的，由tick()按计划建立
+        if(!(openLoop() && options_.connectionPerRequest)){
+            connect(conn, now);
+        }
+    }
+
+    void tick(int64_t now){
+        int64_t timeout = static_cast<int64_t>(options_.timeout * 1e6);
+        for(Connection &conn : connections_){
+            switch(conn.state){
+                case Connection::kClosed:
+                    if(now >= conn.retryAt
+                       && (!openLoop() || !options_.connectionPerRequest || now >= conn.nextIntended)){
+                        connect(&conn, now);
+                    }
+                    break;
+                case Connection::kConnecting:
+                case Connection::kHandshaking:
+                    if(now - conn.connectStart > timeout){
+                        fail(&conn, &result_.timeouts, now);
+                    }
+                    break;
+                case Connection::kOpen:
+                    if(!conn.inflight.empty() && now - conn.inflight.front().sent > timeout){
+                        fail(&conn, &result_.timeouts, now);
+                    }
+                    else if(openLoop()){
+                        send(&conn, now);
+                    }
+                    break;
+            }
+        }
+    }
+
+    void onEvent(Connection *conn, uint32_t events, int64_t now){
+        // 同一批事件中前面的事件已经关闭了这个连接
+        if(conn->state == Connection::kClosed){
+            return;
+        }
+        if(conn->state == Connection::kConnecting){
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if((events & (EPOLLERR | EPOLLHUP))
+               || ::getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0){
+                connectFailed(conn, now);
+                return;
+            }
+            if(!(events & EPOLLOUT)){
+                return;
+            }
+            if(options_.tls){
+                conn->ssl = SSL_new(target_.sslCtx);
+                SSL_set_fd(conn->ssl, conn->fd);
+                SSL_set_tlsext_host_name(conn->ssl, options_.host.c_str());
+                if(conn->session){
+                    SSL_set_session(conn->ssl, conn->session);
+                }
+                conn->state = Connection::kHandshaking;
+            }
+            else{
+                connected(conn, now);
+            }
+        }
+        if(conn->state == Connection::kHandshaking){
+            int ret = SSL_connect(conn->ssl);
+            if(ret != 1){
+                int error = SSL_get_error(conn->ssl, ret);
+                if(error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE){
+                    ERR_clear_error();
+                    connectFailed(conn, now);
+                }
+                return;
+            }
+            connected(conn, now);
+        }
+        // 握手和读出的数据可能已经在SSL的缓冲区中，边沿触发下不会再有事件，这里直接读
+        if(!readInput(conn, now)){
+            return;
+        }
+        send(conn, now);
+    }
+
+    // 按模式加入新请求并写出
+    void send(Connection *conn, int64_t now){
+        if(conn->state != Connection::kOpen){
+            return;
+        }
+        if(options_.connectionPerRequest){
+            if(conn->requestStart >= 0){
+                enqueue(conn, conn->requestStart, now);
+                conn->requestStart = -1;
+            }
+        }
+        else if(openLoop()){
+            while(static_cast<int>(conn->inflight.size()) < options_.pipeline && conn->nextIntended <= now){
+                enqueue(conn, conn->nextIntended, now);
+                conn->nextIntended += interval_;
+            }
+        }
+        else{
+            while(static_cast<int>(conn->inflight.size()) < options_.pipeline){
+                enqueue(conn, now, now);
+            }
+        }
+        flush(conn, now);
+    }
+
+    void enqueue(Connection *conn, int64_t intended, int64_t now){
+        conn->output.push_back(Connection::Output{&options_.requests[conn->nextRequest], 0});
+        conn->nextRequest = (conn->nextRequest + 1) % options_.requests.size();
+        conn->inflight.push_back(Connection::Inflight{intended, now});
+    }
+
+    void flush(Connection *conn, int64_t now){
+        while(!conn->output.empty()){
+            ssize_t n;
+            if(conn->ssl){
+                Connection::Output &out = conn->output.front();
+                int ret = SSL_write(conn->ssl, out.data->data() + out.offset,
+                                    static_cast<int>(out.data->size() - out.offset));
+                if(ret <= 0){
+                    int error = SSL_get_error(conn->ssl, ret);
+                    if(error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ){
+                        return;
+                    }
+                    ERR_clear_error();
+                    fail(conn, &result_.writeErrors, now);
+                    return;
+                }
+                n = ret;
+            }
+            else{
+                // pipeline的多个请求一次写出
+                struct iovec iov[kMaxIov];
+                int count = 0;
+                for(auto it = conn->output.begin(); it != conn->output.end() && count < kMaxIov; ++it, ++count){
+                    iov[count].iov_base = const_cast<char *>(it->data->data() + it->offset);
+                    iov[count].iov_len = it->data->size() - it->offset;
+                }
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = count;
+                n = ::sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+                if(n < 0){
+                    if(errno == EAGAIN || errno == EWOULDBLOCK){
+                        return;
+                    }
+                    fail(conn, &result_.writeErrors, now);
+                    return;
+                }
+            }
+            if(measuring(now)){
+                result_.bytesWritten += n;
+            }
+            size_t written = static_cast<size_t>(n);
+            while(written > 0){
+                Connection::Output &out = conn->output.front();
+                size_t left = out.data->size() - out.offset;
+                if(written < left){
+                    out.offset += written;
+                    break;
+                }
+                written -= left;
+                conn->output.pop_front();
+            }
+        }
+    }
+
+    // 读到EAGAIN为止，连接仍然可用时返回true
+    bool readInput(Connection *conn, int64_t now){
+        while(true){
+            ssize_t n;
+            if(conn->ssl){
+                int ret = SSL_read(conn->ssl, buffer_, sizeof(buffer_));
+                n = ret;
+                if(ret <= 0){
+                    int error = SSL_get_error(conn->ssl, ret);
+                    if(error == SSL_ERROR_WANT_READ){
+                        return true;
+                    }
+                    // 对端没有发close_notify就关闭了连接也当作正常关闭
+                    n = error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && ERR_peek_error() == 0) ? 0 : -1;
+                    ERR_clear_error();
+                    errno = 0;
+                }
+            }
+            else{
+                n = ::read(conn->fd, buffer_, sizeof(buffer_));
+            }
+            if(n <= 0){
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                    return true;
+                }
+                // 对端关闭：没有在途请求时是正常的keep-alive超时关闭
+                if(n == 0 && conn->inflight.empty() && !conn->inBody){
+                    close(conn);
+                    reconnect(conn, now);
+                }
+                else{
+                    fail(conn, &result_.readErrors, now);
+                }
+                return false;
+            }
+            conn->input.append(buffer_, n);
+            if(measuring(now)){
+                result_.bytesRead += n;
+            }
+            if(!parse(conn, now)){
+                return false;
+            }
+        }
+    }
+
+    // 解析出所有完整的响应，连接被关闭时返回false
+    bool parse(Connection *conn, int64_t now){
+        while(conn->inputOffset < conn->input.size()){
+            if(!conn->inBody){
+                const char *begin = conn->input.data() + conn->inputOffset;
+                const char *end = conn->input.data() + conn->input.size();
+                const char *headerEnd = static_cast<const char *>(memmem(begin, end - begin, "\r\n\r\n", 4));
+                if(!headerEnd){
+                    if(static_cast<size_t>(end - begin) > kMaxHeaderSize){
+                        fail(conn, &result_.readErrors, now);
+                        return false;
+                    }
+                    break;
+                }
+                if(conn->inflight.empty() || headerEnd - begin < 12 || strncmp(begin, "HTTP/1.", 7) != 0){
+                    fail(conn, &result_.readErrors, now);
+                    return false;
+                }
+                conn->status = atoi(begin + 9);
+                conn->bodyRemaining = 0;
+                conn->closeAfter = begin[7] == '0';
+                const char *line = static_cast<const char *>(memchr(begin, '\n', headerEnd + 2 - begin)) + 1;
+                while(line < headerEnd){
+                    const char *lineEnd = static_cast<const char *>(memchr(line, '\r', headerEnd + 2 - line));
+                    const char *colon = static_cast<const char *>(memchr(line, ':', lineEnd - line));
+                    if(colon){
+                        const char *value = colon + 1;
+                        while(value < lineEnd && *value == ' '){
+                            ++value;
+                        }
+                        if(headerIs(line, colon, "content-length")){
+                            conn->bodyRemaining = strtoull(value, nullptr, 10);
+                        }
+                        else if(headerIs(line, colon, "connection")){
+                            conn->closeAfter = containsToken(value, lineEnd, "close");
+                        }
+                        else if(headerIs(line, colon, "transfer-encoding")){
+                            // 服务端的HTTP/1.x响应都带Content-Length，这里不实现分块解码
+                            fail(conn, &result_.readErrors, now);
+                            return false;
+                        }
+                    }
+                    line = lineEnd + 2;
+                }
+                conn->inputOffset = headerEnd + 4 - conn->input.data();
+                conn->inBody = true;
+            }
+            uint64_t available = conn->input.size() - conn->inputOffset;
+            uint64_t take = std::min(available, conn->bodyRemaining);
+            conn->inputOffset += take;
+            conn->bodyRemaining -= take;
+            if(conn->bodyRemaining > 0){
+                break;
+            }
+            conn->inBody = false;
+            complete(conn, now);
+            if(conn->closeAfter || options_.connectionPerRequest){
+                close(conn);
+                reconnect(conn, now);
+                return false;
+            }
+        }
+        // 响应体不保留，已经解析的部分随时丢掉
+        if(conn->inputOffset == conn->input.size()){
+            conn->input.clear();
+            conn->inputOffset = 0;
+        }
+        else if(conn->inputOffset >= kReadChunk){
+            conn->input.erase(0, conn->inputOffset);
+            conn->inputOffset = 0;
+        }
+        return true;
+    }
+
+    void complete(Connection *conn, int64_t now){
+        Connection::Inflight request = conn->inflight.front();
+        conn->inflight.pop_front();
+        if(!measuring(now)){
+            return;
+        }
+        ++result_.requests;
+        if(conn->status < 200 || conn->status >= 300){
+            ++result_.non2xx;
+        }
+        result_.latency.record(static_cast<uint64_t>(std::max<int64_t>(now - request.intended, 0)));
+    }
+
+private:
+    const Target &target_;
+    const LoadOptions &options_;
+    int epollFd_;
+    // 创建后不再改变大小，epoll中登记的是元素的地址
+    std::vector<Connection> connections_;
+    int64_t interval_;                  // 开环时每个连接上相邻两个请求的计划间隔，微秒
+    LoadResult result_;
+    char buffer_[kReadChunk];
+};
+
+bool resolve(const std::string &host, uint16_t port, struct sockaddr_storage *addr, socklen_t *addrLen){
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *list = nullptr;
+    if(::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &list) != 0 || !list){
+        return false;
+    }
+    memcpy(addr, list->ai_addr, list->ai_addrlen);
+    *addrLen = list->ai_addrlen;
+    ::freeaddrinfo(list);
+    return true;
+}
+
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions &options)
+    : options_(options)
+{
+    options_.threads = std::max(1, options_.threads);
+    options_.connections = std::max(options_.threads, options_.connections);
+    options_.pipeline = std::max(1, options_.pipeline);
+    if(options_.connectionPerRequest){
+        options_.pipeline = 1;
+    }
+}
+
+bool LoadGenerator::run(LoadResult *result){
+    if(options_.requests.empty()){
+        fprintf(stderr, "no requests to send\n");
+        return false;
+    }
+    Target target;
+    target.options = &options_;
+    if(!resolve(options_.host, options_.port, &target.addr, &target.addrLen)){
+        fprintf(stderr, "cannot resolve %s\n", options_.host.c_str());
+        return false;
+    }
+    // 对端关闭后写入时不要被SIGPIPE终止，SSL_write不能传MSG_NOSIGNAL
+    ::signal(SIGPIPE, SIG_IGN);
+    std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> sslCtx(nullptr, SSL_CTX_free);
+    if(options_.tls){
+        sslCtx.reset(SSL_CTX_new(TLS_client_method()));
+        // 压测本机的服务端，通常是自签名证书，不校验
+        SSL_CTX_set_verify(sslCtx.get(), SSL_VERIFY_NONE, nullptr);
+        SSL_CTX_set_mode(sslCtx.get(), SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        // 服务端开启了HTTP/2时也用HTTP/1.1
+        static const unsigned char alpn[] = {8, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+        SSL_CTX_set_alpn_protos(sslCtx.get(), alpn, sizeof(alpn));
+    }
+    target.sslCtx = sslCtx.get();
+    target.startTime = nowMicros();
+    target.measureStart = target.startTime + static_cast<int64_t>(options_.warmup * 1e6);
+    target.endTime = target.measureStart + static_cast<int64_t>(options_.duration * 1e6);
+
+    size_t total = static_cast<size_t>(options_.connections);
+    size_t threads = static_cast<size_t>(options_.threads);
+    std::vector<std::unique_ptr<Worker>> workers;
+    size_t first = 0;
+    for(size_t i = 0; i < threads; ++i){
+        size_t count = total / threads + (i < total % threads ? 1 : 0);
+        workers.emplace_back(new Worker(target, first, count, total));
+        first += count;
+    }
+    std::vector<std::thread> running;
+    for(auto &worker : workers){
+        running.emplace_back(&Worker::run, worker.get());
+    }
+    for(std::thread &thread : running){
+        thread.join();
+    }
+
+    *result = LoadResult();
+    result->elapsed = options_.duration;
+    for(auto &worker : workers){
+        const LoadResult &part = worker->result();
+        result->requests += part.requests;
+        result->bytesRead += part.bytesRead;
+        result->bytesWritten += part.bytesWritten;
+        result->connects += part.connects;
+        result->connectErrors += part.connectErrors;
+        result->readErrors += part.readErrors;
+        result->writeErrors += part.writeErrors;
+        result->timeouts += part.timeouts;
+        result->non2xx += part.non2xx;
+        result->backlogged += part.backlogged;
+        result->latency.merge(part.latency);
+        result->connectLatency.merge(part.connectLatency);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Histogram.h"
+
+namespace bench{
+
+// 一次压测的参数
+struct LoadOptions{
+    std::string host = "127.0.0.1";
+    uint16_t port = 8080;
+    int threads = 2;
+    int connections = 64;               // 总连接数，平均分到各线程
+    double duration = 10.0;             // 秒，计入结果的时长
+    double warmup = 2.0;                // 秒，之前的请求不计入结果
+    double timeout = 5.0;               // 秒，单个请求超过这个时间没有完成时记为超时并重连
+    // 每个连接上同时在途的请求数，大于1即为pipeline
+    int pipeline = 1;
+    // 大于0时为开环：按固定速率（总的请求/秒）发送，不管之前的请求有没有完成；
+    // 延迟从请求按计划应当发出的时刻算起，而不是实际发出的时刻，
+    // 服务端停顿期间本该发出却被积压的请求也计入这段停顿（coordinated omission校正）；
+    // 为0时为闭环：每个连接收到响应后立即发出下一个请求，测量最大吞吐
+    double rate = 0;
+    // 每个请求都新建连接（请求带Connection: close），TLS下即每个请求一次完整握手
+    bool connectionPerRequest = false;
+    bool tls = false;
+    // TLS会话复用，关闭时每次握手都是完整握手
+    bool tlsResume = false;
+    // 按顺序循环发送的请求，各连接从不同的位置开始；每个都是完整的原始报文
+    std::vector<std::string> requests;
+};
+
+struct LoadResult{
+    double elapsed = 0;                 // 秒，实际计入结果的时长
+    uint64_t requests = 0;              // 完成的请求（收到完整响应）
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t connects = 0;              // 建立的连接（TLS下为完成的握手）
+    uint64_t connectErrors = 0;
+    uint64_t readErrors = 0;            // 包括对端提前关闭、TLS错误和无法解析的响应
+    uint64_t writeErrors = 0;
+    uint64_t timeouts = 0;
+    uint64_t non2xx = 0;                // 状态码不是2xx的响应，也计入requests
+    // 开环时应当发出而没有发出的请求（结束时仍积压在连接上的），说明服务端跟不上给定速率
+    uint64_t backlogged = 0;
+    Histogram latency;                  // 微秒
+    Histogram connectLatency;           // 微秒，TCP连接（以及TLS握手）的耗时
+};
+
+// wrk风格的HTTP/1.1压测：每个线程一个epoll，管理自己的一组非阻塞连接；
+// 不使用被测服务端的网络库，避免两边的瓶颈相互掩盖
+class LoadGenerator{
+public:
+    explicit LoadGenerator(const LoadOptions &options);
+
+    // 阻塞执行warmup + duration，返回合并后的结果；参数无效时返回false
+    bool run(LoadResult *result);
+
+private:
+    LoadOptions options_;
+};
+
+}
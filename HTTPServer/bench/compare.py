@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# 比较两次httpload运行的结果（JSON行文件），按场景列出吞吐和延迟分位数的变化
+#
+#   bench/compare.py base.jsonl new.jsonl
+#
+# 同一个文件中同一场景有多条结果时取最后一条
+
+import json
+import sys
+
+METRICS = [
+    ("req/s", lambda r: r["requests_per_sec"], True),
+    ("p50", lambda r: r["latency_us"]["p50"], False),
+    ("p99", lambda r: r["latency_us"]["p99"], False),
+    ("p99.9", lambda r: r["latency_us"]["p99.9"], False),
+    ("max", lambda r: r["latency_us"]["max"], False),
+]
+
+
+def load(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if line:
+                r = json.loads(line)
+                results[(r["scenario"], r["mode"])] = r
+    return results
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: compare.py base.jsonl new.jsonl", file=sys.stderr)
+        return 2
+    base, new = load(sys.argv[1]), load(sys.argv[2])
+    print("%-18s %-6s %14s %14s %9s" % ("scenario", "metric", "base", "new", "change"))
+    for key in sorted(set(base) & set(new)):
+        b, n = base[key], new[key]
+        for name, get, higherIsBetter in METRICS:
+            old, cur = get(b), get(n)
+            change = (cur - old) / old * 100 if old else 0.0
+            # 变好的方向标+，吞吐升高和延迟降低都算变好
+            better = change > 0 if higherIsBetter else change < 0
+            mark = "+" if better and abs(change) >= 1 else ("-" if abs(change) >= 1 else " ")
+            print("%-18s %-6s %14.1f %14.1f %+8.1f%% %s" % ("%s/%s" % key, name, old, cur, change, mark))
+        errors = sum(n["errors"].values())
+        if errors:
+            print("%-18s errors in new run: %s" % ("%s/%s" % key, n["errors"]))
+    for key in sorted(set(base) ^ set(new)):
+        print("%-18s only in %s" % ("%s/%s" % key, "base" if key in base else "new"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
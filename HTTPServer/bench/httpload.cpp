@@ -0,0 +1,331 @@
+// httpload：对本机的示例服务端（BenchServer）运行预定义的压测场景，每个场景输出一行JSON
+//
+//   httpload --scenario all --port 8080 --tls-port 8443 --label $(git rev-parse --short HEAD) --json results.jsonl
+//   httpload --scenario get --rate 50000 -c 128 -d 30
+//
+// 场景：
+//   get        小GET请求，keep-alive
+//   pipeline   同一连接上pipeline多个GET
+//   post       大请求体的POST
+//   handshake  每个请求一个新的TLS连接（完整握手），需要--tls-port
+//   routes     轮流访问大量静态路由和带参数的路由
+// 命令行上给出的参数覆盖场景的默认值；--rate大于0时为开环，延迟经过coordinated omission校正
+// 两次运行的结果用compare.py比较
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "LoadGenerator.h"
+
+namespace{
+
+struct Args{
+    std::string scenario = "all";
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int tlsPort = 0;
+    // 以下为-1（或空）时用场景的默认值
+    int threads = -1;
+    int connections = -1;
+    double duration = -1;
+    double warmup = -1;
+    double timeout = -1;
+    int pipeline = -1;
+    double rate = -1;
+    long bodySize = -1;
+    int routes = -1;
+    bool tlsResume = false;
+    std::string label;
+    std::string jsonFile;
+};
+
+struct Scenario{
+    const char *name;
+    // 场景的默认值，之后再用命令行参数覆盖
+    int connections;
+    int pipeline;
+    bool tls;
+    bool connectionPerRequest;
+    void (*buildRequests)(const Args &args, std::vector<std::string> *requests);
+};
+
+std::string hostHeader(const Args &args, bool tls){
+    return args.host + ":" + std::to_string(tls ? args.tlsPort : args.port);
+}
+
+std::string getRequest(const std::string &path, const std::string &host, bool close){
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n";
+    if(close){
+        request += "Connection: close\r\n";
+    }
+    return request + "\r\n";
+}
+
+void buildHello(const Args &args, std::vector<std::string> *requests){
+    requests->push_back(getRequest("/bench/hello", hostHeader(args, false), false));
+}
+
+void buildHandshake(const Args &args, std::vector<std::string> *requests){
+    requests->push_back(getRequest("/bench/hello", hostHeader(args, true), true));
+}
+
+void buildPost(const Args &args, std::vector<std::string> *requests){
+    size_t size = args.bodySize >= 0 ? static_cast<size_t>(args.bodySize) : 1024 * 1024;
+    std::string request = "POST /bench/echo HTTP/1.1\r\nHost: " + hostHeader(args, false) + "\r\n"
+                          "Content-Type: application/octet-stream\r\n"
+                          "Content-Length: " + std::to_string(size) + "\r\n\r\n";
+    request.append(size, 'x');
+    requests->push_back(std::move(request));
+}
+
+// 和BenchServer注册的路由对应：/bench/route/<i>是静态路由，/bench/r<i>/:id是带参数的路由
+void buildRoutes(const Args &args, std::vector<std::string> *requests){
+    int routes = args.routes > 0 ? args.routes : 500;
+    std::string host = hostHeader(args, false);
+    for(int i = 0; i < routes; ++i){
+        requests->push_back(getRequest("/bench/route/" + std::to_string(i), host, false));
+        requests->push_back(getRequest("/bench/r" + std::to_string(i) + "/" + std::to_string(i * 7), host, false));
+    }
+}
+
+const Scenario kScenarios[] = {
+    {"get",       64, 1,  false, false, buildHello},
+    {"pipeline",  16, 16, false, false, buildHello},
+    {"post",      16, 1,  false, false, buildPost},
+    {"handshake", 32, 1,  true,  true,  buildHandshake},
+    {"routes",    64, 1,  false, false, buildRoutes},
+};
+
+std::string escape(const std::string &s){
+    std::string out;
+    for(char c : s){
+        if(c == '"' || c == '\\'){
+            out += '\\';
+        }
+        if(static_cast<unsigned char>(c) >= 0x20){
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string latencyJson(const bench::Histogram &h){
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"min\":%llu,\"mean\":%.1f,\"stdev\":%.1f,\"p50\":%llu,\"p75\":%llu,\"p90\":%llu,"
+             "\"p99\":%llu,\"p99.9\":%llu,\"p99.99\":%llu,\"max\":%llu}",
+             static_cast<unsigned long long>(h.min()), h.mean(), h.stddev(),
+             static_cast<unsigned long long>(h.percentile(50)),
+             static_cast<unsigned long long>(h.percentile(75)),
+             static_cast<unsigned long long>(h.percentile(90)),
+             static_cast<unsigned long long>(h.percentile(99)),
+             static_cast<unsigned long long>(h.percentile(99.9)),
+             static_cast<unsigned long long>(h.percentile(99.99)),
+             static_cast<unsigned long long>(h.max()));
+    return buf;
+}
+
+std::string resultJson(const Args &args, const Scenario &scenario, const bench::LoadOptions &options,
+                       const bench::LoadResult &result){
+    char buf[1024];
+    double seconds = result.elapsed > 0 ? result.elapsed : 1;
+    snprintf(buf, sizeof(buf),
+             "{\"label\":\"%s\",\"scenario\":\"%s\",\"mode\":\"%s\",\"tls\":%s,\"threads\":%d,\"connections\":%d,"
+             "\"pipeline\":%d,\"rate\":%.0f,\"duration\":%.1f,\"requests\":%llu,\"requests_per_sec\":%.1f,"
+             "\"read_bytes_per_sec\":%.0f,\"write_bytes_per_sec\":%.0f,\"connects\":%llu,\"backlogged\":%llu,"
+             "\"errors\":{\"connect\":%llu,\"read\":%llu,\"write\":%llu,\"timeout\":%llu,\"non2xx\":%llu},",
+             escape(args.label).c_str(), scenario.name, options.rate > 0 ? "open" : "closed",
+             options.tls ? "true" : "false", options.threads, options.connections, options.pipeline,
+             options.rate, result.elapsed,
+             static_cast<unsigned long long>(result.requests), result.requests / seconds,
+             result.bytesRead / seconds, result.bytesWritten / seconds,
+             static_cast<unsigned long long>(result.connects),
+             static_cast<unsigned long long>(result.backlogged),
+             static_cast<unsigned long long>(result.connectErrors),
+             static_cast<unsigned long long>(result.readErrors),
+             static_cast<unsigned long long>(result.writeErrors),
+             static_cast<unsigned long long>(result.timeouts),
+             static_cast<unsigned long long>(result.non2xx));
+    return std::string(buf) + "\"latency_us\":" + latencyJson(result.latency)
+         + ",\"connect_us\":" + latencyJson(result.connectLatency) + "}";
+}
+
+void printSummary(const Scenario &scenario, const bench::LoadOptions &options, const bench::LoadResult &result){
+    const bench::Histogram &h = result.latency;
+    fprintf(stderr, "%-10s %s %dt %dc pipeline=%d: %.0f req/s, %.2f MB/s read\n",
+            scenario.name, options.rate > 0 ? "open" : "closed", options.threads, options.connections,
+            options.pipeline, result.requests / result.elapsed, result.bytesRead / result.elapsed / 1e6);
+    fprintf(stderr, "           latency us: p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n",
+            static_cast<unsigned long long>(h.percentile(50)),
+            static_cast<unsigned long long>(h.percentile(90)),
+            static_cast<unsigned long long>(h.percentile(99)),
+            static_cast<unsigned long long>(h.percentile(99.9)),
+            static_cast<unsigned long long>(h.max()));
+    uint64_t errors = result.connectErrors + result.readErrors + result.writeErrors + result.timeouts;
+    if(errors > 0 || result.non2xx > 0 || result.backlogged > 0){
+        fprintf(stderr, "           errors: connect=%llu read=%llu write=%llu timeout=%llu non2xx=%llu backlogged=%llu\n",
+                static_cast<unsigned long long>(result.connectErrors),
+                static_cast<unsigned long long>(result.readErrors),
+                static_cast<unsigned long long>(result.writeErrors),
+                static_cast<unsigned long long>(result.timeouts),
+                static_cast<unsigned long long>(result.non2xx),
+                static_cast<unsigned long long>(result.backlogged));
+    }
+}
+
+bool runScenario(const Args &args, const Scenario &scenario){
+    bench::LoadOptions options;
+    options.host = args.host;
+    options.tls = scenario.tls;
+    options.port = static_cast<uint16_t>(scenario.tls ? args.tlsPort : args.port);
+    options.connectionPerRequest = scenario.connectionPerRequest;
+    options.tlsResume = args.tlsResume;
+    options.connections = args.connections > 0 ? args.connections : scenario.connections;
+    options.pipeline = args.pipeline > 0 ? args.pipeline : scenario.pipeline;
+    if(args.threads > 0){
+        options.threads = args.threads;
+    }
+    if(args.duration > 0){
+        options.duration = args.duration;
+    }
+    if(args.warmup >= 0){
+        options.warmup = args.warmup;
+    }
+    if(args.timeout > 0){
+        options.timeout = args.timeout;
+    }
+    if(args.rate > 0){
+        options.rate = args.rate;
+    }
+    scenario.buildRequests(args, &options.requests);
+
+    bench::LoadGenerator generator(options);
+    bench::LoadResult result;
+    if(!generator.run(&result)){
+        return false;
+    }
+    // 打印的是修正之后的参数（比如连接数不少于线程数）
+    options.threads = std::max(1, options.threads);
+    options.connections = std::max(options.threads, options.connections);
+    if(options.connectionPerRequest){
+        options.pipeline = 1;
+    }
+    printSummary(scenario, options, result);
+    std::string line = resultJson(args, scenario, options, result);
+    printf("%s\n", line.c_str());
+    fflush(stdout);
+    if(!args.jsonFile.empty()){
+        FILE *file = fopen(args.jsonFile.c_str(), "a");
+        if(!file){
+            perror(args.jsonFile.c_str());
+            return false;
+        }
+        fprintf(file, "%s\n", line.c_str());
+        fclose(file);
+    }
+    return result.requests > 0;
+}
+
+void usage(const char *prog){
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s, --scenario NAME   get|pipeline|post|handshake|routes|all (default all)\n"
+            "  -H, --host HOST       default 127.0.0.1\n"
+            "  -p, --port PORT       plaintext port, default 8080\n"
+            "  -T, --tls-port PORT   TLS port for the handshake scenario, skipped when 0\n"
+            "  -t, --threads N       client threads, default 2\n"
+            "  -c, --connections N   total connections\n"
+            "  -d, --duration SEC    measured duration, default 10\n"
+            "  -w, --warmup SEC      unmeasured warmup, default 2\n"
+            "  -R, --rate N          open loop at N requests/sec in total (corrected latency)\n"
+            "  -P, --pipeline N      requests in flight per connection\n"
+            "      --timeout SEC     per-request timeout, default 5\n"
+            "      --body-size N     POST body size, default 1048576\n"
+            "      --routes N        distinct routes for the routes scenario, default 500\n"
+            "      --tls-resume      resume TLS sessions in the handshake scenario\n"
+            "  -l, --label TEXT      recorded in every result, e.g. a commit id\n"
+            "  -o, --json FILE       append results to FILE as JSON lines\n",
+            prog);
+}
+
+}
+
+int main(int argc, char *argv[]){
+    enum{kTimeout = 256, kBodySize, kRoutes, kTlsResume};
+    static const struct option longOptions[] = {
+        {"scenario", required_argument, nullptr, 's'},
+        {"host", required_argument, nullptr, 'H'},
+        {"port", required_argument, nullptr, 'p'},
+        {"tls-port", required_argument, nullptr, 'T'},
+        {"threads", required_argument, nullptr, 't'},
+        {"connections", required_argument, nullptr, 'c'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"warmup", required_argument, nullptr, 'w'},
+        {"rate", required_argument, nullptr, 'R'},
+        {"pipeline", required_argument, nullptr, 'P'},
+        {"timeout", required_argument, nullptr, kTimeout},
+        {"body-size", required_argument, nullptr, kBodySize},
+        {"routes", required_argument, nullptr, kRoutes},
+        {"tls-resume", no_argument, nullptr, kTlsResume},
+        {"label", required_argument, nullptr, 'l'},
+        {"json", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    Args args;
+    int opt;
+    while((opt = getopt_long(argc, argv, "s:H:p:T:t:c:d:w:R:P:l:o:h", longOptions, nullptr)) != -1){
+        switch(opt){
+            case 's': args.scenario = optarg; break;
+            case 'H': args.host = optarg; break;
+            case 'p': args.port = atoi(optarg); break;
+            case 'T': args.tlsPort = atoi(optarg); break;
+            case 't': args.threads = atoi(optarg); break;
+            case 'c': args.connections = atoi(optarg); break;
+            case 'd': args.duration = atof(optarg); break;
+            case 'w': args.warmup = atof(optarg); break;
+            case 'R': args.rate = atof(optarg); break;
+            case 'P': args.pipeline = atoi(optarg); break;
+            case kTimeout: args.timeout = atof(optarg); break;
+            case kBodySize: args.bodySize = atol(optarg); break;
+            case kRoutes: args.routes = atoi(optarg); break;
+            case kTlsResume: args.tlsResume = true; break;
+            case 'l': args.label = optarg; break;
+            case 'o': args.jsonFile = optarg; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    bool ok = true;
+    bool found = false;
+    for(const Scenario &scenario : kScenarios){
+        if(args.scenario != "all" && args.scenario != scenario.name){
+            continue;
+        }
+        found = true;
+        if(scenario.tls && args.tlsPort <= 0){
+            if(args.scenario != "all"){
+                fprintf(stderr, "%s needs --tls-port\n", scenario.name);
+                ok = false;
+            }
+            continue;
+        }
+        if(!runScenario(args, scenario)){
+            fprintf(stderr, "%s: no successful requests\n", scenario.name);
+            ok = false;
+        }
+    }
+    if(!found){
+        usage(argv[0]);
+        return 2;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#!/bin/bash
+# 在本机启动BenchServer（明文和TLS各一个进程），依次运行httpload的全部场景，结果追加到JSON行文件
+#
+#   bench/run.sh results.jsonl [httpload的其它参数...]
+#
+# 环境变量：
+#   BENCH_SERVER  BenchServer可执行文件，默认./bench_server
+#   HTTPLOAD      httpload可执行文件，默认./httpload
+#   PORT/TLS_PORT 默认8080/8443
+#   SERVER_ARGS   传给两个BenchServer的额外参数，比如 "--threads 8"
+#   LABEL         写进每条结果，默认当前的git提交
+#
+# 比较两次运行：bench/compare.py base.jsonl new.jsonl
+
+set -e
+
+OUT=${1:?usage: $0 results.jsonl [httpload options]}
+shift
+
+BENCH_SERVER=${BENCH_SERVER:-./bench_server}
+HTTPLOAD=${HTTPLOAD:-./httpload}
+PORT=${PORT:-8080}
+TLS_PORT=${TLS_PORT:-8443}
+LABEL=${LABEL:-$(git rev-parse --short HEAD 2>/dev/null || echo unknown)}
+
+WORK=$(mktemp -d)
+PIDS=""
+cleanup(){
+    for pid in $PIDS; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+# 握手场景用的自签名证书
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -keyout "$WORK/key.pem" -out "$WORK/cert.pem" >/dev/null 2>&1
+
+"$BENCH_SERVER" --port "$PORT" $SERVER_ARGS &
+PIDS="$PIDS $!"
+"$BENCH_SERVER" --port "$TLS_PORT" --tls "$WORK/cert.pem" "$WORK/key.pem" $SERVER_ARGS &
+PIDS="$PIDS $!"
+
+# 等两个端口都开始监听
+for port in "$PORT" "$TLS_PORT"; do
+    tries=0
+    until (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; do
+        tries=$((tries + 1))
+        if [ "$tries" -gt 50 ]; then
+            echo "server on port $port did not start" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+done
+
+"$HTTPLOAD" --scenario all --port "$PORT" --tls-port "$TLS_PORT" --label "$LABEL" --json "$OUT" "$@"
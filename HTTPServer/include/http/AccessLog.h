@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/base/Timestamp.h>
+
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+
+namespace http{
+
+struct AccessLogConfig{
+    enum Level{
+        kOff,           // 不记录
+        kErrors,        // 只记录状态码>=400或者超过slowThreshold的请求
+        kAll,           // 全部请求，其中正常的请求按sampleRate抽样
+    };
+    Level level = kOff;
+    // kAll下正常请求的抽样比例，1为全部记录；错误和慢请求总是记录
+    double sampleRate = 1.0;
+    double slowThreshold = 1.0;         // 秒，0表示不按耗时判断
+    // 日志文件，追加写；为空时写到标准输出
+    std::string path;
+    // 每个线程的记录环的容量（条，取整到2的幂），后台线程来不及写时新记录被丢弃并计数
+    size_t ringCapacity = 4096;
+    double flushInterval = 0.2;         // 秒，后台线程批量写出的周期
+};
+
+// 访问日志：请求线程只把定长的二进制记录（方法、路径、状态码、大小、耗时）写进本线程的无锁环，
+// 不格式化、不分配内存、不加锁；后台线程定期取出所有环中的记录，格式化成一批文本后一次写出
+//
+// 每行格式：
+//   2026-10-19 08:00:00.123456 GET /path HTTP/1.1 200 req=0 resp=1024 us=87
+// 路径超过kMaxPathLength字节时截断
+class AccessLog : muduo::noncopyable{
+public:
+    explicit AccessLog(const AccessLogConfig &config);
+    // 写出剩余的记录后返回
+    ~AccessLog();
+
+    // 请求处理完之后在请求线程中调用；按级别和抽样决定是否记录，kOff时只有一次比较的开销
+    void log(const HttpRequest &req, const HttpResponse &resp);
+
+    // 因为环满而丢弃的记录数
+    uint64_t dropped() const {return dropped_.load(std::memory_order_relaxed);}
+
+    static constexpr size_t kMaxPathLength = 88;
+
+private:
+    // 定长记录，128字节
+    struct Record{
+        int64_t time;                   // 请求的接收时间，微秒
+        uint64_t requestBytes;
+        uint64_t responseBytes;
+        uint32_t latency;               // 微秒
+        uint16_t status;
+        uint8_t method;
+        uint8_t version;                // 0:HTTP/1.0 1:HTTP/1.1 2:HTTP/2 3:其它
+        uint8_t pathLength;
+        char path[kMaxPathLength];
+    };
+    static_assert(sizeof(Record) == 128, "Record should stay 128 bytes");
+
+    // 单生产者单消费者的环：生产者是拥有它的请求线程，消费者是后台线程
+    struct Ring{
+        explicit Ring(size_t capacity);
+
+        std::vector<Record> records;
+        size_t mask;
+        alignas(64) std::atomic<uint64_t> head;    // 消费者读到的位置
+        alignas(64) std::atomic<uint64_t> tail;    // 生产者写到的位置
+    };
+    using RingPtr = std::shared_ptr<Ring>;
+
+    // 本线程的环，第一次调用时创建并登记
+    Ring *localRing();
+    bool sampled();
+    void push(const Record &record);
+
+    void threadFunc();
+    // 取出所有环中的记录格式化到batch，返回取出的条数；同时回收所属线程已经退出的空环
+    size_t drain(std::string *batch);
+    static void format(const Record &record, std::string *batch);
+
+private:
+    AccessLogConfig config_;
+    // 抽样：随机数小于阈值时记录
+    uint32_t sampleThreshold_;
+    uint64_t id_;                       // 区分同一线程用到的不同AccessLog
+    FILE *file_;
+    std::atomic<uint64_t> dropped_;
+
+    std::mutex ringsMutex_;
+    std::vector<RingPtr> rings_;
+
+    std::atomic<bool> running_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+};
+
+}
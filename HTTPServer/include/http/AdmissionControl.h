@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/EventLoop.h>
+
+namespace http{
+
+struct AdmissionConfig{
+    // 连接数上限（整个服务器 / 每个客户端IP），超出时新连接直接关闭；0表示不限制
+    size_t maxConnections = 0;
+    size_t maxConnectionsPerIp = 0;
+    // 同时在处理的请求数上限，超出时返回503；0表示不限制
+    size_t maxInflightRequests = 0;
+
+    // 自适应减载：请求从读入到开始处理的排队时间在一整个观察周期内都高于目标值（连最快的请求都要排队），
+    // 或者IO线程的定时器延迟超过目标值时，认为该线程过载，在下一个周期内排队超过目标值的请求直接返回503
+    bool loadShedding = false;
+    double targetQueueDelay = 0.05;     // 秒
+    double interval = 0.1;              // 观察周期（秒）
+    // 503响应中 Retry-After 的秒数
+    int retryAfter = 1;
+};
+
+// 连接数计数，所有IO线程共用；按客户端IP分片加锁，不同IP的连接建立互不阻塞
+class ConnectionLimiter : muduo::noncopyable{
+public:
+    ConnectionLimiter(size_t maxConnections, size_t maxConnectionsPerIp);
+
+    // 成功时计入这个连接，之后必须调用release()
+    bool tryAcquire(const std::string &ip);
+    void release(const std::string &ip);
+    size_t connections() const {return total_.load(std::memory_order_relaxed);}
+
+private:
+    struct alignas(64) Shard{
+        std::mutex mutex;
+        std::unordered_map<std::string, size_t> counts;
+    };
+    Shard &shardFor(const std::string &ip);
+
+private:
+    size_t maxConnections_;
+    size_t maxConnectionsPerIp_;
+    std::atomic<size_t> total_;
+    std::vector<Shard> shards_;
+};
+
+// 一个IO线程的过载检测，只在该线程中访问
+// 思路同CoDel：短时的突发会让个别请求排队，但只要周期内还有请求能立刻被处理就不算过载；
+// 只有排队时间的最小值都超过目标值（形成了持续的队列）才开始减载，让剩下的请求仍然能快速完成
+class LoadShedder : muduo::noncopyable{
+public:
+    LoadShedder(muduo::net::EventLoop *loop, double targetQueueDelay, double interval);
+    // 在loop所在的线程中析构
+    ~LoadShedder();
+
+    // 请求开始处理时调用，queueDelay为请求从读入到现在的秒数；返回true表示应当直接返回503
+    bool shouldShed(double queueDelay);
+    bool overloaded() const {return overloaded_;}
+
+private:
+    void onTimer();
+
+private:
+    muduo::net::EventLoop *loop_;
+    muduo::net::TimerId timerId_;
+    double targetQueueDelay_;
+    double interval_;
+    muduo::Timestamp lastTick_;
+    double minQueueDelay_;      // 本周期内最小的排队时间，没有请求时为无穷大
+    bool overloaded_;
+};
+
+}
@@ -1,11 +1,20 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <muduo/net/TcpServer.h>
 
 #include "HttpRequest.h"
+#include "TimingWheel.h"
+
+namespace ssl{
+class SslConnection;
+}
 
 namespace http{
+namespace http2{
+class Http2Connection;
+}
 
 // 用于在HTTP请求解析过程中存储当前解析的状态、请求内容（HttpRequest），并提供解析方法。
 class HttpContext{
@@ -18,8 +27,22 @@ public:
         kGotAll,        // 解析完成
     };
 
+    // 连接当前所处的超时阶段，不同阶段的超时时间不同
+    enum TimeoutPhase{
+        kTimeoutNone,       // 还没有开始计时，或者上一个请求刚处理完
+        kTimeoutIdle,       // 两个请求之间的空闲
+        kTimeoutHeaders,    // 请求已经开始，等待请求头收齐
+        kTimeoutBody,       // 请求头已收齐，等待请求体收齐
+    };
+
     HttpContext()
         : state_(kExpectRequestLine)
+        , timingWheel_(nullptr)
+        , timeoutPhase_(kTimeoutNone)
+        , writePaused_(false)
+        , requestDeferred_(false)
+        , maxBodySize_(0)
+        , bodyTooLarge_(false)
     {
     }
 
@@ -35,6 +58,7 @@ public:
     // 这样写是为了避免构造新对象时调用 request_ 的析构函数，性能更好。
     void reset(){
         state_ = kExpectRequestLine;
+        timeoutPhase_ = kTimeoutNone;   // 下一个请求重新计时
         HttpRequest dummyData;
         request_.swap(dummyData);  // 交换数据，避免深拷贝
     }
@@ -47,12 +71,71 @@ public:
         return request_;
     }
 
+    // HTTPS连接的SslConnection和解析状态一起挂在TcpConnection的context上，
+    // 收发数据时直接从连接取得，不需要全局查表；SslConnection持有TcpConnectionPtr，
+    // 断开连接时必须置空以打破循环引用
+    void setSslConnection(std::shared_ptr<ssl::SslConnection> sslConn){
+        sslConn_ = std::move(sslConn);
+    }
+    ssl::SslConnection *sslConnection() const {
+        return sslConn_.get();
+    }
+
+    // 协商为HTTP/2的连接由Http2Connection处理，上面的HTTP/1.x状态机不再使用
+    void setHttp2Connection(std::shared_ptr<http2::Http2Connection> http2Conn){
+        http2Conn_ = std::move(http2Conn);
+    }
+    http2::Http2Connection *http2Connection() const {
+        return http2Conn_.get();
+    }
+
+    // 是否处于两个请求之间（没有解析到一半的请求）
+    bool expectRequestLine() const {
+        return state_ == kExpectRequestLine;
+    }
+    bool expectBody() const {
+        return state_ == kExpectBody;
+    }
+
+    // 连接所在IO线程的时间轮和当前阶段的超时条目
+    void setTimingWheel(TimingWheel *wheel) {timingWheel_ = wheel;}
+    TimingWheel *timingWheel() const {return timingWheel_;}
+    void setTimeout(TimeoutPhase phase, const TimingWheel::WeakEntryPtr &entry){
+        timeoutPhase_ = phase;
+        timeoutEntry_ = entry;
+    }
+    TimeoutPhase timeoutPhase() const {return timeoutPhase_;}
+    const TimingWheel::WeakEntryPtr &timeoutEntry() const {return timeoutEntry_;}
+
+    // 连接的发送缓冲区超过高水位后置位，期间不读取、不解析新的请求，
+    // 其他往这个连接写数据的生产者也应当据此暂停，直到缓冲区排空
+    void setWritePaused(bool paused) {writePaused_ = paused;}
+    bool writePaused() const {return writePaused_;}
+
+    // 已经解析完的请求在等待预取的会话，结果到达后再处理，期间不解析后续数据
+    void setRequestDeferred(bool deferred) {requestDeferred_ = deferred;}
+    bool requestDeferred() const {return requestDeferred_;}
+
+    // 请求体上限（字节），0表示不限制：Content-Length超过它时parseRequest()返回false，
+    // 此时bodyTooLarge()为true，调用者应回复413而不是400，请求体不会被读进来
+    void setMaxBodySize(size_t bytes) {maxBodySize_ = bytes;}
+    bool bodyTooLarge() const {return bodyTooLarge_;}
+
 private:
     // 解析第一行请求行
     bool processRequestLine(const char *start, const char *end);
 private:
     HttpRequestParseState state_;  // 当前解析状态    
     HttpRequest request_;  // 当前正在构建的请求对象
+    std::shared_ptr<ssl::SslConnection> sslConn_;   // 非HTTPS连接为空
+    std::shared_ptr<http2::Http2Connection> http2Conn_;
+    TimingWheel *timingWheel_;
+    TimeoutPhase timeoutPhase_;
+    TimingWheel::WeakEntryPtr timeoutEntry_;
+    bool writePaused_;
+    bool requestDeferred_;
+    size_t maxBodySize_;
+    bool bodyTooLarge_;
 
 };
 
@@ -30,7 +30,7 @@ public:
 
     // 设置和获取请求路径
     void setPath(const char *start, const char *end);
-    std::string path() const {return path_;}
+    const std::string &path() const {return path_;}
 
     // 设置和获取路径参数
     void setPathParameters(const std::string &key, const std::string &value);
@@ -44,12 +44,13 @@ public:
     void setVersion(std::string V){
         version_ = V;
     }
-    std::string getVersion() const {
+    const std::string &getVersion() const {
         return version_;
     }
 
     // 请求头处理
     void addHeader(const char *start, const char *colon, const char *end);
+    void addHeader(const std::string &field, const std::string &value);
     std::string getHeader(const std::string &field) const;
     const std::map<std::string, std::string> &headers() const {
         return headers_;
@@ -62,7 +63,7 @@ public:
             content_.assign(start, end - start);
         }
     }
-    std::string getBody() const {return content_;}
+    const std::string &getBody() const {return content_;}
 
     // 设置和获取请求体长度
     void setContentLength(uint64_t length){
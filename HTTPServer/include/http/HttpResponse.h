@@ -17,7 +17,9 @@ public:
         k403Forbidden = 403,
         k404NotFound = 404,
         k409Confict = 409,
+        k413PayloadTooLarge = 413,
         k500InternalServerError = 500,
+        k503ServiceUnavailable = 503,
     };
 
     HttpResponse(bool close = true)
@@ -48,8 +50,18 @@ public:
         headers_[key] = value;
     }
 
+    // 追加已经格式化好的头部字节（形如 "Key: Value\r\n"），appendToBuffer时原样输出
+    // 适用于中间件预先拼好的固定头部块，省去逐个插入map和重复拼接字符串的开销
+    void appendRawHeaders(const std::string &headers) {rawHeaders_.append(headers);}
+    void appendRawHeaders(const char *data, size_t len) {rawHeaders_.append(data, len);}
+
     void setBody(const std::string &body) {body_ = body;}
 
+    // 供HTTP/2按字段重新编码响应
+    const std::map<std::string, std::string> &headers() const {return headers_;}
+    const std::string &rawHeaders() const {return rawHeaders_;}
+    const std::string &body() const {return body_;}
+
     // 设置http相应状态行
     void setStatusLine(const std::string &version,
                         HttpStatusCode statusCode,
@@ -66,6 +78,7 @@ private:
     std::string statusMessage_;  // 状态码对应的文字，如"OK"、"Not Found"
     bool closeConnection_;  // 是否关闭TCP链接，决定响应头中的Connection字段
     std::map<std::string, std::string> headers_;  // 存放响应头
+    std::string rawHeaders_;  // 预格式化的响应头块，直接追加到输出
     std::string body_;  // http响应体
     bool isFile_;  // 是否是文件相应
 };
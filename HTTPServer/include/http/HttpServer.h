@@ -4,23 +4,36 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <functional>
+#include <future>
 #include <iostream>
-#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <muduo/net/TcpServer.h>
 #include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
 #include <muduo/base/Logging.h>
 
+#include "AccessLog.h"
+#include "AdmissionControl.h"
 #include "HttpContext.h"
 #include "HttpRequest.h"
 #include "HttpResponse.h"
+#include "Listener.h"
+#include "ListenerHandover.h"
+#include "TimingWheel.h"
+#include "../http2/Http2Connection.h"
 #include "../router/Router.h"
 #include "../session/SessionManager.h"
 #include "../middleware/MiddlewareChain.h"
 #include "../middleware/cors/CorsMiddleware.h"
+#include "../middleware/session/SessionMiddleware.h"
 #include "../ssl/SslConnection.h"
 #include "../ssl/SslContext.h"
 
@@ -29,6 +42,10 @@ class HttpResponse;
 
 namespace http{
 
+namespace uring{
+class IoUringServer;
+}
+
 class HttpServer : muduo::noncopyable{
 public:
     using HttpCallback = std::function<void (const HttpRequest &, HttpResponse *)>;
@@ -37,16 +54,49 @@ public:
                const std::string &name,
                bool useSSL = false,
                muduo::net::TcpServer::Option option = muduo::net::TcpServer::kNoReusePort);
+    ~HttpServer();
 
     // 基础配置
     void setThreadNum(int numThreads){
-        server_.setThreadNum(numThreads);
+        threadPool_->setThreadNum(numThreads);
     }
 
     void start();
 
-    muduo::net::EventLoop *getLoop() const{
-        return server_.getLoop();
+    // 优雅关闭：停止accept，之后的响应都带上Connection: close（HTTP/2连接发送GOAWAY），立即关闭空闲的连接，
+    // 其余连接处理完当前请求后关闭；连接全部关闭或者超过宽限期后start()返回，剩下的连接在析构时强制关闭
+    // 没有交接给继任者时，accept队列中已经完成握手的连接先接进来照常服务，之后才关闭监听socket
+    // 可以在任意线程调用，但不能在信号处理函数中调用，信号用stopOnSignals()
+    void stop();
+    void setShutdownGracePeriod(double seconds) {shutdownGracePeriod_ = seconds;}
+    // 收到SIGTERM或SIGINT时调用stop()，需要在start()之前设置
+    void stopOnSignals() {stopOnSignals_ = true;}
+
+    // 重启时交接监听socket（见ListenerHandover），需要在start()之前设置，新旧进程使用同一个path：
+    // start()时如果path上有前任，就接过它的监听socket代替新建的，开始accept后通知前任排空退出，
+    // 之后自己在path上等待下一个继任者；在start()之前完成预热，就不会有请求落到还没准备好的进程上
+    // 要求以kReusePort构造：接过来的socket不够用时要新建，前任还在监听时只有两边都开启了SO_REUSEPORT才能绑定
+    // 新旧进程的监听数（多监听模式的线程数）最好相同，多出来的socket会被关闭，其accept队列中的连接随之丢失
+    void setHandoverPath(const std::string &path);
+
+    // SO_REUSEPORT多监听模式，需要以kReusePort构造并在start()之前设置：
+    // 启动numListeners个线程，每个线程有自己的EventLoop和监听socket，自己accept、自己处理，
+    // 连接不在线程之间转交，由内核在各监听socket之间分配；此模式下setThreadNum()不起作用，
+    // 主循环只运行会话清理之类的定时任务
+    // pinCpu把第i个线程绑定到第i个CPU（超过CPU数时取模）；
+    // cpuSteering再给监听组挂一个CBPF程序，连接交给收到它的CPU上的监听线程，处理过程不离开这个核，
+    // 要求numListeners不超过CPU数，并配合网卡RSS/RPS把连接分散到这些CPU上
+    void setReusePortListeners(int numListeners, bool pinCpu = true, bool cpuSteering = false);
+
+    // 改用io_uring后端收发数据，需要在start()之前设置：numThreads个线程各自监听（SO_REUSEPORT）并处理连接，
+    // accept/recv/send都经由io_uring批量提交，省去每次读写各一次系统调用；路由、中间件、准入检查和超时设置照常生效
+    // 只支持明文HTTP/1.x：启用了SSL或HTTP/2，或者内核不支持（需要6.0以上）时仍使用muduo
+    void enableIoUring(int numThreads){
+        ioUringThreads_ = numThreads;
+    }
+
+    muduo::net::EventLoop *getLoop(){
+        return &mainLoop_;
     }
 
     // 注册回调
@@ -78,15 +128,48 @@ public:
         router_.addRegexHandler(method, path, handler);
     }
 
+    // 连接超时（秒），为0表示不限制，需要在start()之前设置：
+    // idle为keep-alive连接两个请求之间允许的空闲时间（HTTP/2连接任何数据都算活动），
+    // headers为从收到请求的第一个字节到请求头收齐的期限，body为请求头收齐后到请求体收齐的期限；
+    // 后两者是固定期限，慢慢发送数据并不能延长，用于防御slowloris一类的慢速攻击
+    void setIdleTimeout(int seconds) {idleTimeout_ = seconds;}
+    void setHeaderTimeout(int seconds) {headerTimeout_ = seconds;}
+    void setBodyTimeout(int seconds) {bodyTimeout_ = seconds;}
+
+    // 单个连接发送缓冲区的高水位（字节），需要在start()之前设置：
+    // 积压的响应超过它时停止读取和解析这个连接的后续请求，排空后再继续，
+    // 读得慢又不停流水线发请求的客户端占用的内存因此不超过高水位加一个响应
+    void setHighWaterMark(size_t bytes) {highWaterMark_ = bytes;}
+
+    // 单个请求体的上限（字节），0表示不限制，需要在start()之前设置：
+    // HTTP/1.x的Content-Length超过它时回复413并关闭连接；HTTP/2的流超过它时回复413并重置该流，
+    // 一个HTTP/2连接上所有流缓存的请求体合计不超过它的4倍
+    void setMaxBodySize(size_t bytes) {maxBodySize_ = bytes;}
+
+    // 准入控制：连接数上限、同时处理的请求数上限和过载时的自适应减载，需要在start()之前设置
+    void setAdmissionConfig(const AdmissionConfig &config);
+
+    // 访问日志：每个请求（含被准入控制拒绝的）处理完后按配置的级别和抽样记录，由后台线程批量写出
+    void setAccessLog(const AccessLogConfig &config){
+        accessLog_ = config.level == AccessLogConfig::kOff ? nullptr : std::make_unique<AccessLog>(config);
+    }
+
     // 会话管理
+    // 同时注册SessionMiddleware，在每个请求结束时把修改过的会话写回存储
     void setSessionManager(std::unique_ptr<session::SessionManager> manager){
         sessionManager_ = std::move(manager);
+        middlewareChain_.addMiddleware(std::make_shared<middleware::SessionMiddleware>(sessionManager_.get()));
     }
 
     session::SessionManager *getSessionManager() const {
         return sessionManager_.get();   // 返回智能指针中保留的裸指针
     }
 
+    // 过期会话的清理周期（秒），在start()时注册到主循环
+    void setSessionCleanInterval(double seconds){
+        sessionCleanInterval_ = seconds;
+    }
+
     // 添加中间件
     void addMiddleware(std::shared_ptr<middleware::Middleware> middleware){
         middlewareChain_.addMiddleware(middleware);
@@ -99,33 +182,150 @@ public:
 
     void setSslConfig(const ssl::SslConfig &config);
 
+    // 启用HTTP/2：HTTPS连接通过ALPN协商，明文连接接受以连接前言开头的h2c（先验知识）
+    // 需要在setSslConfig()之前调用
+    void enableHttp2(bool enable){
+        http2Enabled_ = enable;
+    }
+
+    // 证书续期后重新加载全部证书，不需要重启，新的握手立即使用新证书
+    // 在调用线程中读取证书文件，不要在IO线程中调用
+    bool reloadCertificates(){
+        return sslCtx_ && sslCtx_->reloadCertificates();
+    }
+
 private:
+    struct LoopState;
+
     void initialize();
+    // 启动io_uring后端，条件不满足或启动失败时返回false
+    bool startIoUring();
+    // 多监听模式下一个监听线程的主体，监听开始后通过ready通知start()
+    void runListener(int index, std::promise<void> *ready);
+    // 第index个监听使用的socket：接过来的socket中的第index个，没有时新建
+    int listenerSocket(size_t index);
+    // 开始在listener上accept并登记它，连接交给ioLoop（为空时轮流交给线程池中的各个循环）处理
+    bool startListener(Listener *listener, muduo::net::EventLoop *ioLoop);
+    // 本进程的监听socket，按监听的顺序，交接时发给继任者
+    std::vector<int> listeningFds();
+    void installStopSignals();
+
+    // 继任者已经开始accept，在主循环中执行
+    void onHandedOver();
+    // 排空，在主循环中执行
+    void startDrain();
+    // 关闭loop上的空闲连接，给HTTP/2连接发送GOAWAY
+    void closeIdleConnections(muduo::net::EventLoop *loop);
+    // 连接全部关闭或者超过宽限期时结束主循环
+    void checkDrained();
 
     // 连接管理
-    void onConnection(const muduo::net::TcpConnectionPtr &conn);
+    // 新连接在accept所在的线程中创建，之后交给ioLoop
+    void newConnection(muduo::net::EventLoop *ioLoop, int sockfd, const muduo::net::InetAddress &peerAddr);
+    // 连接关闭，在连接所属的IO线程中执行
+    void removeConnection(const muduo::net::TcpConnectionPtr &conn);
+    // 销毁loop上剩下的连接，停掉时间轮和减载的定时器，在loop所在的线程中执行
+    void destroyConnections(muduo::net::EventLoop *loop);
+    // sockfd为accept得到的连接socket，kTLS要用它
+    void onConnection(const muduo::net::TcpConnectionPtr &conn, int sockfd);
     // 数据接收与解析 onMessage()+HttpContext
     void onMessage(const muduo::net::TcpConnectionPtr &conn,
                    muduo::net::Buffer *buf,
                    muduo:Timestamp receiveTime);
     //
     void onRequest(const muduo::net::TcpConnectionPtr &, const httpRequest &);
+    // 发送缓冲区超过高水位 / 排空时暂停和恢复连接的读取
+    void onHighWaterMark(const muduo::net::TcpConnectionPtr &conn, size_t bytes);
+    void onWriteComplete(const muduo::net::TcpConnectionPtr &conn);
+    void pauseReading(const muduo::net::TcpConnectionPtr &conn, HttpContext *context);
+    // 预取的会话到达后处理推迟的请求
+    void onDeferredRequest(const muduo::net::TcpConnectionPtr &conn);
+    // IO线程启动时为它创建时间轮和过载检测
+    void onThreadInit(muduo::net::EventLoop *loop);
+    // loop的LoopState，只能在loop所在的线程中调用；不是本服务的IO线程时返回nullptr
+    LoopState *loopState(muduo::net::EventLoop *loop) const;
+    // 根据解析状态切换连接的超时阶段；阶段不变时期限不变
+    void updateTimeout(const muduo::net::TcpConnectionPtr &conn, HttpContext *context,
+                       HttpContext::TimeoutPhase phase);
+    // 判断连接是否应该按HTTP/2处理，是的话创建Http2Connection
+    // 返回false表示收到的数据还不足以判断（不完整的h2c连接前言）
+    bool maybeStartHttp2(const muduo::net::TcpConnectionPtr &conn, HttpContext *context,
+                         muduo::net::Buffer *buf);
+    // HTTP/1和HTTP/2的请求都经过这里：准入检查、处理，最后记录访问日志
+    void serve(muduo::net::EventLoop *loop, const HttpRequest &req, HttpResponse *resp);
+    // 先做准入检查，通过后才交给httpCallback_
+    void admitAndHandle(muduo::net::EventLoop *loop, const HttpRequest &req, HttpResponse *resp);
+    // 过载或超出请求数上限时的快速503响应，不经过中间件和路由
+    void rejectRequest(HttpResponse *resp);
     // 请求分发 handleRequest() + router_
     void handleRequest(const HttpRequest &req, HttpResponse *resp);
 
 
+private:
+    // 每个IO线程各自的状态，只在该线程中访问
+    struct LoopState{
+        muduo::net::EventLoop                   *loop = nullptr;
+        std::unique_ptr<TimingWheel>            timingWheel;
+        std::unique_ptr<LoadShedder>            loadShedder;
+        // 本线程的连接，从建立到关闭都由这里持有；排空时用来找出空闲的连接
+        std::unordered_set<muduo::net::TcpConnectionPtr> connections;
+    };
+
 private:
     muduo::net::InetAddress                     listenAddr_;    // 监听地址
-    muduo::net::TcpServer                       server_;
+    std::string                                 name_;
     muduo::net::EventLoop                       mainLoop_;
+    // 主监听模式的IO线程，以及主循环上的监听
+    std::unique_ptr<muduo::net::EventLoopThreadPool> threadPool_;
+    std::unique_ptr<Listener>                   listener_;
+    std::atomic<uint64_t>                       nextConnId_;
     HttpCallback                                httpCallback_;     // 请求回调
     router::Router                              router_;
     std::unique_ptr<session::SessionManager>    sessionManager_;
+    double                                      sessionCleanInterval_;
     middleware::MiddlewareChain                 middlewareChain_;
     std::unique_ptr<ssl::SslContext>            sslCtx_;
     bool                                        useSSL_;
-    // TcpConnectionPtr -> SslConnection
-    std::map<muduo::net::TcpConnectionPtr, std:unique_ptr<ssl::SslConnection>> sslConns_; 
+    bool                                        http2Enabled_;
+    int                                         idleTimeout_;
+    int                                         headerTimeout_;
+    int                                         bodyTimeout_;
+    size_t                                      highWaterMark_;
+    size_t                                      maxBodySize_;
+    muduo::net::TcpServer::Option               option_;
+    // 多监听模式：监听数（0表示不启用）、各监听线程和它们的EventLoop（用于退出时结束循环）；
+    // listeners_为两种模式下正在accept的监听，排空时停止它们
+    int                                         reusePortListeners_;
+    bool                                        pinListeners_;
+    bool                                        cpuSteering_;
+    std::vector<std::thread>                    listenerThreads_;
+    std::mutex                                  listenerLoopsMutex_;
+    std::vector<muduo::net::EventLoop *>        listenerLoops_;
+    std::vector<Listener *>                     listeners_;
+    int                                         ioUringThreads_;
+    std::unique_ptr<uring::IoUringServer>       uringServer_;
+    // 各监听的socket，按监听的顺序；交接时从前任接过来、还没用上的socket
+    std::vector<int>                            listenFds_;
+    std::vector<int>                            inheritedFds_;
+    std::string                                 handoverPath_;
+    std::unique_ptr<ListenerHandover>           handover_;
+    bool                                        handedOver_;    // 只在主循环中访问
+    // 优雅关闭
+    double                                      shutdownGracePeriod_;
+    bool                                        stopOnSignals_;
+    std::unique_ptr<muduo::net::Channel>        signalChannel_;
+    std::atomic<bool>                           draining_;
+    muduo::Timestamp                            drainDeadline_;
+    std::atomic<size_t>                         activeConnections_;
+    AdmissionConfig                             admissionConfig_;
+    std::unique_ptr<ConnectionLimiter>          connectionLimiter_;
+    std::atomic<size_t>                         inflightRequests_;
+    std::unique_ptr<AccessLog>                  accessLog_;
+    // 各IO线程的状态，在线程启动时创建；指针同时放在该线程EventLoop的context中，线程内经由它查找，
+    // 多监听模式下各线程启动时其它线程已经在处理连接，查找不能访问这张表；
+    // 这张表只在创建时追加、在排空时遍历，都持有loopStatesMutex_
+    std::mutex                                  loopStatesMutex_;
+    std::vector<std::unique_ptr<LoopState>>     loopStates_;
 
 };
 
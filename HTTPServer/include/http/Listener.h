@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/InetAddress.h>
+
+namespace http{
+
+// HttpServer自己持有的监听socket，在所属的EventLoop上accept，新连接的描述符交给回调
+// 不用muduo TcpServer内部的Acceptor：交接（ListenerHandover）要拿到监听socket本身，
+// 排空要在不依赖继任者的情况下停止accept，而Acceptor这两样都不公开
+class Listener : muduo::noncopyable{
+public:
+    // sockfd是非阻塞、CLOEXEC的已连接socket，所有权交给回调
+    using NewConnectionCallback = std::function<void(int sockfd, const muduo::net::InetAddress &peerAddr)>;
+
+    // 新建绑定在listenAddr上的socket（还没有listen），失败时返回-1
+    static int createSocket(const muduo::net::InetAddress &listenAddr, bool reusePort);
+    // fd是不是在port上监听的TCP socket，用于检查从前任接过来的socket
+    static bool isListeningOn(int fd, uint16_t port);
+
+    // 接管已经绑定（或者已经在监听）的fd，析构时关闭
+    Listener(muduo::net::EventLoop *loop, int fd);
+    ~Listener();
+
+    void setNewConnectionCallback(const NewConnectionCallback &cb) {newConnectionCallback_ = cb;}
+
+    // 以下在loop所在的线程中调用
+    // 开始监听和accept；对已经在监听的socket只是更新backlog
+    bool listen();
+    // 停止accept并关闭socket：acceptQueued为true时先accept完队列中已经完成握手的连接，它们照常得到服务；
+    // 为false时留给同样持有这个socket的继任者
+    void stop(bool acceptQueued);
+
+    muduo::net::EventLoop *getLoop() const {return loop_;}
+    int fd() const {return fd_;}
+
+private:
+    void handleRead();
+    // accept一个连接交给回调，队列为空或者出错时返回false
+    bool acceptOne();
+
+private:
+    muduo::net::EventLoop *loop_;
+    int fd_;
+    std::unique_ptr<muduo::net::Channel> channel_;
+    // 描述符耗尽（EMFILE）时先关掉这个备用的再accept，以便立即关闭新连接，否则它一直留在队列里反复触发可读
+    int idleFd_;
+    NewConnectionCallback newConnectionCallback_;
+};
+
+}
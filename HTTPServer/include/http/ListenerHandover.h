@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+
+namespace http{
+
+// 监听socket的交接，用于不拒绝任何连接的重启：
+//   - 前任在path（Unix socket）上等待继任者，继任者连上来后把自己的监听socket通过SCM_RIGHTS发过去
+//   - 继任者直接在收到的socket上accept，不再新建，开始accept后回复确认；
+//     此前前任一直照常服务，继任者可以在start()之前充分预热
+//   - 前任收到确认后停止accept，排空已有的连接后退出；两者交替期间共用同一组监听socket，
+//     已经在accept队列中的连接不会丢失
+// 继任者没有确认就断开（比如启动失败）时前任继续服务，可以再次交接
+class ListenerHandover : muduo::noncopyable{
+public:
+    // 交接时要发出的监听socket，按监听的顺序
+    using ListenersCallback = std::function<std::vector<int>()>;
+    // 继任者已经开始accept
+    using HandedOverCallback = std::function<void()>;
+
+    ListenerHandover(muduo::net::EventLoop *loop, const std::string &path);
+    ~ListenerHandover();
+
+    // 继任者一侧：向path上的前任请求监听socket，成功时返回true，ackFd用于之后的confirm()
+    // 没有前任（path不存在或者没有人在监听）时返回false；会阻塞，最多等待timeout秒
+    static bool takeOver(const std::string &path, std::vector<int> *fds, int *ackFd, double timeout = 5.0);
+    // 已经用收到的socket开始accept，通知前任停止
+    static void confirm(int ackFd);
+
+    // 前任一侧：开始在path上等待继任者，在loop所在的线程中调用
+    bool listen(const ListenersCallback &listenersCb, const HandedOverCallback &handedOverCb);
+
+private:
+    void onConnect();
+    void onAck();
+    void closeSuccessor();
+
+private:
+    muduo::net::EventLoop *loop_;
+    std::string path_;
+    int listenFd_;
+    std::unique_ptr<muduo::net::Channel> listenChannel_;
+    // 已经发出监听socket、正在等待确认的继任者
+    int successorFd_;
+    std::unique_ptr<muduo::net::Channel> successorChannel_;
+    ListenersCallback listenersCallback_;
+    HandedOverCallback handedOverCallback_;
+};
+
+}
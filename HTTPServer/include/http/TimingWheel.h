@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+
+namespace http{
+
+// 按秒转动的时间轮，用于关闭超时的连接，每个IO线程（EventLoop）一个，只在该线程中访问
+//
+// 桶里存放Entry的shared_ptr，连接本身只保存Entry的weak_ptr，每个连接始终只有一个Entry：
+// 重新计时只是改写Entry记下的到期时刻，再把它放进对应的桶，每次都是O(1)；
+// 指针转到某个桶时清空它，其中到期时刻正好是现在的Entry关闭连接，其余的是之前计时留下的，直接丢掉
+// （同一个Entry在每个桶里最多一份，所以每个连接占用的桶位置不超过桶的数量，和请求速率无关）
+class TimingWheel : muduo::noncopyable{
+public:
+    class Entry : muduo::noncopyable{
+    public:
+        explicit Entry(const std::weak_ptr<muduo::net::TcpConnection> &weakConn)
+            : weakConn_(weakConn)
+            , deadline_(0)
+        {
+        }
+
+    private:
+        friend class TimingWheel;
+
+        std::weak_ptr<muduo::net::TcpConnection> weakConn_;
+        uint64_t deadline_;     // 到期的tick，0表示没有在计时
+    };
+    using EntryPtr = std::shared_ptr<Entry>;
+    using WeakEntryPtr = std::weak_ptr<Entry>;
+
+    // maxTimeout为支持的最长超时（秒），决定桶的数量
+    TimingWheel(muduo::net::EventLoop *loop, int maxTimeout);
+    // 在loop所在的线程中析构，loop此时还没有销毁
+    ~TimingWheel();
+
+    // timeout秒后关闭连接（误差不超过1秒）
+    WeakEntryPtr add(const muduo::net::TcpConnectionPtr &conn, int timeout);
+    // 重新计时，改为从现在起timeout秒后关闭连接，可以比原来的早；条目已经释放时返回false，需要重新add()
+    bool rearm(const WeakEntryPtr &weakEntry, int timeout);
+    // 把超时推迟到从现在起timeout秒后；timeout不能比原来的剩余时间短，否则仍以较晚的为准
+    void refresh(const WeakEntryPtr &weakEntry, int timeout);
+    // 停止计时，条目留给之后的rearm()
+    static void cancel(const WeakEntryPtr &weakEntry);
+
+private:
+    void onTimer();
+    // 记下到期的tick，把entry放进对应的桶
+    void schedule(const EntryPtr &entry, uint64_t deadline);
+    // 从现在起timeout秒后对应的tick，至少是下一个，最多转一整圈
+    uint64_t deadlineAfter(int timeout) const;
+
+private:
+    muduo::net::EventLoop *loop_;
+    muduo::net::TimerId timerId_;
+    std::vector<std::unordered_set<EntryPtr>> buckets_;
+    uint64_t ticks_;    // 已经转过的tick数，当前的桶是ticks_ % buckets_.size()
+};
+
+}
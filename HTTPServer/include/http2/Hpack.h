@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace http{
+namespace http2{
+
+struct HeaderField{
+    std::string name;
+    std::string value;
+};
+using HeaderList = std::vector<HeaderField>;
+
+// HPACK（RFC 7541）的动态表，编码端和解码端各有一份，由同一串头部块驱动，两边内容始终一致
+// 新条目插在最前面（索引最小），超出容量时从最老的一端淘汰；每个条目按 name + value + 32 字节计算大小
+class HpackDynamicTable{
+public:
+    explicit HpackDynamicTable(size_t maxSize = 4096);
+
+    void add(const std::string &name, const std::string &value);
+    // 调小容量时立即淘汰多出来的条目
+    void setMaxSize(size_t maxSize);
+    size_t maxSize() const {return maxSize_;}
+    size_t count() const {return entries_.size();}
+    // 下标0为最新的条目
+    const HeaderField &at(size_t i) const {return entries_[i];}
+
+    static size_t entrySize(const std::string &name, const std::string &value){
+        return name.size() + value.size() + 32;
+    }
+
+private:
+    void evictTo(size_t maxSize);
+
+private:
+    std::deque<HeaderField> entries_;
+    size_t size_;
+    size_t maxSize_;
+};
+
+// 头部块解码器，每条HTTP/2连接一个
+class HpackDecoder{
+public:
+    // maxTableSize为我们在SETTINGS_HEADER_TABLE_SIZE中允许的上限，对端的表大小更新不能超过它
+    // maxHeaderListSize限制一个头部块解出的总大小，防止很小的块借助索引展开成巨大的头部列表
+    explicit HpackDecoder(size_t maxTableSize = 4096, size_t maxHeaderListSize = 64 * 1024);
+
+    // 解码一个完整的头部块（HEADERS + 所有CONTINUATION的片段拼接），结果追加到headers
+    // 返回false表示COMPRESSION_ERROR，此后动态表状态不再可信，只能关闭连接
+    bool decode(const char *data, size_t len, HeaderList *headers);
+
+private:
+    // 按索引取静态表或动态表中的条目，value为空时只取头部名
+    bool lookup(uint64_t index, std::string *name, std::string *value) const;
+
+private:
+    HpackDynamicTable table_;
+    size_t maxTableSize_;
+    size_t maxHeaderListSize_;
+};
+
+// 头部块编码器，每条HTTP/2连接一个
+// 能在静态表或动态表中完整匹配的头部只输出一个索引；其余的以增量索引的方式写入并加进动态表，
+// 同一条连接上后续响应中重复的头部（Content-Type、Server、CORS头等）就只占一两个字节；
+// 每个响应都不同的头部（Content-Length等）和敏感头部不进动态表。字符串在Huffman编码更短时使用Huffman编码
+class HpackEncoder{
+public:
+    HpackEncoder();
+
+    // 对端通过SETTINGS_HEADER_TABLE_SIZE通知它的解码器能容纳的动态表大小，
+    // 下一个头部块开头会带上动态表大小更新
+    void setMaxTableSize(size_t maxSize);
+
+    // 编码结果追加到out末尾；头部名必须已经是小写
+    void encode(const HeaderList &headers, std::string *out);
+
+private:
+    void encodeField(const HeaderField &field, std::string *out);
+
+private:
+    HpackDynamicTable table_;
+    size_t minTableSize_;       // 上次编码以来对端设置过的最小表大小
+    bool tableSizeChanged_;
+};
+
+}
+}
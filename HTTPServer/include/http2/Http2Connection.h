@@ -0,0 +1,178 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/Buffer.h>
+
+#include "Hpack.h"
+#include "../http/HttpRequest.h"
+#include "../http/HttpResponse.h"
+
+namespace http{
+namespace http2{
+
+// 一条HTTP/2连接（RFC 7540）的服务端协议状态：帧解析、流的多路复用、HPACK和流量控制
+//
+// 不直接操作TcpConnection：收到的明文由上层通过onData()交进来，
+// 产生的帧先积攒在output_中，一次onData()处理完之后通过writeCallback_一次写出
+// （HTTPS连接交给SslConnection加密，h2c直接写TcpConnection），同一批请求的响应合并成一次写
+//
+// 流收齐请求（END_STREAM）后映射成HttpRequest，同步调用requestCallback_（即HttpServer的路由和中间件），
+// 得到的HttpResponse编码成HEADERS + DATA帧；DATA受连接和流两级发送窗口限制，
+// 窗口不够时剩下的部分挂在流上，等对端的WINDOW_UPDATE再继续发
+class Http2Connection : muduo::noncopyable{
+public:
+    using WriteCallback = std::function<void(muduo::net::Buffer *)>;
+    using RequestCallback = std::function<void(const HttpRequest &, HttpResponse *)>;
+
+    // maxBodySize为单个流的请求体上限（0表示不限制），所有流缓存的请求体合计不超过它的kMaxBufferedBodies倍
+    Http2Connection(const WriteCallback &writeCb, const RequestCallback &requestCb, size_t maxBodySize);
+
+    // 处理buf中所有完整的帧，不完整的帧留在buf中等待后续数据
+    // 返回false表示出现了连接错误，GOAWAY已经发出，调用者应关闭连接
+    bool onData(muduo::net::Buffer *buf, muduo::Timestamp receiveTime);
+
+    // 底层连接的发送缓冲区积压过多时暂停发送响应体（DATA帧留在流上，和窗口用完时一样），
+    // 缓冲区排空后恢复并继续发送
+    void setWritePaused(bool paused);
+
+    // 优雅关闭：发送GOAWAY(NO_ERROR)，已经打开的流照常完成，之后新开的流以REFUSED_STREAM拒绝，
+    // 客户端可以放心地在新连接上重试这些请求
+    void goAway();
+    // 没有未完成的流
+    bool idle() const {return streams_.empty();}
+
+    // 客户端连接前言，h2c（明文先验知识）靠它识别HTTP/2连接
+    static const char kClientPreface[];
+    static constexpr size_t kClientPrefaceLength = 24;
+
+private:
+    enum FrameType{
+        kData = 0x0,
+        kHeaders = 0x1,
+        kPriority = 0x2,
+        kRstStream = 0x3,
+        kSettings = 0x4,
+        kPushPromise = 0x5,
+        kPing = 0x6,
+        kGoAway = 0x7,
+        kWindowUpdate = 0x8,
+        kContinuation = 0x9,
+    };
+
+    enum ErrorCode{
+        kNoError = 0x0,
+        kProtocolError = 0x1,
+        kInternalError = 0x2,
+        kFlowControlError = 0x3,
+        kStreamClosed = 0x5,
+        kFrameSizeError = 0x6,
+        kRefusedStream = 0x7,
+        kCompressionError = 0x9,
+        kEnhanceYourCalm = 0xb,
+    };
+
+    struct FrameHeader{
+        uint32_t length;
+        uint8_t type;
+        uint8_t flags;
+        uint32_t streamId;
+    };
+
+    struct Stream{
+        HeaderList headers;
+        std::string body;
+        bool endStream = false;         // 对端已经发完请求
+        int64_t sendWindow = 0;
+        int64_t recvWindow = 0;
+        size_t recvUnacked = 0;         // 已消费但还没有用WINDOW_UPDATE归还的字节
+        // 等待发送窗口的响应体
+        std::string pending;
+        size_t pendingOffset = 0;
+    };
+    using StreamMap = std::map<uint32_t, Stream>;
+
+    // 处理一帧，返回false表示连接错误（GOAWAY已写入output_）
+    bool processFrame(const FrameHeader &header, const char *payload);
+    bool onHeadersFrame(const FrameHeader &header, const char *payload);
+    bool onContinuationFrame(const FrameHeader &header, const char *payload);
+    bool onDataFrame(const FrameHeader &header, const char *payload);
+    bool onSettingsFrame(const FrameHeader &header, const char *payload);
+    bool onPingFrame(const FrameHeader &header, const char *payload);
+    bool onWindowUpdateFrame(const FrameHeader &header, const char *payload);
+    bool onRstStreamFrame(const FrameHeader &header, const char *payload);
+    // 头部块收齐后解码，新建流或处理trailer
+    bool onHeaderBlock(uint32_t streamId, bool endStream);
+
+    // 请求收齐后调用回调并发送响应，响应发完时流被移除
+    void dispatchRequest(StreamMap::iterator it);
+    // 请求体超过上限：不再接收，回复413后重置流
+    void rejectBody(StreamMap::iterator it);
+    // 移除流，同时扣除它缓存的请求体
+    void eraseStream(StreamMap::iterator it);
+    // 伪头部缺失或不合法时返回false
+    bool buildRequest(const Stream &stream, HttpRequest *req) const;
+    void sendResponse(StreamMap::iterator it, const HttpResponse &resp);
+    // 在窗口允许的范围内发送挂起的响应体，全部发完时关闭并移除流
+    void sendPendingData(StreamMap::iterator it);
+    // 连接窗口或初始窗口变大后，依次继续发送各个流挂起的数据
+    void resumePendingStreams();
+
+    void writeFrameHeader(uint32_t length, uint8_t type, uint8_t flags, uint32_t streamId);
+    void writeSettings();
+    void writeWindowUpdate(uint32_t streamId, uint32_t increment);
+    void resetStream(uint32_t streamId, ErrorCode code);
+    // 发送GOAWAY并进入关闭状态，总是返回false，便于直接 return connectionError(...)
+    bool connectionError(ErrorCode code);
+    void flush();
+
+    // 我们的设置：并发流上限和接收窗口；帧长度用协议默认的16KB
+    static constexpr uint32_t kMaxConcurrentStreams = 128;
+    static constexpr uint32_t kMaxFrameSize = 16384;
+    static constexpr int64_t kStreamWindow = 1 << 20;
+    static constexpr int64_t kConnectionWindow = 4 << 20;
+    static constexpr int64_t kDefaultWindow = 65535;
+    static constexpr int64_t kMaxWindow = 0x7fffffff;
+    // 一个头部块（HEADERS + CONTINUATION）压缩后的上限
+    static constexpr size_t kMaxHeaderBlockSize = 64 * 1024;
+    // 一条连接上所有流缓存的请求体合计最多是单个上限的几倍
+    static constexpr size_t kMaxBufferedBodies = 4;
+
+private:
+    WriteCallback writeCallback_;
+    RequestCallback requestCallback_;
+    muduo::net::Buffer output_;
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    // 按流ID有序，窗口恢复时先打开的流先发
+    StreamMap streams_;
+    bool prefaceReceived_;
+    bool settingsReceived_;
+    bool closed_;
+    bool writePaused_;
+    bool goingAway_;
+    uint32_t lastStreamId_;             // 对端打开过的最大流ID
+    uint32_t goAwayStreamId_;           // GOAWAY中告知的最后一个流，之后的流不再处理
+    // 正在接收的头部块：非0时下一帧必须是同一个流的CONTINUATION
+    uint32_t continuationStreamId_;
+    bool continuationEndStream_;
+    std::string headerBlock_;
+    // 对端的设置
+    uint32_t peerMaxFrameSize_;
+    int64_t peerInitialWindow_;
+    // 连接级窗口
+    int64_t sendWindow_;
+    int64_t recvWindow_;
+    size_t recvUnacked_;
+    // 请求体上限和所有流当前缓存的请求体字节数；接收窗口收下数据就归还，不能靠它限制内存
+    size_t maxBodySize_;
+    size_t bufferedBody_;
+    muduo::Timestamp receiveTime_;      // 当前处理的这批数据的接收时间
+};
+
+}
+}
@@ -8,12 +8,13 @@ namespace middleware{
 
 struct CorsConfig{
     // 允许访问的来源域名
+    // 支持 "*"（任意来源）、精确来源 "https://a.example.com" 以及通配子域名 "https://*.example.com"
     std::vector<std::string> allowOrigins;
     // 允许访问的方法
     std::vector<std::string> allowMethods;
     // 允许客户端带的自定义请求头
     std::vector<std::string> allowHeaders;
-    // 是否允许带上 cookie 或 Authorization
+    // 是否允许带上 cookie 或 Authorization；只对明确列出的来源有效，与"*"（或空列表）同时设置时被忽略
     bool allowCredential = false;
     // 预检请求结果缓存的最大时间
     int maxAge = 3600;
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <unordered_set>
+#include <vector>
+
 #include "../../http/HttpRequest.h"
 #include "../../http/HttpResponse.h"
 #include "../Middleware.h"
@@ -12,9 +16,10 @@ class CorsMiddleware : public Middleware{
 public:
     // explicit：防止隐式转换。
     // 接收一个 CorsConfig 对象，默认使用 defaultConfig()。用于初始化中间件的 CORS 策略。
-    explicit CorsMiddleware(const CorsConfig & config == CorsConfig::defaultConfig());
+    // 构造时把配置“编译”成预格式化的头部块和哈希化的来源集合，之后每个响应只需几次append
+    explicit CorsMiddleware(const CorsConfig &config = CorsConfig::defaultConfig());
 
-    // 在请求到达主处理逻辑之前执行 → 可用于拦截预检请求。
+    // 在请求到达主处理逻辑之前执行 → 可用于拦截预检请求，并记录本次请求匹配到的Origin。
     void before(HttpRequest &request) override;
     // 在响应返回客户端之前执行 → 添加 CORS 响应头。
     void after(HttpResponse &response) override;
@@ -22,22 +27,41 @@ public:
     // 工具函数：字符串拼接  将字符串列表按某个分隔符拼接起来，比如把多个允许的 Header 合成一行用 , 分隔。
     // 例如 join({"GET", "POST", "OPTIONS"}, ", ")
     // 结果："GET, POST, OPTIONS"
-    std::string join(const std::vector<std::string> &strings, cosnt std::string &delimiter);
+    // 现在只在构造时调用一次
+    static std::string join(const std::vector<std::string> &strings, const std::string &delimiter);
 
 private:
-    // 检查请求头中的 Origin 是否包含在 config_.allowedOrigins 中。
+    // 通配子域名规则，例如 "https://*.example.com" 拆成 prefix="https://"、suffix=".example.com"
+    struct WildcardOrigin{
+        std::string prefix;
+        std::string suffix;
+    };
+
+    // 把config_编译成下面这些预计算结果
+    void compile();
+    // 检查请求头中的 Origin 是否被允许：先查哈希集合，再匹配通配子域名规则
     bool isOriginAllowed(const std::string &origin) const;
     // 处理预检请求(OPTIONS) 如果是OPTIONS， 构造一个响应并加上必要的CORS头，提前返回响应，避免进入主业务逻辑
     void handlePreflightRequest(const HttpRequest &request, HttpResponse &response);
-    // 添加响应头
-    void addCorsHeaders(HttpResponse &response, const std::string &origin);
+    // 添加响应头  preflight为true时额外追加 Methods/Headers/Max-Age 块
+    void addCorsHeaders(HttpResponse &response, const std::string &origin, bool preflight);
+    // 本线程上本实例当前请求匹配到的Origin，空串表示不添加CORS头
+    std::string &currentOrigin() const;
 
 private:
     // 存储本实例的 CORS 策略配置，用于判断和生成头部。
     CorsConfig config_;
 
+    bool allowAnyOrigin_;   // allowOrigins为空或包含"*"
+    std::unordered_set<std::string> exactOrigins_;  // 精确匹配的来源
+    std::vector<WildcardOrigin> wildcardOrigins_;   // 通配子域名来源，一般只有几条，线性匹配即可
+
+    // 预格式化好的头部字节（每行以\r\n结尾）
+    std::string wildcardOriginHeader_;  // "Access-Control-Allow-Origin: *\r\n"
+    std::string commonHeaders_;         // Credentials 等每个响应都带的头
+    std::string preflightHeaders_;      // Methods / Headers / Max-Age，只在预检响应中输出
 };
 
 
 }
-}
\ No newline at end of file
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../../http/HttpRequest.h"
+#include "../../http/HttpResponse.h"
+#include "../../session/SessionManager.h"
+#include "../Middleware.h"
+
+namespace http{
+namespace middleware{
+
+// 请求结束时把本次请求访问过的会话写回存储
+// 会话只在被修改过（或过期时间需要更新）时才真正写入，一个请求最多写一次
+// HttpServer::setSessionManager() 会自动注册它
+class SessionMiddleware : public Middleware{
+public:
+    // 裸指针：manager由HttpServer持有，生命周期长于中间件
+    explicit SessionMiddleware(session::SessionManager *manager);
+
+    // 把上一个请求因异常没能写回的会话先补写掉
+    void before(HttpRequest &request) override;
+    // 写回本次请求访问过的会话
+    void after(HttpResponse &response) override;
+
+private:
+    session::SessionManager *sessionManager_;
+};
+
+}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SessionCodec.h"
+#include "SessionStorage.h"
+
+namespace http{
+namespace session{
+
+// 有内存上限的会话存储：不保存Session对象，而是把每个会话压成一段扁平的二进制（sessionId + 键值对编码），
+// 放在定长64字节的槽中；数据不超过槽内的空间时直接内联存放（小串优化），否则单独分配一块堆内存
+// SessionManager生成的32个十六进制字符的id按16个原始字节存放，内联空间还能再放下约20字节的键值对
+//
+// 内存按字节精确计账：每个分片记录 活跃槽数 * sizeof(Slot) + 索引表大小 + 各堆块的实际可用大小（malloc_usable_size），
+// 写入新数据前若会超出分片的预算，就用CLOCK算法淘汰：指针绕着槽数组转，
+// 引用位为1的清零并跳过（最近被访问过，给第二次机会），为0的淘汰
+//
+// 每次load都会解码出一个新的Session对象，修改和过期时间的刷新通过save/touch写回
+class CompactSessionStorage : public SessionStorage{
+public:
+    // memoryBudget为所有分片合计的字节数，平均分给各个分片
+    explicit CompactSessionStorage(size_t memoryBudget, size_t shardCount = 16);
+    ~CompactSessionStorage() override;
+
+    void save(std::shared_ptr<Session> session) override;
+    std::shared_ptr<Session> load(const std::string &sessionId) override;
+    void remove(const std::string &sessionId) override;
+    // 只更新槽里的过期时间，不重新编码数据
+    void touch(std::shared_ptr<Session> session) override;
+
+    // 从上次停下的位置继续扫描槽数组，单次最多检查budget个槽
+    size_t evictExpired(size_t budget) override;
+
+    size_t size() const;
+    // 计入预算的字节数（活跃槽 + 索引表 + 堆块）
+    size_t memoryUsage() const;
+    // 实际占用的字节数，另外包含槽数组中空闲槽和未使用的容量
+    size_t memoryFootprint() const;
+    // 因超出预算被淘汰的会话数
+    size_t evictions() const;
+
+    static const size_t kInlineBytes = 37;
+
+private:
+    // 一个槽正好64字节，一条缓存行
+    struct Slot{
+        uint64_t hash;          // 0表示空闲槽
+        int64_t expiry;         // 过期时间（自纪元起的秒数）；空闲槽中存放下一个空闲槽的下标
+        int32_t maxAge;
+        uint32_t size;          // 数据总长度 = idLen + 键值对编码的长度
+        uint8_t idLen;          // 存放的id长度，packedId时为16
+        uint8_t packedId;       // id是十六进制串，按原始字节存放
+        uint8_t referenced;     // CLOCK引用位
+        // 内联的数据，或者（不内联时）前8字节存放堆块的指针；不按指针对齐，才能多出几个字节给内联数据
+        char storage[kInlineBytes];
+
+        bool isInline() const {return size <= kInlineBytes;}
+        char *heapData() const{
+            char *data;
+            memcpy(&data, storage, sizeof(data));
+            return data;
+        }
+        void setHeapData(char *data) {memcpy(storage, &data, sizeof(data));}
+        const char *data() const {return isInline() ? storage : heapData();}
+    };
+    static_assert(sizeof(Slot) == 64, "Slot should fill exactly one cache line");
+
+    // 槽下标的哨兵：find()找不到、空闲链表的结尾
+    static const uint32_t kNoSlot = UINT32_MAX;
+    // 索引表项的取值：0为空，kTombstoneEntry为已删除，其余为槽下标+1
+    static const uint32_t kEmptyEntry = 0;
+    static const uint32_t kTombstoneEntry = UINT32_MAX;
+    // 槽下标+1不能和kTombstoneEntry相同，槽下标本身也不能是kNoSlot
+    static const uint32_t kMaxSlots = UINT32_MAX - 1;
+
+    struct alignas(64) Shard{
+        mutable std::mutex mutex;
+        std::vector<Slot> slots;        // CLOCK环
+        // 开放寻址的索引表，存放槽下标+1；kEmptyEntry表示空，kTombstoneEntry表示已删除
+        std::vector<uint32_t> table;
+        size_t tableUsed = 0;           // 非空的表项，包括墓碑
+        size_t live = 0;
+        size_t heapBytes = 0;
+        uint32_t freeHead = kNoSlot;    // 空闲槽链表
+        size_t hand = 0;                // CLOCK指针
+        size_t scanCursor = 0;          // evictExpired的扫描位置
+        size_t evictions = 0;
+    };
+
+    Shard &shardFor(uint64_t hash){
+        return shards_[hash & shardMask_];
+    }
+    static uint64_t hashOf(const std::string &sessionId);
+    // 槽中存放的id：小写十六进制串（SessionManager生成的id）压成原始字节并返回true，其它id原样存放
+    static bool packId(const std::string &sessionId, std::string *out);
+
+    // 以下函数要求调用者持有shard.mutex
+    // 返回会话所在槽的下标，不存在返回kNoSlot；storedId为packId()的结果
+    uint32_t find(const Shard &shard, uint64_t hash, const std::string &storedId, bool packed) const;
+    void insertIndex(Shard &shard, uint64_t hash, uint32_t slot);
+    void rehash(Shard &shard, size_t tableSize);
+    // 移除槽中的会话：索引表中留下墓碑，槽挂回空闲链表
+    void eraseSlot(Shard &shard, uint32_t slot);
+    // 把数据写入槽，按需分配/释放堆块并更新heapBytes
+    void assignData(Shard &shard, Slot &slot, const std::string &blob);
+    // 用CLOCK淘汰，直到再放入incoming字节也不超过分片预算；keep为正在更新、不能被淘汰的槽
+    void makeRoom(Shard &shard, size_t incoming, uint32_t keep);
+    size_t accountedBytes(const Shard &shard) const;
+
+private:
+    std::vector<Shard> shards_;
+    size_t shardMask_;
+    size_t shardBits_;          // 分片用掉了哈希的低位，索引表用剩下的高位
+    size_t shardBudget_;
+    // 下一次清理开始的分片，只在定时器所在的线程中访问
+    size_t evictCursor_;
+};
+
+}
+}
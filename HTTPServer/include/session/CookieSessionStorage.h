@@ -0,0 +1,62 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+#include <memory>
+#include <string>
+
+#include "SessionCodec.h"
+#include "SessionStorage.h"
+
+namespace http{
+namespace session{
+
+// 无状态的会话存储：把会话数据用SessionCodec序列化成紧凑的二进制，签名（可选加密）后整个放进Cookie，
+// 服务端不保存任何东西，多个进程/节点之间不需要粘性路由
+//
+// Cookie值的格式：
+//   "s." + base64url(payload) + "." + base64url(HMAC-SHA256)    仅签名
+//   "e." + base64url(iv || AES-256-GCM密文 || tag)                加密（GCM自带认证）
+//   其它（32位十六进制）                                          编码后超过大小上限，存在fallback存储中的sessionId
+//
+// save()/touch()本身什么都不做，真正的写回发生在cookieValue()中（由SessionManager在请求结束时调用）
+class CookieSessionStorage : public SessionStorage{
+public:
+    // secret至少32字节，签名和加密用的密钥都由它派生
+    // fallback用于存放编码后超过maxCookieBytes的大会话
+    CookieSessionStorage(const std::string &secret,
+                         std::unique_ptr<SessionStorage> fallback,
+                         bool encrypt = false,
+                         size_t maxCookieBytes = kDefaultMaxCookieBytes);
+    ~CookieSessionStorage() override;
+
+    void save(std::shared_ptr<Session> session) override {}
+    std::shared_ptr<Session> load(const std::string &cookieValue) override;
+    // 数据在客户端，无法主动吊销，只能删除fallback里的那一份
+    void remove(const std::string &sessionId) override;
+    void touch(std::shared_ptr<Session> session) override {}
+    size_t evictExpired(size_t budget) override;
+
+    bool cookieValue(const std::shared_ptr<Session> &session, std::string *value) override;
+
+    // 浏览器对单个Cookie的限制约为4KB，扣除Cookie名和属性后留出余量
+    static const size_t kDefaultMaxCookieBytes = 3800;
+
+private:
+    // 签名 / 校验
+    bool sign(const std::string &payload, unsigned char *mac);
+    // 加密 / 解密
+    bool seal(const std::string &payload, std::string *out);
+    bool unseal(const unsigned char *data, size_t len, std::string *payload);
+
+private:
+    std::unique_ptr<SessionStorage> fallback_;
+    bool encrypt_;
+    size_t maxCookieBytes_;
+    EVP_PKEY *macKey_;              // HMAC密钥，只读，可以在线程间共享
+    unsigned char encKey_[32];      // AES-256-GCM密钥
+    uint64_t instanceId_;           // 线程本地cipher上下文据此判断已加载的是不是本实例的密钥
+};
+
+}
+}
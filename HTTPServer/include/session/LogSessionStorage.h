@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "SessionCodec.h"
+#include "SessionStorage.h"
+
+namespace http{
+namespace session{
+
+// 持久化的会话存储：会话更新以追加写的方式写入内存映射(mmap)的日志段文件，内存中只保留哈希索引
+// 写入就是一次memcpy到页缓存，进程重启后扫描日志段重建索引，用户不会因为发布而被登出
+//
+// 目录下的文件为 session-<序号>.log，每个段预分配segmentSize字节
+// 记录格式： u32长度 | u32 CRC32 | u8类型 | 数据
+//   PUT：数据为SessionCodec编码的会话
+//   DEL：数据为sessionId
+// 启动时逐段扫描，遇到长度为0或校验失败的记录即认为该段到此结束（预分配的空白或写了一半的尾巴）
+//
+// 压缩：后台线程从最老的已封存段开始，当其有效数据比例低于阈值时，把其中仍然有效的记录
+// 追加到当前活跃段，然后删除该段。总是从最老的段开始压缩，
+// 所以丢弃其中的删除记录是安全的：比它更老的PUT记录都已经不存在了
+class LogSessionStorage : public SessionStorage{
+public:
+    explicit LogSessionStorage(const std::string &directory,
+                               size_t segmentSize = 64 * 1024 * 1024);   // 不能超过4GB
+    ~LogSessionStorage() override;
+
+    void save(std::shared_ptr<Session> session) override;
+    std::shared_ptr<Session> load(const std::string &sessionId) override;
+    void remove(const std::string &sessionId) override;
+    size_t evictExpired(size_t budget) override;
+
+    // 有效数据比例低于该值的最老段会被压缩
+    void setCompactThreshold(double ratio) {compactThreshold_ = ratio;}
+    // 把已写入的数据异步刷到磁盘（MS_ASYNC），每次evictExpired时也会顺带调用
+    void sync();
+
+    size_t size() const;
+
+private:
+    using TimePoint = std::chrono::system_clock::time_point;
+
+    struct Segment{
+        uint64_t seq;
+        std::string path;
+        int fd;
+        char *base;
+        size_t capacity;
+        size_t size;        // 已写入的字节数（下一条记录的写入位置）
+        size_t liveBytes;   // 仍被索引引用的字节数
+    };
+
+    // 索引项：会话最新一条PUT记录的位置
+    struct Location{
+        uint64_t seq;
+        uint32_t offset;
+        uint32_t length;    // 整条记录的长度（含头部）
+        TimePoint expiry;
+    };
+
+    using ExpiryEntry = std::pair<TimePoint, std::string>;
+    using ExpiryHeap = std::priority_queue<ExpiryEntry, std::vector<ExpiryEntry>, std::greater<ExpiryEntry>>;
+
+    // 打开目录下已有的段并重放，重建索引
+    void recover();
+    void replaySegment(Segment &segment);
+    // 新建/打开并映射一个段
+    bool openSegment(uint64_t seq, bool create, Segment *segment);
+    void closeSegment(Segment &segment, bool unlink);
+    Segment *findSegment(uint64_t seq);
+
+    // 以下三个函数要求调用者持有mutex_
+    // 追加一条记录，返回其位置；空间不够时封存当前段并新开一段
+    bool appendRecord(char type, const char *data, size_t len, Location *location);
+    void dropLocation(const Location &location);
+    bool shouldCompact() const;
+
+    // 压缩最老的段，每次持锁最多处理batch条记录，返回是否还有工作要做；
+    // 写入失败（比如磁盘满）时返回false并置failed，由调用者退避
+    bool compactStep(size_t batch, bool *failed);
+
+    void compactThreadFunc();
+
+private:
+    std::string directory_;
+    size_t segmentSize_;
+    double compactThreshold_;
+
+    mutable std::mutex mutex_;
+    std::deque<Segment> segments_;      // 按seq升序，最后一个是活跃段；deque在两端增删时不会使其它元素的引用失效
+    std::unordered_map<std::string, Location> index_;
+    ExpiryHeap expiryHeap_;
+    size_t compactCursor_;              // 正在压缩的最老段中下一条待处理记录的偏移
+
+    std::atomic<bool> running_;
+    std::condition_variable compactCond_;
+    std::thread compactThread_;
+};
+
+}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SessionCodec.h"
+#include "SessionStorage.h"
+
+namespace http{
+namespace session{
+
+struct RespConfig{
+    std::string host = "127.0.0.1";     // 目前只支持IPv4地址
+    uint16_t port = 6379;
+    std::string keyPrefix = "session:";
+    // 每个IO线程持有的连接数；同一个sessionId总是落在同一条连接上，保证读到自己刚写的数据
+    int connectionsPerLoop = 2;
+    // 连接和等待load回复的超时时间；连接失败后按指数退避重连，退避期间的操作直接失败
+    int timeoutMs = 200;
+};
+
+class RespConnection;
+
+// 基于RESP协议（Redis）的远程会话存储，多节点部署时共享会话
+//
+// 每个IO线程有自己的连接池，连接不跨线程共享，因此不需要加锁：
+//  - save/touch/remove 只把命令追加到连接的发送缓冲区，并通过 EventLoop::queueInLoop
+//    在本轮事件循环末尾统一发送：同一轮中多个请求产生的写操作合并成一次write，一次往返
+//  - HttpServer在处理请求之前调用prefetch()，同一轮事件循环中各个请求的GET和写命令一起在本轮末尾发出，
+//    请求推迟到回复到达时在连接的可读事件中处理，其中的load()直接取预取的结果：IO线程不等待，
+//    一轮的读取合并成一次往返；超过timeoutMs没有回复按连接失败处理
+//  - 没有预取的load()（比如HTTP/2的请求）只能当场等待这一条回复，最多timeoutMs，
+//    发送GET时会把排在它前面的写命令一起带上（流水线），之前写命令的回复在读取时顺带消费
+//  - 写不完的命令由连接的可写事件继续发送；回复（包括只写命令的）在可读事件中消费
+//  - 会话的过期交给服务端的TTL（SET ... EX / EXPIRE），evictExpired()什么都不做
+class RespSessionStorage : public SessionStorage{
+public:
+    explicit RespSessionStorage(const RespConfig &config);
+    ~RespSessionStorage() override;
+
+    void save(std::shared_ptr<Session> session) override;
+    std::shared_ptr<Session> load(const std::string &sessionId) override;
+    bool prefetch(const std::string &sessionId, const std::function<void()> &ready) override;
+    void remove(const std::string &sessionId) override;
+    // 只刷新TTL，用EXPIRE代替整体SET
+    void touch(std::shared_ptr<Session> session) override;
+
+private:
+    // 当前线程上、负责该sessionId的连接
+    RespConnection *connectionFor(const std::string &sessionId);
+    // 把写命令安排到本轮事件循环末尾发送
+    void scheduleFlush(RespConnection *conn);
+    static long long ttlSeconds(const Session &session);
+
+private:
+    RespConfig config_;
+    uint64_t instanceId_;   // 区分线程本地连接池属于哪个存储实例
+};
+
+}
+}
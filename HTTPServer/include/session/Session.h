@@ -1,10 +1,12 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <chrono>
+#include <mutex>
 
 namespace http{
 namespace session{
@@ -30,6 +32,8 @@ public:
 
     bool isExpired() const;
     void refresh(); // 刷新过期时间
+    std::chrono::system_clock::time_point getExpiryTime() const;
+    int getMaxAge() const {return maxAge_;}
 
     // 数据存取
     void setValue(const std::string &key, const std::string &value);
@@ -37,7 +41,29 @@ public:
     void remove(const std::string &key);
     void clear();
 
+    // 整体读出/恢复会话数据，供需要序列化会话的存储实现使用
+    std::unordered_map<std::string, std::string> getValues() const;
+    // 用存储中读出的数据和过期时间恢复会话，恢复后的会话不是脏的
+    void restore(std::unordered_map<std::string, std::string> data,
+                 std::chrono::system_clock::time_point expiryTime);
+
+    // 脏标记与版本号
+    // 每次修改data_都会让version_加一；持久化时记录下写入的版本，
+    // 两者不相等就说明有未写回存储的修改
+    bool isDirty() const;
+    uint64_t getVersion() const;
+    // 存储写入了version对应的数据后调用；期间若又有新的修改，会话仍然保持脏状态
+    void markPersisted(uint64_t version);
+
+    // 刷新过期时间不算数据修改，只需要惰性地把新的过期时间写回存储：
+    // 距离上次写入的过期时间超过maxAge_/4才需要再写一次，把频繁的刷新合并掉
+    bool needsExpiryWrite() const;
+    void markExpiryPersisted();
+
 private:
+    // 同一个会话可能被不同IO线程上的并发请求同时访问（同一用户的多个连接），
+    // data_ 和 expiryTime_ 的读写都由它保护
+    mutable std::mutex mutex_;
     std::string sessionId_;
     // 保存任意会话数据
     std::unordered_map<std::string, std::string> data_;
@@ -45,6 +71,11 @@ private:
     std::chrono::system_clock::time_point expiryTime_;
     // 最长生命周期
     int maxAge_;
+    // 当前数据版本和最近一次写回存储的版本
+    uint64_t version_;
+    uint64_t persistedVersion_;
+    // 最近一次写回存储的过期时间
+    std::chrono::system_clock::time_point persistedExpiry_;
     // 未使用智能指针避免循环引用
     SessionManager *sessionManager_;
 };
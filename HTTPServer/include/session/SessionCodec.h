@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "Session.h"
+
+namespace http{
+namespace session{
+
+// 会话的紧凑二进制编码，供需要把会话放到进程之外的存储实现（Cookie、日志文件等）复用
+/* 布局：
+    u8      格式版本
+    varint  sessionId长度 + sessionId
+    8字节   过期时间（秒，大端）
+    varint  maxAge
+    varint  键值对数量，之后每对为 varint长度+key、varint长度+value
+*/
+class SessionCodec{
+public:
+    // 编码结果追加到out末尾
+    static void encode(const Session &session, std::string *out);
+    // 数据格式不对或会话已过期时返回nullptr；返回的会话不是脏的，manager需要调用者自己设置
+    static std::shared_ptr<Session> decode(const char *data, size_t len);
+    // 只解出sessionId和过期时间，不构造会话（用于启动时重建索引）
+    static bool peek(const char *data, size_t len, std::string *sessionId,
+                     std::chrono::system_clock::time_point *expiryTime);
+
+    // 只编码/解码键值对部分（varint数量 + 各键值对），供自己管理id和过期时间的存储使用
+    static void encodeValues(const std::unordered_map<std::string, std::string> &values, std::string *out);
+    static bool decodeValues(const char *data, size_t len, std::unordered_map<std::string, std::string> *values);
+};
+
+}
+}
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <memory>
-#include <random>
+#include <vector>
 
 #include "SessionStorage.h"
 #include "../http/HttpRequest.h"
@@ -18,31 +18,52 @@ public:
     // 创建了新的session，通过setSessionCookie()写入响应Cookie
     std::shared_ptr<Session> getSession(const HttpRequest &req, HttpResponse *resp);
 
+    // 预取请求Cookie中的会话，返回true时调用者应当推迟处理这个请求，直到ready被调用（见SessionStorage::prefetch）
+    bool prefetchSession(const HttpRequest &req, const std::function<void()> &ready);
     // 销毁会话，一般用于登出or安全清除的场景
     void destroySession(const std::string &sessionId);
 
     // 清理过期会话
-    // 遍历已有会话，删除所有已经过期的
+    // 由HttpServer在主循环上用runEvery定时调用，每次最多清理cleanBatchSize_个，
+    // 把清理工作摊到每个tick里，不做全量扫描
     void cleanExpiredSessions();
 
+    void setCleanBatchSize(size_t batchSize) {cleanBatchSize_ = batchSize;}
+
     // 更新会话，立即保存
     void updateSession(std::shared_ptr<Session> session){
+        uint64_t version = session->getVersion();
         storage_->save(session);
+        session->markPersisted(version);
     }
 
+    // 登记一个在本次请求中被访问的会话，请求结束时由flushPendingSessions()统一写回
+    void scheduleFlush(std::shared_ptr<Session> session);
+    // 写回当前线程登记的会话：有修改的整体保存，只刷新了过期时间的按需touch，其余跳过
+    // 由SessionMiddleware::after()在每个请求结束时调用；resp非空时可以下发更新后的Cookie
+    void flushPendingSessions(HttpResponse *resp = nullptr);
+
 private:
+    // Session ID包含的随机字节数，编码为十六进制后长度翻倍
+    static const size_t kSessionIdBytes = 16;
+
     // 生成唯一的Session ID
     std::string generateSessionId();
     // 从Cookie中获取sessionId
     std::string getSessionIdFromCookie(const HttpRequest &req);
     // 设置Cookie返回给客户端
     void setSessionCookie(const std::string &sessionId, HttpResponse *resp);
+    // 按脏标记和过期时间决定是否写回单个会话
+    void flushSession(const std::shared_ptr<Session> &session, HttpResponse *resp);
 
 private:
     // 指向具体的存储实现
     std::unique_ptr<SessionStorage> storage_;
-    // 使用梅森旋转算法的伪随机数生成器
-    std::mt19937 rng_;
+    // 每次定时清理最多处理的会话数
+    size_t cleanBatchSize_;
+    // 当前IO线程上正在处理的请求所访问过的会话
+    // 请求在单个IO线程上同步处理完毕，所以按线程记录即可，不需要加锁
+    static thread_local std::vector<std::shared_ptr<Session>> pendingSessions_;
 
 };
 
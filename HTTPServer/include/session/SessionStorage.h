@@ -1,6 +1,13 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "Session.h"
 
@@ -15,17 +22,71 @@ public:
     virtual void save(std::shared_ptr<Session> session) = 0;    // 保存
     virtual std::shared_ptr<Session> load(const std::string &sessionId) = 0;  // 加载
     virtual void remove(const std::string &sessionId) = 0;  // 删除
+
+    // 只写回会话的过期时间（数据没变）
+    // 默认整体保存；能单独更新TTL的存储可以重写成更轻量的操作
+    virtual void touch(std::shared_ptr<Session> session) {save(session);}
+
+    // 在save()/touch()之后调用，给出需要通过Set-Cookie下发的新值
+    // 默认返回false：数据在服务端，Cookie里的sessionId保持不变；
+    // 把会话数据编码进Cookie的实现（见CookieSessionStorage）会在这里完成真正的写回
+    virtual bool cookieValue(const std::shared_ptr<Session> &session, std::string *value) {return false;}
+
+    // 预先发出对sessionId的读取，在IO线程中调用；返回true表示已经发出，调用者应当推迟处理请求，
+    // 结果到达（或者失败）后在同一个IO线程中调用ready，在ready中load()直接取结果，不再等待
+    // 默认返回false：本地存储的load()不需要等待
+    virtual bool prefetch(const std::string &sessionId, const std::function<void()> &ready) {return false;}
+    // 增量清理过期会话，单次最多清理budget个，返回实际清理的数量
+    // 默认不做任何事：自带TTL的外部存储不需要服务端主动清理
+    virtual size_t evictExpired(size_t budget) {return 0;}
 };
 
 // 基于内存的会话存储实现
+// 按sessionId的哈希分成N个分片，每个分片独立加锁；
+// 多个IO线程同时访问时只有落在同一分片上的请求才会竞争同一把锁
 class MemorySessionStorage : public SessionStorage{
 public:
+    // shardCount会向上取整为2的幂，便于用掩码代替取模
+    explicit MemorySessionStorage(size_t shardCount = 64);
+
     void save(std::shared_ptr<Session> session) override;
     std::shared_ptr<Session> load(const std::string &sessionId) override;
     void remove(const std::string &sessionId) override;
+    // 内存中存的就是会话对象本身，过期时间已经是最新的，无需写入
+    void touch(std::shared_ptr<Session> session) override {}
+
+    // 每个分片维护一个按过期时间排序的最小堆，定时器每次只弹出堆顶已到期的部分，
+    // 从上次停下的分片继续，单次最多处理budget个条目，避免全量扫描造成的停顿
+    size_t evictExpired(size_t budget) override;
+
+    // 当前存储的会话总数（逐个分片加锁统计，仅用于监控）
+    size_t size() const;
+
+private:
+    using TimePoint = std::chrono::system_clock::time_point;
+    // 堆中的过期条目，每个会话只有一条；到期时若会话已被刷新则按新的过期时间重新入堆
+    using ExpiryEntry = std::pair<TimePoint, std::string>;
+    using ExpiryHeap = std::priority_queue<ExpiryEntry, std::vector<ExpiryEntry>, std::greater<ExpiryEntry>>;
+
+    // 每个分片独占一条缓存行，避免不同分片的锁之间发生伪共享
+    struct alignas(64) Shard{
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<Session>> sessions;
+        ExpiryHeap expiryHeap;
+    };
+
+    // 在持有shard.mutex的情况下清理该分片，扣减budget，返回删除的会话数
+    size_t evictShard(Shard &shard, TimePoint now, size_t &budget);
+
+    Shard &shardFor(const std::string &sessionId){
+        return shards_[std::hash<std::string>{}(sessionId) & shardMask_];
+    }
 
 private:
-    std::unordered_map<std::string, std::shared_ptr<Session>> sessions_;
+    std::vector<Shard> shards_;
+    size_t shardMask_;
+    // 下一次清理开始的分片，只在定时器所在的线程中访问
+    size_t evictCursor_;
 };
 
 
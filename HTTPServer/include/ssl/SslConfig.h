@@ -6,6 +6,15 @@
 #include "SslTypes.h"
 
 namespace ssl{
+
+// 按SNI主机名选择的证书，hostname可以是 "*.example.com" 形式的通配符（只匹配一级子域名）
+struct CertificateEntry{
+    std::string hostname;
+    std::string certFile;
+    std::string keyFile;
+    std::string chainFile;
+};
+
 class SslConfig{
 public:
     SslConfig();
@@ -15,6 +24,11 @@ public:
     void setCertificateFile(const std::string &certFile) {certFile_ = certFile;}
     void setPrivateKeyFile(const std::string &keyFile) {keyFile_ = keyFile;}
     void setCertificateChainFile(const std::string &chainFile) {chainFile_ = chainFile;}
+    // 为某个主机名添加证书；客户端SNI没有匹配的证书时使用上面的默认证书
+    void addCertificate(const std::string &hostname, const std::string &certFile,
+                        const std::string &keyFile, const std::string &chainFile = ""){
+        certificates_.push_back(CertificateEntry{hostname, certFile, keyFile, chainFile});
+    }
 
     void setPortocoVersion(SSLVersion version) {version_ = version;}
     void setCipherList(const std::string &cipherList) {cipherList_ = cipherList;}
@@ -22,13 +36,29 @@ public:
     void setVerifyClient(bool verify) {verifyClient_ = verify;}
     void setVerifyDepth(int depth) {verifyDepth_ = depth;}
 
+    // 握手完成后尝试把记录加密交给内核（kTLS，需要内核加载tls模块、OpenSSL编译时启用ktls）
+    // 不满足条件时自动退回用户态加密
+    void setEnableKtls(bool enable) {enableKtls_ = enable;}
+
+    // 握手线程数：大于0时SSL_do_handshake（含私钥运算）在独立的线程池中执行，
+    // 新连接的握手高峰不会拖慢IO线程上已建立连接的请求；为0时在IO线程中执行
+    void setHandshakeThreads(int num) {handshakeThreads_ = num;}
+
+    // 通过ALPN向客户端提供HTTP/2（"h2"），不支持的客户端继续使用HTTP/1.1
+    void setEnableHttp2(bool enable) {enableHttp2_ = enable;}
+
     void setSessionTImeout(int seconds) {sessionTimeout_ = seconds;}
+    // 无状态会话票据：会话状态用服务端的票据密钥加密后交给客户端保存，恢复时不需要服务端缓存
+    void setSessionTickets(bool enable) {sessionTickets_ = enable;}
+    // 票据密钥的轮换周期（秒），旧密钥在之后的若干个周期内仍可用于解密
+    void setTicketKeyRotation(int seconds) {ticketKeyRotation_ = seconds;}
     void setSessionCacheSiZE(long size) {sessionCacheSize_ = size;}
 
     // Getters
     const std::string &getCertificateFile() const {return certFile_;}
     const std::string &getPrivateKeyFile() const {return keyFile_;}
     const std::string &getCertificateChainFile() const {return chainFile_;}
+    const std::vector<CertificateEntry> &getCertificates() const {return certificates_;}
 
     SSLVersion getProtocaVersion() const {return version_;}
     const std::string &getCipherList() const {return cipherList_;}
@@ -36,8 +66,14 @@ public:
     bool getVerifyClient() const {return verifyClient_;}
     int getVeryfiDepth() const {return verifyDepth_;}
 
+    bool getEnableKtls() const {return enableKtls_;}
+    int getHandshakeThreads() const {return handshakeThreads_;}
+    bool getEnableHttp2() const {return enableHttp2_;}
+
     int getSessionTimeout() const {return sessionTimeout_;}
     long getSessionCacheSize() const {return sessionCacheSize_;}
+    bool getSessionTickets() const {return sessionTickets_;}
+    int getTicketKeyRotation() const {return ticketKeyRotation_;}
 
 
     // 关于getters中有的返回的是const引用，有的返回的是值
@@ -48,13 +84,19 @@ private:
     std::string certFile_;  // 证书文件
     std::string keyFile_;   // 私钥文件
     std::string chainFile_; // 证书链文件
+    std::vector<CertificateEntry> certificates_;    // 按主机名选择的证书
     SSLVersion version_;    // 协议版本
     std::string cipherList_;    // 加密套件
 
     bool verifyClient_;     // 是否验证客户端整数
     int verifyDepth_;       // 验证深度
+    bool enableKtls_;       // 是否启用内核TLS
+    int handshakeThreads_;  // 握手线程数
+    bool enableHttp2_;      // 是否通过ALPN协商HTTP/2
     int sessionTimeout_;    // 会话超时时间
     long sessionCacheSize_; // 会话缓存大小
+    bool sessionTickets_;   // 是否启用会话票据
+    int ticketKeyRotation_; // 票据密钥轮换周期
 };
 
 } // namespace ssl
\ No newline at end of file
@@ -3,8 +3,10 @@
 #include <memory>
 #include <openssl/ssl.h>
 #include <muduo/base/noncopyable.h>
+#include <muduo/base/ThreadPool.h>
 #include <muduo/net/TcpConnection.h>
 #include <muduo/net/Buffer.h>
+#include <muduo/net/Channel.h>
 
 #include "SslContext.h"
 
@@ -13,12 +15,14 @@ using MessageCallback = std::function<void(const std::shared_ptr<muduo::net::Tcp
                                                muduo::net::Buffer *,
                                                muduo::Timestamp)>;
 
-class SslConnection : muduo::noncopyable{
+// 握手放到线程池时，任务持有SslConnection的shared_ptr，连接断开后它一直活到任务回到IO线程
+class SslConnection : muduo::noncopyable, public std::enable_shared_from_this<SslConnection>{
 public:
     using TcpConnectionPtr = std::shared_ptr<muduo::net::tcpConnection>;
     using BufferPtr = muduo::net::Buffer*;
 
-    SslConnection(const TcpConnectionPtr &conn, SslContext *ctx);
+    // sockfd为连接的socket（accept时得到），只在启用kTLS时使用，握手期间OpenSSL经由它直接写
+    SslConnection(const TcpConnectionPtr &conn, SslContext *ctx, int sockfd);
     ~SslConnection();
 
     void startHandshake();
@@ -27,17 +31,38 @@ public:
     void onRead(const TcpConnectionPtr &conn, BufferPtr buf, muduo::Timestamp time);
 
     bool isHandshakeCompleted() const {return state_ == SSLState::ESTABLISHED;}
+    // 发送方向的记录加密是否已经交给内核
+    bool isKtlsEnabled() const {return ktlsTx_;}
+    // 握手中通过ALPN协商出的应用层协议（如"h2"），没有协商时为空
+    std::string alpnProtocol() const;
     muduo::net::Buffer *getDecryptedBuffer() {return &decryptedBuffer_;}
     void setMessageCallback(const MessageCallback &cb) {messageCallback_ = cb;}
 
     // SSL BIO回调函数（底层OpenSSL接口）
-    // 这些是为了让 OpenSSL 的 BIO 层能读写 Muduo 的 Buffer
+    // 这些是为了让 OpenSSL 的 BIO 层能读写 Muduo 的 Buffer：
+    // 读取onRead期间连接的输入缓冲区，写入writeBuffer_
     static int bioWrite(BIO *bio, const char *data, int len);
     static int bioRead(BIO *bio, char *data, int len);
     static long bioCtrl(BIO *bio, int cmd, long num, void *ptr);
 
 private:
+    // 推进一步握手：配置了握手线程池时提交到线程池，否则在当前线程执行
     void handleHandshake();
+    void submitHandshake(muduo::ThreadPool *pool);
+    // 线程池中的一步完成后回到IO线程执行
+    void onHandshakeDone(int ret, int err, unsigned long errCode);
+    // 处理一步握手的结果（ret/err为SSL_do_handshake的返回值和SSL_get_error的结果）
+    void onHandshakeStep(int ret, int err, unsigned long errCode);
+    // 解密inputBuffer_中的全部完整记录并交给上层
+    void decryptInput(muduo::Timestamp time);
+    // 把writeBuffer_中积攒的密文一次发送出去
+    void flushWriteBuffer();
+    // 握手完成后检查OpenSSL是否启用了内核TLS，没有的话把写BIO换回自定义BIO
+    void finishKtlsSetup();
+    // kTLS握手时socket发送缓冲区满（WANT_WRITE）：登记可写事件，可写时继续握手
+    void waitWritable();
+    void onWritable();
+    void stopWaitWritable();
     // 处理收到的密文
     void onEncrypted(const char *data, size_t len);
     // 处理解密的明文
@@ -46,16 +71,35 @@ private:
     void handleError(SSLError error);
 
 
+    // 一条TLS记录最多携带16KB明文，每次SSL_read前至少留出这么多空间
+    static const size_t kMaxRecordPlaintext = 16 * 1024;
+
 private:
     SSL *ssl_;        // ssl连接
     SslContext *ctx_;  // ssl上下文
     TcpConnectionPtr conn_; // tcp连接
     SSLState state_;
-    BIO *readBio_;
-    BIO *writeBio_;
-    muduo::net::Buffer readBuffer_;
+    BIO *bio_;              // 读写共用的自定义BIO
+    // onRead期间指向连接的输入缓冲区，bioRead从这里直接取密文；其余时间为空
+    BufferPtr inputBuffer_;
+    // 待发送的密文，一次send()或一轮读处理产生的所有记录都先放在这里
     muduo::net::Buffer writeBuffer_;
-    // 已被解密的数据缓冲区
+    // 自适应记录大小：距上次空闲以来发送的明文字节数和最近一次发送的时间
+    size_t bytesSinceIdle_;
+    muduo::Timestamp lastSendTime_;
+    // kTLS模式下连接的socket，握手期间OpenSSL通过它直接写，以便在切换密钥时把密钥装进内核；
+    // 握手期间连接上没有别的数据要发，muduo的输出缓冲区是空的，绕过它写不会乱序
+    int sockfd_;
+    // 等待socket可写的Channel：muduo不提供单独关注连接可写的接口，同一个fd在epoll中也只能登记一次，
+    // 所以登记的是dup出来的描述符，它和连接的socket是同一个文件
+    int writeWaitFd_;
+    std::unique_ptr<muduo::net::Channel> writeWaitChannel_;
+    bool ktlsTx_;
+    // 握手放到线程池时，密文先拷贝到这里（握手消息只有几KB），线程池线程只读它
+    muduo::net::Buffer handshakeInput_;
+    bool handshakeInFlight_;            // 只在IO线程访问
+    // 已被解密的数据缓冲区，在连接的整个生命周期内复用，
+    // 上层没有解析完的明文（半个请求）留在这里，和下一次解密出的数据拼起来
     muduo::net::Buffer decryptedBuffer_;
     MessageCallback messageCallback_;
 
@@ -2,7 +2,12 @@
 
 #include <openssl/ssl.h>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <muduo/base/noncopyable.h>
+#include <muduo/base/ThreadPool.h>
 
 #include "SslConfig.h"
 
@@ -18,18 +23,72 @@ public:
     // 获取底层OpenSSL的SSL_CTX *指针
     // 对外暴露原生句柄的做法常用于封装类
     SSL_CTX *getNativeHandle() const {return ctx_;}
+    const SslConfig &getConfig() const {return config_;}
+    // 握手线程池，未配置时为空
+    muduo::ThreadPool *getHandshakePool() const {return handshakePool_.get();}
+
+    // 重新读取配置中的全部证书文件，构建新的证书表后整体替换
+    // 已建立的连接继续使用原来的SSL_CTX（SSL对象持有其引用计数），新握手使用新证书
+    // 读取和解析证书在调用线程中进行，可以在任意线程调用，但不要在IO线程中调用
+    bool reloadCertificates();
+
+    // 生成新的票据密钥作为当前密钥，最老的一把被淘汰
+    // 由HttpServer按配置的周期在主循环中调用，所有IO线程共用同一个密钥环
+    void rotateTicketKeys();
 
 private:
-    bool loadCertificates();
+    bool loadCertificates(SSL_CTX *ctx, const std::string &certFile,
+                          const std::string &keyFile, const std::string &chainFile);
     bool setupProtocol();
     void setupSessionCache();
     static void handleSslError(const char *msg);
 
+    // 票据密钥：16字节名字（写在票据开头，用于找到解密用的密钥）+ AES-256-CBC密钥 + HMAC-SHA256密钥
+    struct TicketKey{
+        unsigned char name[16];
+        unsigned char aesKey[32];
+        unsigned char hmacKey[32];
+    };
+    // 当前密钥在最前；轮换时整体替换，读者拿到的快照不会被修改
+    using TicketKeyRing = std::vector<TicketKey>;
+
+    void setupSessionTickets();
+
+    // 证书表：每个证书一个只装了证书和私钥的SSL_CTX，握手时用SSL_set_SSL_CTX切换过去；
+    // 协议版本、加密套件、会话缓存和票据仍然来自ctx_
+    struct CertificateStore : muduo::noncopyable{
+        ~CertificateStore();
+        SSL_CTX *defaultCtx = nullptr;
+        std::unordered_map<std::string, SSL_CTX *> exact;      // 完整主机名 -> 证书
+        std::unordered_map<std::string, SSL_CTX *> wildcard;   // "*.example.com" 存为 "example.com"
+        // 按SNI选择证书，没有匹配时返回defaultCtx
+        SSL_CTX *select(const char *serverName) const;
+    };
+
+    SSL_CTX *createCertificateContext(const std::string &certFile, const std::string &keyFile,
+                                      const std::string &chainFile);
+    std::shared_ptr<const CertificateStore> certificateStore() const;
+    // OpenSSL处理ClientHello时的回调，根据SNI切换证书
+    static int serverNameCallback(SSL *ssl, int *alert, void *arg);
+    // 按SNI切换SSL_CTX之后OpenSSL用新SSL_CTX上的ALPN回调，所以每个SSL_CTX都要设置
+    void setupAlpn(SSL_CTX *ctx);
+    static int alpnSelectCallback(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                                  const unsigned char *in, unsigned int inlen, void *arg);
+    std::shared_ptr<const TicketKeyRing> ticketKeys() const;
+    // OpenSSL在签发和解密票据时的回调
+    static int ticketKeyCallback(SSL *ssl, unsigned char *keyName, unsigned char *iv,
+                                 EVP_CIPHER_CTX *cipherCtx, EVP_MAC_CTX *macCtx, int enc);
+
 private:
     // OpenSSL 的 SSL_CTX 结构体，用于存储 SSL 上下文信信息
     // 是整个类的核心资源，所有 SSL 通信都会基于它创建 SSL 实例。
     SSL_CTX *ctx_;
     SslConfig config_;
+    mutable std::mutex ticketKeyMutex_;
+    std::shared_ptr<const TicketKeyRing> ticketKeys_;
+    std::unique_ptr<muduo::ThreadPool> handshakePool_;
+    mutable std::mutex certMutex_;
+    std::shared_ptr<const CertificateStore> certStore_;
 
 };
 
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <liburing.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/Buffer.h>
+
+#include "../http/AdmissionControl.h"
+#include "../http/HttpContext.h"
+#include "../http/HttpRequest.h"
+#include "../http/HttpResponse.h"
+
+namespace http{
+namespace uring{
+
+struct IoUringOptions{
+    uint16_t port = 0;
+    int numThreads = 1;
+    // 超时（秒，0表示不限制）、发送缓冲区高水位和请求体上限，含义与HttpServer的同名设置相同
+    int idleTimeout = 60;
+    int headerTimeout = 10;
+    int bodyTimeout = 30;
+    size_t highWaterMark = 1024 * 1024;
+    size_t maxBodySize = 8 * 1024 * 1024;
+    // 连接数限制，为空表示不限制；由HttpServer持有，和muduo后端共用
+    ConnectionLimiter *limiter = nullptr;
+    // 从前任进程接过来的监听socket，第i个线程使用第i个（复制一份，调用者自己的可以关闭）；不够时新建
+    std::vector<int> listenFds;
+};
+
+// 一个io_uring事件循环，每个线程一个：有自己的SO_REUSEPORT监听socket、ring和接收缓冲区环，
+// 自己accept、自己处理，连接不在线程之间转交
+//
+// - accept和recv都用multishot：提交一次，之后每个新连接 / 每段数据各产生一个完成事件
+// - recv不指定缓冲区，由内核从注册的缓冲区环中挑选，读完拷贝进连接的输入缓冲区后立即归还，
+//   空闲连接不占用接收缓冲区
+// - 一轮完成事件处理完之后，每个连接本轮产生的响应合并成一次send，所有新请求一次提交（同时等待下一轮）
+//
+// 只处理明文HTTP/1.x；请求交给requestCallback_（即HttpServer的准入检查、中间件和路由），在本线程中同步执行
+class IoUringLoop : muduo::noncopyable{
+public:
+    using RequestCallback = std::function<void(const HttpRequest &, HttpResponse *)>;
+
+    // index为线程的序号，决定使用哪一个接过来的监听socket
+    IoUringLoop(const IoUringOptions &options, const RequestCallback &cb, size_t index);
+    ~IoUringLoop();
+
+    // 创建监听socket、ring和缓冲区环，内核不支持或监听失败时返回false；必须在运行loop()的线程中调用
+    bool init();
+    // 运行到quit()被调用
+    void loop();
+    // 可以在任意线程调用
+    void quit();
+    // 开始排空：停止accept并关闭监听socket，关闭空闲的连接，其余连接的响应都带上Connection: close；
+    // 可以在任意线程调用
+    void drain();
+
+    // init()之后有效
+    int listenFd() const {return listenFd_;}
+    size_t connectionCount() const {return connectionCount_.load(std::memory_order_relaxed);}
+
+private:
+    struct Connection{
+        uint64_t id = 0;
+        int fd = -1;
+        std::string ip;                 // 只在有连接数限制时记录，用于归还名额
+        HttpContext context;
+        muduo::net::Buffer input;       // 收到但还没有解析完的数据
+        muduo::net::Buffer output;      // 等待发送的响应
+        // 正在发送的数据：send提交后内核直接读这块内存，期间不能再往里追加，新的响应先放进output
+        muduo::net::Buffer sending;
+        int inflight = 0;               // 已提交、还没有最终完成事件的操作数
+        bool recvArmed = false;
+        bool sendArmed = false;
+        bool paused = false;            // 待发送数据超过高水位，暂停解析和接收
+        bool closeAfterSend = false;    // 响应发完后关闭（短连接或请求错误）
+        bool peerClosed = false;        // 对端已经关闭了写方向
+        bool closing = false;
+        HttpContext::TimeoutPhase phase = HttpContext::kTimeoutNone;
+        muduo::Timestamp deadline;      // 当前阶段的期限，无效表示不限制
+    };
+    using ConnectionPtr = std::unique_ptr<Connection>;
+
+    // user_data的高8位是操作类型，低56位是连接ID；连接关闭后迟到的完成事件按ID找不到连接，直接忽略
+    enum OpType : uint64_t{
+        kAccept = 1,
+        kRecv,
+        kSend,
+        kShutdown,
+        kClose,
+        kCancel,
+        kTimer,
+        kWakeup,
+        kProbe,
+    };
+    static uint64_t userData(OpType op, uint64_t id) {return (static_cast<uint64_t>(op) << 56) | id;}
+
+    // 在socketpair上试一次multishot recv：有缓冲区环但不支持multishot recv的内核（6.0之前）返回EINVAL，
+    // 这时每个连接的recv都会失败，只能换用epoll后端；必须在缓冲区环建好之后调用
+    bool probeMultishotRecv();
+    // 取一个提交项，提交队列满时先把已有的提交掉
+    io_uring_sqe *getSqe();
+    void armAccept();
+    void armRecv(Connection *conn);
+    void armSend(Connection *conn);
+    void armTimer();
+    void armWakeup();
+
+    void handleCompletion(io_uring_cqe *cqe);
+    void onAccept(io_uring_cqe *cqe);
+    void onRecv(Connection *conn, io_uring_cqe *cqe);
+    void onSend(Connection *conn, io_uring_cqe *cqe);
+    void onShutdown(Connection *conn);
+    // 每秒检查一次各连接的期限，恢复暂停的accept
+    void onTimer();
+    void startDrain();
+
+    // 解析输入缓冲区中的完整请求并生成响应，追加到output
+    void processInput(Connection *conn);
+    // 与HttpServer::updateTimeout相同：阶段变化时按新阶段重新计时，阶段不变时期限不变
+    void setPhase(Connection *conn, HttpContext::TimeoutPhase phase);
+    // 待发送数据超过高水位时暂停解析和接收，发送缓冲区排空后恢复
+    void pause(Connection *conn);
+    void resume(Connection *conn);
+    // 取消连接上的所有操作，全部结束后关闭socket并释放连接
+    void closeConnection(Connection *conn);
+    void maybeDestroy(Connection *conn);
+    void returnBuffer(uint16_t bid);
+
+    // 接收缓冲区环：kBufferCount个kBufferSize字节的缓冲区
+    static constexpr unsigned kBufferCount = 512;
+    static constexpr size_t kBufferSize = 8192;
+    static constexpr int kBufferGroup = 0;
+    static constexpr unsigned kQueueDepth = 4096;
+
+private:
+    IoUringOptions options_;
+    RequestCallback requestCallback_;
+    size_t index_;
+    io_uring ring_;
+    bool ringInitialized_;
+    io_uring_buf_ring *bufferRing_;
+    std::vector<char> bufferMemory_;
+    int listenFd_;
+    int wakeupFd_;                      // eventfd，quit()写它唤醒loop()
+    uint64_t wakeupValue_;
+    __kernel_timespec tick_;            // 定时器的间隔，提交后到完成前内核会读它
+    std::atomic<bool> quit_;
+    std::atomic<bool> draining_;
+    bool drainStarted_;                 // 只在本线程中访问
+    // 描述符用完（EMFILE/ENFILE）后accept暂停，由下一次定时器重新提交，避免在同一个错误上空转
+    bool acceptPaused_;
+    muduo::Timestamp now_;              // 本轮完成事件的处理时间，作为请求的接收时间
+    uint64_t nextId_;
+    std::unordered_map<uint64_t, ConnectionPtr> connections_;
+    std::atomic<size_t> connectionCount_;   // connections_的大小，供其它线程查看排空的进度
+    // 本轮有新响应待发送的连接，一轮结束时统一提交send
+    std::vector<uint64_t> dirty_;
+};
+
+// 多个线程各运行一个IoUringLoop
+class IoUringServer : muduo::noncopyable{
+public:
+    using RequestCallback = IoUringLoop::RequestCallback;
+
+    IoUringServer(const IoUringOptions &options, const RequestCallback &cb);
+    ~IoUringServer();
+
+    // 启动全部线程，等它们都开始监听后返回；有线程初始化失败时停止已启动的线程并返回false
+    bool start();
+    void stop();
+    // 所有线程开始排空，见IoUringLoop::drain()
+    void drain();
+
+    // 各线程的监听socket，按线程的顺序，start()之后、drain()之前有效
+    const std::vector<int> &listenFds() const {return listenFds_;}
+    size_t connectionCount() const;
+
+private:
+    IoUringOptions options_;
+    RequestCallback requestCallback_;
+    std::vector<int> listenFds_;
+    std::vector<std::unique_ptr<IoUringLoop>> loops_;
+    std::vector<std::thread> threads_;
+};
+
+}
+}
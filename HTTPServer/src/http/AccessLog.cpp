@@ -0,0 +1,275 @@
+#include "../../include/http/AccessLog.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+#include <muduo/base/Logging.h>
+
+namespace http{
+
+namespace{
+
+std::atomic<uint64_t> g_nextLogId(1);
+
+// 本线程用过的环：AccessLog的id -> 环，通常只有一项
+thread_local std::vector<std::pair<uint64_t, std::shared_ptr<void>>> t_rings;
+thread_local uint64_t t_lastId = 0;
+thread_local void *t_lastRing = nullptr;
+
+// 抽样用的xorshift，每个线程一个状态，不需要同步
+thread_local uint32_t t_random = 0;
+
+uint32_t nextRandom(){
+    if(t_random == 0){
+        t_random = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    }
+    t_random ^= t_random << 13;
+    t_random ^= t_random >> 17;
+    t_random ^= t_random << 5;
+    return t_random;
+}
+
+const char *methodName(uint8_t method){
+    switch(method){
+        case HttpRequest::kGet: return "GET";
+        case HttpRequest::kPost: return "POST";
+        case HttpRequest::kHead: return "HEAD";
+        case HttpRequest::kPut: return "PUT";
+        case HttpRequest::kDelete: return "DELETE";
+        case HttpRequest::kOptions: return "OPTIONS";
+        default: return "-";
+    }
+}
+
+const char *versionName(uint8_t version){
+    switch(version){
+        case 0: return "HTTP/1.0";
+        case 1: return "HTTP/1.1";
+        case 2: return "HTTP/2.0";
+        default: return "-";
+    }
+}
+
+// 路径来自客户端，控制字符、空格和反斜杠写成\xNN：换行会伪造出整行日志，空格会让按空格切分的字段错位
+void appendEscaped(std::string *batch, const char *data, size_t length){
+    static const char kHex[] = "0123456789abcdef";
+    for(size_t i = 0; i < length; ++i){
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if(c <= ' ' || c == 0x7f || c == '\\'){
+            char escaped[4] = {'\\', 'x', kHex[c >> 4], kHex[c & 0xf]};
+            batch->append(escaped, sizeof(escaped));
+        }
+        else{
+            batch->push_back(static_cast<char>(c));
+        }
+    }
+}
+
+uint8_t versionCode(const std::string &version){
+    if(version == "HTTP/1.1"){
+        return 1;
+    }
+    if(version == "HTTP/1.0"){
+        return 0;
+    }
+    if(version == "HTTP/2.0"){
+        return 2;
+    }
+    return 3;
+}
+
+size_t roundUpPowerOfTwo(size_t n){
+    size_t capacity = 1;
+    while(capacity < n){
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+}
+
+AccessLog::Ring::Ring(size_t capacity)
+    : records(roundUpPowerOfTwo(std::max<size_t>(capacity, 2)))
+    , mask(records.size() - 1)
+    , head(0)
+    , tail(0)
+{
+}
+
+AccessLog::AccessLog(const AccessLogConfig &config)
+    : config_(config)
+    , sampleThreshold_(0)
+    , id_(g_nextLogId.fetch_add(1, std::memory_order_relaxed))
+    , file_(stdout)
+    , dropped_(0)
+    , running_(true)
+{
+    double rate = std::min(std::max(config_.sampleRate, 0.0), 1.0);
+    sampleThreshold_ = rate >= 1.0 ? UINT32_MAX : static_cast<uint32_t>(rate * UINT32_MAX);
+    if(!config_.path.empty()){
+        file_ = ::fopen(config_.path.c_str(), "ae");
+        if(!file_){
+            LOG_SYSERR << "Failed to open access log " << config_.path << ", writing to stdout";
+            file_ = stdout;
+        }
+    }
+    thread_ = std::thread(&AccessLog::threadFunc, this);
+}
+
+AccessLog::~AccessLog(){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_one();
+    thread_.join();
+    if(file_ != stdout){
+        ::fclose(file_);
+    }
+}
+
+void AccessLog::log(const HttpRequest &req, const HttpResponse &resp){
+    if(config_.level == AccessLogConfig::kOff){
+        return;
+    }
+    muduo::Timestamp now = muduo::Timestamp::now();
+    muduo::Timestamp received = req.receiveTime().valid() ? req.receiveTime() : now;
+    int64_t latency = now.microSecondsSinceEpoch() - received.microSecondsSinceEpoch();
+    int status = static_cast<int>(resp.getStatusCode());
+    bool notable = status >= 400
+                || (config_.slowThreshold > 0
+                    && latency >= static_cast<int64_t>(config_.slowThreshold * muduo::Timestamp::kMicroSecondsPerSecond));
+    if(!notable && (config_.level == AccessLogConfig::kErrors || !sampled())){
+        return;
+    }
+
+    Record record;
+    record.time = received.microSecondsSinceEpoch();
+    record.requestBytes = req.getBody().size();
+    record.responseBytes = resp.body().size();
+    record.latency = static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(latency, 0), UINT32_MAX));
+    record.status = static_cast<uint16_t>(status);
+    record.method = static_cast<uint8_t>(req.method());
+    record.version = versionCode(req.getVersion());
+    const std::string &path = req.path();
+    record.pathLength = static_cast<uint8_t>(std::min(path.size(), kMaxPathLength));
+    memcpy(record.path, path.data(), record.pathLength);
+    push(record);
+}
+
+bool AccessLog::sampled(){
+    return sampleThreshold_ == UINT32_MAX || nextRandom() < sampleThreshold_;
+}
+
+AccessLog::Ring *AccessLog::localRing(){
+    if(t_lastId == id_){
+        return static_cast<Ring *>(t_lastRing);
+    }
+    Ring *ring = nullptr;
+    for(auto &entry : t_rings){
+        if(entry.first == id_){
+            ring = static_cast<Ring *>(entry.second.get());
+            break;
+        }
+    }
+    if(!ring){
+        // 线程本地变量和rings_各持有一份，线程退出后只剩rings_中的一份，后台线程据此回收
+        RingPtr created = std::make_shared<Ring>(config_.ringCapacity);
+        ring = created.get();
+        t_rings.emplace_back(id_, created);
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        rings_.push_back(std::move(created));
+    }
+    t_lastId = id_;
+    t_lastRing = ring;
+    return ring;
+}
+
+void AccessLog::push(const Record &record){
+    Ring *ring = localRing();
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    if(tail - ring->head.load(std::memory_order_acquire) >= ring->records.size()){
+        // 后台线程跟不上时丢弃，不阻塞请求线程
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->records[tail & ring->mask] = record;
+    ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+void AccessLog::threadFunc(){
+    std::string batch;
+    uint64_t reportedDropped = 0;
+    auto interval = std::chrono::microseconds(static_cast<int64_t>(config_.flushInterval * 1000000));
+    bool running = true;
+    while(running){
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait_for(lock, interval, [this](){return !running_;});
+            running = running_;
+        }
+        // 退出前最后再取一次，析构时请求线程都已经停止
+        if(drain(&batch) > 0){
+            ::fwrite(batch.data(), 1, batch.size(), file_);
+            ::fflush(file_);
+            batch.clear();
+        }
+        uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if(dropped != reportedDropped){
+            LOG_WARN << "Access log dropped " << dropped - reportedDropped << " records";
+            reportedDropped = dropped;
+        }
+    }
+}
+
+size_t AccessLog::drain(std::string *batch){
+    std::vector<RingPtr> rings;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        // use_count为1说明所属线程已经退出，不会再有新记录
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const RingPtr &ring){
+                         return ring.use_count() == 1
+                             && ring->head.load(std::memory_order_relaxed) == ring->tail.load(std::memory_order_acquire);
+                     }),
+                     rings_.end());
+        rings = rings_;
+    }
+    size_t count = 0;
+    for(const RingPtr &ring : rings){
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for(uint64_t i = head; i != tail; ++i){
+            format(ring->records[i & ring->mask], batch);
+        }
+        count += tail - head;
+        // 格式化完才归还这些位置
+        ring->head.store(tail, std::memory_order_release);
+    }
+    return count;
+}
+
+void AccessLog::format(const Record &record, std::string *batch){
+    time_t seconds = static_cast<time_t>(record.time / muduo::Timestamp::kMicroSecondsPerSecond);
+    int micros = static_cast<int>(record.time % muduo::Timestamp::kMicroSecondsPerSecond);
+    struct tm tm;
+    ::gmtime_r(&seconds, &tm);
+    char line[96];
+    int n = snprintf(line, sizeof(line), "%4d-%02d-%02d %02d:%02d:%02d.%06d %s ",
+                     tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                     tm.tm_hour, tm.tm_min, tm.tm_sec, micros, methodName(record.method));
+    batch->append(line, n);
+    appendEscaped(batch, record.path, record.pathLength);
+    n = snprintf(line, sizeof(line), " %s %u req=%llu resp=%llu us=%u\n",
+                 versionName(record.version), record.status,
+                 static_cast<unsigned long long>(record.requestBytes),
+                 static_cast<unsigned long long>(record.responseBytes),
+                 record.latency);
+    batch->append(line, n);
+}
+
+}
@@ -0,0 +1,90 @@
+#include "../../include/http/AdmissionControl.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace http{
+
+namespace{
+
+const size_t kLimiterShards = 16;
+
+}
+
+ConnectionLimiter::ConnectionLimiter(size_t maxConnections, size_t maxConnectionsPerIp)
+    : maxConnections_(maxConnections)
+    , maxConnectionsPerIp_(maxConnectionsPerIp)
+    , total_(0)
+    , shards_(kLimiterShards)
+{
+}
+
+ConnectionLimiter::Shard &ConnectionLimiter::shardFor(const std::string &ip){
+    return shards_[std::hash<std::string>()(ip) % shards_.size()];
+}
+
+bool ConnectionLimiter::tryAcquire(const std::string &ip){
+    // 先加再检查，超出时退回，多个IO线程同时接受连接也不会超过上限
+    size_t total = total_.fetch_add(1, std::memory_order_relaxed) + 1;
+    if(maxConnections_ > 0 && total > maxConnections_){
+        total_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    if(maxConnectionsPerIp_ > 0){
+        Shard &shard = shardFor(ip);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size_t &count = shard.counts[ip];
+        if(count >= maxConnectionsPerIp_){
+            total_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        ++count;
+    }
+    return true;
+}
+
+void ConnectionLimiter::release(const std::string &ip){
+    total_.fetch_sub(1, std::memory_order_relaxed);
+    if(maxConnectionsPerIp_ > 0){
+        Shard &shard = shardFor(ip);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.counts.find(ip);
+        if(it != shard.counts.end() && --it->second == 0){
+            shard.counts.erase(it);
+        }
+    }
+}
+
+LoadShedder::LoadShedder(muduo::net::EventLoop *loop, double targetQueueDelay, double interval)
+    : loop_(loop)
+    , targetQueueDelay_(targetQueueDelay)
+    , interval_(interval)
+    , lastTick_(muduo::Timestamp::now())
+    , minQueueDelay_(std::numeric_limits<double>::infinity())
+    , overloaded_(false)
+{
+    timerId_ = loop_->runEvery(interval_, std::bind(&LoadShedder::onTimer, this));
+}
+
+LoadShedder::~LoadShedder(){
+    loop_->cancel(timerId_);
+}
+
+bool LoadShedder::shouldShed(double queueDelay){
+    minQueueDelay_ = std::min(minQueueDelay_, queueDelay);
+    return overloaded_ && queueDelay > targetQueueDelay_;
+}
+
+void LoadShedder::onTimer(){
+    // 定时器本身也要排队等IO线程空出来，实际间隔比设定的长出的部分就是事件循环的延迟
+    muduo::Timestamp now = muduo::Timestamp::now();
+    double loopLag = timeDifference(now, lastTick_) - interval_;
+    lastTick_ = now;
+
+    // 没有请求的周期只看事件循环的延迟
+    bool sawRequests = minQueueDelay_ != std::numeric_limits<double>::infinity();
+    overloaded_ = (sawRequests && minQueueDelay_ > targetQueueDelay_) || loopLag > targetQueueDelay_;
+    minQueueDelay_ = std::numeric_limits<double>::infinity();
+}
+
+}
@@ -43,7 +43,12 @@ bool HttpContext::parseRequest(Buffer *buf, Timestamp, receiveTime){
                         std:: string contentLength = request_.getHeader("Content-Length");
                         if(!contentLength.empty()){
                             request_.setContentLength(std::stoi(contentLength));
-                            if(request_.contentLength() > 0){
+                            if(maxBodySize_ > 0 && request_.contentLength() > maxBodySize_){
+                                bodyTooLarge_ = true;
+                                ok = false;
+                                hasMore = false;
+                            }
+                            else if(request_.contentLength() > 0){
                                 // Put 和 Post 请求，并且存在内容，则继续解析请求体
                                 state_ = kExpectBody;
                             }
@@ -59,6 +64,11 @@ bool HttpContext::parseRequest(Buffer *buf, Timestamp, receiveTime){
                             hasMore = false;
                         }
                     }
+                    else{
+                        // GET等没有请求体的方法，空行就是报文结尾
+                        state_ = kGotAll;
+                        hasMore = false;
+                    }
                 }
                 buf->retrieveUntil(crlf + 2);  //开始读指针指向下一行数据
             }
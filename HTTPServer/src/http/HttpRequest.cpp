@@ -106,6 +106,9 @@ void HttpRequest::addHeader(const char *start, const char *colon, const char *en
     }
     headers_[key] = value;
 }
+void HttpRequest::addHeader(const std::string &field, const std::string &value){
+    headers_[field] = value;
+}
 std::string HttpRequest::getHeader(const std::string &field) const {
     auto it = headers_.find(field);
     if(it != headers_.end()){
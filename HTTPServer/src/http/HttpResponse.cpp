@@ -28,6 +28,10 @@ void HttpResponse::appendToBuffer(muduo::net::Buffer *outputBuf) const{
         outputBuf->append(header.second);
         outputBuf->apppend("\r\n");
     }
+    // 预格式化的头部块已经带有\r\n，直接整体追加
+    if(!rawHeaders_.empty()){
+        outputBuf->append(rawHeaders_);
+    }
     outputBuf->append("\r\n");
     // \r\n：标志 HTTP 头部结束；
     // 然后写入 body_ 内容，可以是 HTML、JSON 等任意字符串。
@@ -1,11 +1,50 @@
 #include "../../include/http/HttpServer.h"
+#include "../../include/uring/IoUringServer.h"
 
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
 #include <any>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <string>
 
 namespace http{
 
+namespace{
+
+// 程序返回处理这个SYN的CPU编号，内核把它当作组内监听socket的序号（按listen的先后），
+// 超出监听数时退回默认的按四元组哈希分配；程序挂在组内任意一个socket上都对整个组生效
+bool attachCpuSteering(int fd){
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    return ::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+
+// 信号处理函数只能做异步信号安全的事，写eventfd唤醒主循环，由主循环调用stop()
+int g_stopSignalFd = -1;
+
+void onStopSignal(int){
+    uint64_t one = 1;
+    ssize_t n = ::write(g_stopSignalFd, &one, sizeof(one));
+    (void)n;
+}
+
+}
+
 // 默认http回应函数
 void defaultHttpCallback(const HttpRequest &, HttpResponse *resp){
     resp->setStatusCode(HttpResponse::k404NotFound);
@@ -18,33 +57,385 @@ HttpServer::HttpServer(int port,
                        bool useSSL,
                        muduo::net::TcpServer::Option option)
     : lisenAddr_(port)
-    , server_(&mainLoop_, ListenAddr_, name, option)
+    , name_(name)
+    , nextConnId_(1)
     , useSSL_(useSSL)
+    , http2Enabled_(false)
+    , idleTimeout_(60)
+    , headerTimeout_(10)
+    , bodyTimeout_(30)
+    , highWaterMark_(1024 * 1024)
+    , maxBodySize_(8 * 1024 * 1024)
+    , option_(option)
+    , reusePortListeners_(0)
+    , pinListeners_(false)
+    , cpuSteering_(false)
+    , ioUringThreads_(0)
+    , handedOver_(false)
+    , shutdownGracePeriod_(30.0)
+    , stopOnSignals_(false)
+    , draining_(false)
+    , activeConnections_(0)
+    , inflightRequests_(0)
+    , sessionCleanInterval_(1.0)
     , httpCallback_(std::bind(&HttpServer::handlerRequest, this, std::placeholders::_1, std::placeholders::_2))
 {
         initialize();
 }
 
+HttpServer::~HttpServer(){
+    // 挂在主循环上的Channel
+    handover_.reset();
+    if(signalChannel_){
+        signalChannel_->disableAll();
+        signalChannel_->remove();
+        signalChannel_.reset();
+    }
+    // io_uring线程会回调到本对象，先停掉它们
+    uringServer_.reset();
+    {
+        std::lock_guard<std::mutex> lock(listenerLoopsMutex_);
+        for(muduo::net::EventLoop *loop : listenerLoops_){
+            loop->quit();
+        }
+    }
+    // 监听线程退出前自己销毁各自的连接
+    for(std::thread &thread : listenerThreads_){
+        thread.join();
+    }
+    // 主监听模式：停止accept，剩下的连接和定时器在各自的IO线程中销毁；线程池析构时先执行完这些任务再结束线程，
+    // loopStates_在此之后才释放，不会有定时器再访问它
+    listener_.reset();
+    {
+        std::lock_guard<std::mutex> lock(loopStatesMutex_);
+        for(auto &state : loopStates_){
+            state->loop->runInLoop(std::bind(&HttpServer::destroyConnections, this, state->loop));
+        }
+    }
+    threadPool_.reset();
+}
+
 void HttpServer::start(){
-    LOG_WARN << "httpServer[" << server_.name() << "] start listening on " << sever_.ipPort();
-    server_.start();
+    // 有前任时接过它的监听socket，端口不对的（比如改了配置）不用
+    int ackFd = -1;
+    std::vector<int> inherited;
+    if(!handoverPath_.empty() && ListenerHandover::takeOver(handoverPath_, &inherited, &ackFd)){
+        for(int fd : inherited){
+            if(Listener::isListeningOn(fd, listenAddr_.port())){
+                inheritedFds_.push_back(fd);
+            }
+            else{
+                ::close(fd);
+            }
+        }
+        LOG_WARN << "httpServer[" << name_ << "] took over " << inheritedFds_.size()
+                 << " listeners from predecessor";
+    }
+
+    if(ioUringThreads_ > 0 && startIoUring()){
+        // 监听和连接都由io_uring线程处理，主循环只运行下面的定时任务
+    }
+    else if(reusePortListeners_ > 0){
+        LOG_WARN << "httpServer[" << name_ << "] start " << reusePortListeners_
+                 << " SO_REUSEPORT listeners on " << listenAddr_.toIpPort();
+        // 逐个启动，等前一个开始监听后再启动下一个，保证组内序号和线程（CPU）编号一致
+        for(int i = 0; i < reusePortListeners_; ++i){
+            std::promise<void> ready;
+            std::future<void> listening = ready.get_future();
+            listenerThreads_.emplace_back(&HttpServer::runListener, this, i, &ready);
+            listening.wait();
+        }
+        if(cpuSteering_ && !attachCpuSteering(listeningFds().front())){
+            LOG_WARN << "Failed to attach CPU steering program, fall back to hash distribution";
+        }
+    }
+    else{
+        LOG_WARN << "httpServer[" << name_ << "] start listening on " << listenAddr_.toIpPort();
+        // 没有设置IO线程时，线程池以主循环调用onThreadInit
+        threadPool_->start(std::bind(&HttpServer::onThreadInit, this, std::placeholders::_1));
+        int fd = listenerSocket(0);
+        if(fd < 0){
+            LOG_FATAL << "httpServer[" << name_ << "] cannot listen on " << listenAddr_.toIpPort();
+        }
+        listener_ = std::make_unique<Listener>(&mainLoop_, fd);
+        if(!startListener(listener_.get(), nullptr)){
+            LOG_FATAL << "httpServer[" << name_ << "] cannot listen on " << listenAddr_.toIpPort();
+        }
+    }
+    // 已经开始accept，接过来的socket中没有用上的关闭，通知前任排空
+    for(int fd : inheritedFds_){
+        if(fd >= 0){
+            LOG_WARN << "More listeners than this process uses, closing inherited listener " << fd;
+            ::close(fd);
+        }
+    }
+    inheritedFds_.clear();
+    if(ackFd >= 0){
+        ListenerHandover::confirm(ackFd);
+    }
+    if(!handoverPath_.empty()){
+        handover_ = std::make_unique<ListenerHandover>(&mainLoop_, handoverPath_);
+        if(!handover_->listen(std::bind(&HttpServer::listeningFds, this), std::bind(&HttpServer::onHandedOver, this))){
+            handover_.reset();
+        }
+    }
+    if(stopOnSignals_){
+        installStopSignals();
+    }
+    // 定时增量清理过期会话，每个tick只处理一批
+    if(sessionManager_){
+        mainLoop_.runEvery(sessionCleanInterval_, [this](){
+            sessionManager_->cleanExpiredSessions();
+        });
+    }
+    // 定时轮换TLS会话票据密钥
+    if(sslCtx_ && sslCtx_->getConfig().getSessionTickets()){
+        mainLoop_.runEvery(sslCtx_->getConfig().getTicketKeyRotation(), [this](){
+            sslCtx_->rotateTicketKeys();
+        });
+    }
     mainLoop_.loop();
 }
 
 void HttpServer::initialize(){
-    // 设置回调
-    server_.setConnectionCallback(std::bind(&HttpServer::onConnection, this,
-                                            std::placeholders::_1));
+    threadPool_ = std::make_unique<muduo::net::EventLoopThreadPool>(&mainLoop_, name_);
+}
+
+void HttpServer::setHandoverPath(const std::string &path){
+    if(!path.empty() && option_ != muduo::net::TcpServer::kReusePort){
+        LOG_ERROR << "Listener handover requires HttpServer constructed with kReusePort";
+        abort();
+    }
+    handoverPath_ = path;
+}
+
+void HttpServer::setReusePortListeners(int numListeners, bool pinCpu, bool cpuSteering){
+    if(numListeners > 0 && option_ != muduo::net::TcpServer::kReusePort){
+        LOG_ERROR << "SO_REUSEPORT listeners require HttpServer constructed with kReusePort";
+        abort();
+    }
+    reusePortListeners_ = numListeners;
+    // 按CPU分配连接要求监听线程和CPU一一对应
+    pinListeners_ = pinCpu || cpuSteering;
+    cpuSteering_ = cpuSteering;
+}
+
+bool HttpServer::startIoUring(){
+    if(useSSL_ || http2Enabled_){
+        LOG_WARN << "io_uring backend serves plaintext HTTP/1.x only, fall back to muduo";
+        return false;
+    }
+    uring::IoUringOptions options;
+    options.port = listenAddr_.port();
+    options.numThreads = ioUringThreads_;
+    options.idleTimeout = idleTimeout_;
+    options.headerTimeout = headerTimeout_;
+    options.bodyTimeout = bodyTimeout_;
+    options.highWaterMark = highWaterMark_;
+    options.maxBodySize = maxBodySize_;
+    options.limiter = connectionLimiter_.get();
+    options.listenFds = inheritedFds_;
+    // io_uring线程不是muduo的EventLoop，没有按线程的过载检测，其余准入检查照常
+    uringServer_ = std::make_unique<uring::IoUringServer>(options, [this](const HttpRequest &req, HttpResponse *resp){
+        serve(nullptr, req, resp);
+    });
+    if(!uringServer_->start()){
+        LOG_WARN << "io_uring backend unavailable, fall back to muduo";
+        uringServer_.reset();
+        return false;
+    }
+    // 各线程用的是自己复制的一份
+    for(size_t i = 0; i < inheritedFds_.size() && i < static_cast<size_t>(ioUringThreads_); ++i){
+        ::close(inheritedFds_[i]);
+        inheritedFds_[i] = -1;
+    }
+    LOG_WARN << "httpServer[" << name_ << "] start " << ioUringThreads_
+             << " io_uring listeners on " << listenAddr_.toIpPort();
+    return true;
+}
+
+void HttpServer::runListener(int index, std::promise<void> *ready){
+    if(pinListeners_){
+        long cpus = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(index % cpus, &cpuSet);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0){
+            LOG_WARN << "Failed to pin listener " << index << " to CPU " << index % cpus;
+        }
+    }
+    muduo::net::EventLoop loop;
+    onThreadInit(&loop);
+    int fd = listenerSocket(index);
+    if(fd < 0){
+        LOG_FATAL << "httpServer[" << name_ << "] listener " << index << " cannot listen on " << listenAddr_.toIpPort();
+    }
+    Listener listener(&loop, fd);
+    // 本线程accept的连接就在本线程处理；返回时已经开始监听
+    if(!startListener(&listener, &loop)){
+        LOG_FATAL << "httpServer[" << name_ << "] listener " << index << " cannot listen on " << listenAddr_.toIpPort();
+    }
+    {
+        std::lock_guard<std::mutex> lock(listenerLoopsMutex_);
+        listenerLoops_.push_back(&loop);
+    }
+    ready->set_value();
+    loop.loop();
+
+    {
+        std::lock_guard<std::mutex> lock(listenerLoopsMutex_);
+        listenerLoops_.erase(std::find(listenerLoops_.begin(), listenerLoops_.end(), &loop));
+        listeners_.erase(std::find(listeners_.begin(), listeners_.end(), &listener));
+    }
+    // 连接和LoopState都要在loop还在的时候、在本线程中销毁
+    destroyConnections(&loop);
+    std::lock_guard<std::mutex> lock(loopStatesMutex_);
+    loopStates_.erase(std::find_if(loopStates_.begin(), loopStates_.end(),
+                                   [&loop](const std::unique_ptr<LoopState> &state){return state->loop == &loop;}));
+}
+
+int HttpServer::listenerSocket(size_t index){
+    if(index < inheritedFds_.size() && inheritedFds_[index] >= 0){
+        int fd = inheritedFds_[index];
+        inheritedFds_[index] = -1;
+        return fd;
+    }
+    return Listener::createSocket(listenAddr_, option_ == muduo::net::TcpServer::kReusePort);
+}
+
+bool HttpServer::startListener(Listener *listener, muduo::net::EventLoop *ioLoop){
+    listener->setNewConnectionCallback([this, ioLoop](int sockfd, const muduo::net::InetAddress &peerAddr){
+        newConnection(ioLoop ? ioLoop : threadPool_->getNextLoop(), sockfd, peerAddr);
+    });
+    if(!listener->listen()){
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(listenerLoopsMutex_);
+    listeners_.push_back(listener);
+    listenFds_.push_back(listener->fd());
+    return true;
+}
+
+std::vector<int> HttpServer::listeningFds(){
+    if(uringServer_){
+        return uringServer_->listenFds();
+    }
+    std::lock_guard<std::mutex> lock(listenerLoopsMutex_);
+    return listenFds_;
+}
+
+void HttpServer::installStopSignals(){
+    g_stopSignalFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(g_stopSignalFd < 0){
+        LOG_SYSERR << "Failed to create eventfd for stop signals";
+        return;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    ::sigaction(SIGTERM, &action, nullptr);
+    ::sigaction(SIGINT, &action, nullptr);
+    signalChannel_.reset(new muduo::net::Channel(&mainLoop_, g_stopSignalFd));
+    signalChannel_->setReadCallback([this](muduo::Timestamp){
+        uint64_t count;
+        ssize_t n = ::read(g_stopSignalFd, &count, sizeof(count));
+        (void)n;
+        stop();
+    });
+    signalChannel_->enableReading();
+}
+
+void HttpServer::stop(){
+    mainLoop_.runInLoop(std::bind(&HttpServer::startDrain, this));
+}
+
+void HttpServer::onHandedOver(){
+    handedOver_ = true;
+    startDrain();
+}
+
+void HttpServer::startDrain(){
+    if(draining_.exchange(true)){
+        return;
+    }
+    LOG_WARN << "httpServer[" << name_ << "] draining, grace period " << shutdownGracePeriod_ << "s";
+    // 不再接受继任者；可能正在它自己的回调中，推迟释放
+    mainLoop_.queueInLoop([this](){
+        handover_.reset();
+    });
+
+    // 停止accept：交接之后accept队列中的连接留给继任者，它持有同一组监听socket；
+    // 没有继任者时先accept完队列中的连接再关闭监听socket，否则它们会被内核重置
+    if(uringServer_){
+        uringServer_->drain();
+    }
+    else{
+        std::lock_guard<std::mutex> lock(listenerLoopsMutex_);
+        for(Listener *listener : listeners_){
+            listener->getLoop()->runInLoop(std::bind(&Listener::stop, listener, !handedOver_));
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(loopStatesMutex_);
+        for(auto &state : loopStates_){
+            muduo::net::EventLoop *loop = state->loop;
+            loop->runInLoop(std::bind(&HttpServer::closeIdleConnections, this, loop));
+        }
+    }
+    drainDeadline_ = muduo::addTime(muduo::Timestamp::now(), shutdownGracePeriod_);
+    mainLoop_.runEvery(0.1, std::bind(&HttpServer::checkDrained, this));
+}
+
+void HttpServer::closeIdleConnections(muduo::net::EventLoop *loop){
+    LoopState *state = loopState(loop);
+    if(!state){
+        return;
+    }
+    for(const muduo::net::TcpConnectionPtr &conn : state->connections){
+        HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
+        if(!context){
+            continue;   // 被连接数上限拒绝、正在关闭的连接
+        }
+        if(http2::Http2Connection *http2Conn = context->http2Connection()){
+            http2Conn->goAway();
+            if(http2Conn->idle()){
+                conn->shutdown();
+            }
+            continue;
+        }
+        // 正在接收或者等待发送响应的连接，在响应之后关闭（onRequest中带上Connection: close）
+        muduo::net::Buffer *input = context->sslConnection() ? context->sslConnection()->getDecryptedBuffer()
+                                                             : conn->inputBuffer();
+        if(context->expectRequestLine() && !context->writePaused()
+           && input->readableBytes() == 0 && conn->outputBuffer()->readableBytes() == 0){
+            conn->shutdown();
+        }
+    }
+}
 
-    server_.setMassageCallback(std::bind(&HttpServer::onMessage, this,
-                                         std::placeholders::_1,
-                                         std::placeholders::_2,
-                                         std::placeholders::_3));
+void HttpServer::checkDrained(){
+    size_t remaining = activeConnections_.load(std::memory_order_relaxed);
+    if(uringServer_){
+        remaining += uringServer_->connectionCount();
+    }
+    bool expired = !(muduo::Timestamp::now() < drainDeadline_);
+    if(remaining == 0 || expired){
+        if(remaining > 0){
+            LOG_WARN << remaining << " connections still open after grace period, closing them";
+        }
+        mainLoop_.quit();
+    }
 }
 
 void HttpServer::setSslConfig(const ssl::SslConfig &config){
     if(useSSL_){
-        sslCtx_ = std::make_unique<ssl::SslContext>(config);    // 创建一个unique_ptr指针，括号内是构造初始化
+        ssl::SslConfig sslConfig = config;
+        if(http2Enabled_){
+            sslConfig.setEnableHttp2(true);
+        }
+        sslCtx_ = std::make_unique<ssl::SslContext>(sslConfig);    // 创建一个unique_ptr指针，括号内是构造初始化
         if(!sslCtx_->initialize()){
             LOG_ERROR << "Failed to initialize SSL context";
             abort();    // 终止程序
@@ -52,29 +443,116 @@ void HttpServer::setSslConfig(const ssl::SslConfig &config){
     }
 }
 
-void HttpServer::onConnection(const muduo::net::TcpConnectionPtr &conn){
+void HttpServer::setAdmissionConfig(const AdmissionConfig &config){
+    admissionConfig_ = config;
+    if(config.maxConnections > 0 || config.maxConnectionsPerIp > 0){
+        connectionLimiter_ = std::make_unique<ConnectionLimiter>(config.maxConnections, config.maxConnectionsPerIp);
+    }
+    else{
+        connectionLimiter_.reset();
+    }
+}
+
+void HttpServer::newConnection(muduo::net::EventLoop *ioLoop, int sockfd, const muduo::net::InetAddress &peerAddr){
+    struct sockaddr_in6 local;
+    memset(&local, 0, sizeof(local));
+    socklen_t len = sizeof(local);
+    if(::getsockname(sockfd, reinterpret_cast<struct sockaddr *>(&local), &len) != 0){
+        LOG_SYSERR << "getsockname of new connection";
+    }
+    muduo::net::InetAddress localAddr;
+    localAddr.setSockAddrInet6(local);
+    std::string connName = name_ + "-" + listenAddr_.toIpPort() + "#"
+                         + std::to_string(nextConnId_.fetch_add(1, std::memory_order_relaxed));
+    auto conn = std::make_shared<muduo::net::TcpConnection>(ioLoop, connName, sockfd, localAddr, peerAddr);
+    conn->setConnectionCallback(std::bind(&HttpServer::onConnection, this, std::placeholders::_1, sockfd));
+    conn->setMessageCallback(std::bind(&HttpServer::onMessage, this,
+                                       std::placeholders::_1,
+                                       std::placeholders::_2,
+                                       std::placeholders::_3));
+    conn->setWriteCompleteCallback(std::bind(&HttpServer::onWriteComplete, this, std::placeholders::_1));
+    conn->setCloseCallback(std::bind(&HttpServer::removeConnection, this, std::placeholders::_1));
+    ioLoop->runInLoop([this, conn](){
+        if(LoopState *state = loopState(conn->getLoop())){
+            state->connections.insert(conn);
+        }
+        conn->connectEstablished();
+    });
+}
+
+void HttpServer::removeConnection(const muduo::net::TcpConnectionPtr &conn){
+    if(LoopState *state = loopState(conn->getLoop())){
+        state->connections.erase(conn);
+    }
+    // 正在连接自己的Channel回调中，推迟到回调返回后再销毁
+    conn->getLoop()->queueInLoop(std::bind(&muduo::net::TcpConnection::connectDestroyed, conn));
+}
+
+void HttpServer::destroyConnections(muduo::net::EventLoop *loop){
+    LoopState *state = loopState(loop);
+    if(!state){
+        return;
+    }
+    // connectDestroyed()会回调onConnection，先把集合换出来
+    std::unordered_set<muduo::net::TcpConnectionPtr> connections;
+    connections.swap(state->connections);
+    for(const muduo::net::TcpConnectionPtr &conn : connections){
+        conn->connectDestroyed();
+    }
+    // 定时器要在loop还在时、在它自己的线程中取消
+    state->timingWheel.reset();
+    state->loadShedder.reset();
+}
+
+void HttpServer::onConnection(const muduo::net::TcpConnectionPtr &conn, int sockfd){
     if(conn->connected()){
+        // 超出连接数上限的连接直接关闭，不设置 HttpContext，断开时也就不会归还名额
+        if(connectionLimiter_ && !connectionLimiter_->tryAcquire(conn->peerAddress().toIp())){
+            LOG_WARN << "Too many connections, reject " << conn->peerAddress().toIpPort();
+            conn->forceClose();
+            return;
+        }
+        // 每个连接都设置一个 HttpContext 作为解析状态机
+        // 解析收到的数据流，并构建出HTTP请求
+        conn->setContext(HttpContext());
+        HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
+        context->setMaxBodySize(maxBodySize_);
+        activeConnections_.fetch_add(1, std::memory_order_relaxed);
+        // HTTPS连接的密文也写在TcpConnection的发送缓冲区里，两种连接用同一个高水位
+        conn->setHighWaterMarkCallback(std::bind(&HttpServer::onHighWaterMark, this,
+                                                 std::placeholders::_1, std::placeholders::_2),
+                                       highWaterMark_);
+        // 连接建立后就开始空闲计时，只连接不发数据（包括不完成TLS握手）的客户端也会被关闭
+        if(LoopState *state = loopState(conn->getLoop())){
+            if(state->timingWheel){
+                context->setTimingWheel(state->timingWheel.get());
+                updateTimeout(conn, context, HttpContext::kTimeoutIdle);
+            }
+        }
         if(useSSL_){
             // 如果开启了 SSL，就为这个连接创建一个 SslConnection 对象（专门处理 SSL 握手 & 解密）
-            auto sslConn = std::make_unique<ssl:SslConnection>(conn, sslCtx_.get());
+            auto sslConn = std::make_shared<ssl::SslConnection>(conn, sslCtx_.get(), sockfd);
             // 设置 SSL 解密完成后的数据处理回调
             sslConn->setMessageCallback(std::bind(&HttpServer::onMessage, this,
                                         std::placeholders::_1,
                                         std::placeholders::_2,
                                         std::placeholders::_3));
-            // 把连接和 sslConn 映射起来
-            sslConns_[conn] = std::move(sslConn);
+            // 挂到连接自己的 HttpContext 上，只在连接所属的IO线程中访问
+            context->setSslConnection(sslConn);
 
             // 开始SSL握手
-            sslConns_[conn]->startHandshake();
+            sslConn->startHandshake();
         }
-        // 每个连接都设置一个 HttpContext 作为解析状态机
-        // 解析收到的数据流，并构建出HTTP请求
-        conn->setContext(HttpContext());
     }else{
-        if(useSSL_){
-            // 如果之前有开启 SSL，则从 sslConns_ 映射表中移除这个连接的 SslConnection 对象，释放资源。
-            sslConns_.erase(conn);
+        // 释放 SslConnection，打破它与 TcpConnection 之间的循环引用
+        HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
+        if(context){
+            context->setHttp2Connection(nullptr);
+            context->setSslConnection(nullptr);
+            if(connectionLimiter_){
+                connectionLimiter_->release(conn->peerAddress().toIp());
+            }
+            activeConnections_.fetch_sub(1, std::memory_order_relaxed);
         }
     }
 }
@@ -83,45 +561,83 @@ void HttpServer::onMessage(const muduo::net::TcpConnectionPtr &conn,
                            muduo::net::Buffer *buf,
                            muduo::Timestamp receiveTime)
 {
+    // 开启SSL时，SslConnection接管了连接的消息回调，解密后再以明文buf调用这里
     try{
-        // 是否支持SSL
-        if(useSSL_){
-            LOG_INFO << "onMessage useSSL_ is true";
-            // 1.查找对应的SSL链接
-            auto it = sslConns_.find(conn);
-            if(it != sslConns_.end()){
-                LOG_INFO << "onMessage sslConns_ is not empty";
-                // 2.SSL的onRead方法处理数据
-                it->second->onRead(conn, buf, receiveTime);
-
-                // 3.如果SSL握手未完成，直接返回
-                if(!it->second->isHandshakeCompleted()){
-                    LOG_INFO << "onMessage ssl handshake is not completed";
-                    return;
-                }
-
-                // 4. 从SSL链接的解密缓冲区中获取数据
-                muduo::net::Buffer *decryptedBuf = it->second->getDecryptedBuffer();
-                if(decryptedBuf->readableBytes() == 0) return;
-
-                // 5. 使用解密后的数据进行HTTP处理
-                buf = decryptedBuf;
-                LOG_INFO << "onMessage decryptedBuf is not empty";
-            }
-        }
         // HttpContext对象用于解析buf中的报文请求，并把关键信息封装进HttpRequest对象中
         HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
-        //解析请求内容
-        if(!context->parseRequest(buf, receiveTime)){
-            // 如果出错了
-            conn->send("HTTP/1.1 400 Bad Request\r\n\r\n");
-            conn->shutdown();
+        if(!context){
+            // 超出连接数上限被拒绝的连接没有HttpContext，forceClose()排队期间到达的数据直接丢弃
+            buf->retrieveAll();
+            return;
+        }
+        if(context->writePaused() || context->requestDeferred()){
+            // 停止读取之前、或者推迟处理期间收到的数据留在buf中，恢复时再处理
+            return;
         }
-        // buf中解析出完整数据包了，封装响应报文
-        if(context->gotAll()){
+        if(!context->http2Connection() && !maybeStartHttp2(conn, context, buf)){
+            // 收到的是不完整的h2c连接前言，等待更多数据
+            return;
+        }
+        if(http2::Http2Connection *http2Conn = context->http2Connection()){
+            // HTTP/2连接上的请求互相交错，只按空闲时间计时，收到任何数据都推迟
+            if(context->timeoutPhase() == HttpContext::kTimeoutIdle && idleTimeout_ > 0){
+                context->timingWheel()->refresh(context->timeoutEntry(), idleTimeout_);
+            }
+            else{
+                updateTimeout(conn, context, HttpContext::kTimeoutIdle);
+            }
+            if(!http2Conn->onData(buf, receiveTime)){
+                // 连接错误，GOAWAY已经发出
+                conn->shutdown();
+            }
+            return;
+        }
+        // 一次读到的数据中可能有多个流水线请求，逐个解析处理，直到剩下的数据不够一个完整请求
+        // 推迟处理后恢复时，context中是已经解析完的请求
+        while(context->gotAll() || buf->readableBytes() > 0){
+            if(!context->gotAll()){
+                //解析请求内容
+                if(!context->parseRequest(buf, receiveTime)){
+                    // 如果出错了；请求体超过上限时不读它，直接关闭连接
+                    conn->send(context->bodyTooLarge() ? "HTTP/1.1 413 Payload Too Large\r\nConnection: close\r\n\r\n"
+                                                       : "HTTP/1.1 400 Bad Request\r\n\r\n");
+                    conn->shutdown();
+                    return;
+                }
+                if(!context->gotAll()){
+                    break;
+                }
+                // 会话在远程存储中：先发出读取，结果到达后再处理，期间不解析后续数据
+                if(sessionManager_ && sessionManager_->prefetchSession(context->request(),
+                                                                       std::bind(&HttpServer::onDeferredRequest, this, conn))){
+                    context->setRequestDeferred(true);
+                    return;
+                }
+            }
+            // buf中解析出完整数据包了，封装响应报文
             onRequest(conn, context->request());
             // 重置状态机，准备下一个请求
             context->reset();
+            // 响应积压过多，剩下的流水线请求等发送缓冲区排空后再处理；
+            // 高水位回调是排队执行的，这里直接检查，同一批数据中的请求也不会继续生成响应
+            if(conn->outputBuffer()->readableBytes() >= highWaterMark_){
+                pauseReading(conn, context);
+            }
+            if(context->writePaused()){
+                // 等待的是客户端读取响应，按空闲计时，一直不读的客户端最终会被关闭
+                updateTimeout(conn, context, HttpContext::kTimeoutIdle);
+                return;
+            }
+        }
+        // 按剩下的数据决定接下来等待什么：请求体、请求头（已收到下一个请求的一部分），或者空闲
+        if(context->expectBody()){
+            updateTimeout(conn, context, HttpContext::kTimeoutBody);
+        }
+        else if(!context->expectRequestLine() || buf->readableBytes() > 0){
+            updateTimeout(conn, context, HttpContext::kTimeoutHeaders);
+        }
+        else{
+            updateTimeout(conn, context, HttpContext::kTimeoutIdle);
         }
     }
     // 捕获异常
@@ -132,20 +648,174 @@ void HttpServer::onMessage(const muduo::net::TcpConnectionPtr &conn,
     }
 }
 
+void HttpServer::onHighWaterMark(const muduo::net::TcpConnectionPtr &conn, size_t){
+    HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
+    if(context){
+        pauseReading(conn, context);
+    }
+}
+
+void HttpServer::pauseReading(const muduo::net::TcpConnectionPtr &conn, HttpContext *context){
+    if(context->writePaused()){
+        return;
+    }
+    context->setWritePaused(true);
+    conn->stopRead();
+    if(http2::Http2Connection *http2Conn = context->http2Connection()){
+        http2Conn->setWritePaused(true);
+    }
+}
+
+void HttpServer::onWriteComplete(const muduo::net::TcpConnectionPtr &conn){
+    HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
+    if(!context || !context->writePaused()){
+        return;
+    }
+    context->setWritePaused(false);
+    conn->startRead();
+    // 客户端读完了积压的响应，算作活动：空闲计时从现在重新开始，持续读取的慢客户端不会被误判为空闲
+    if(context->timeoutPhase() == HttpContext::kTimeoutIdle && idleTimeout_ > 0){
+        context->timingWheel()->refresh(context->timeoutEntry(), idleTimeout_);
+    }
+    if(http2::Http2Connection *http2Conn = context->http2Connection()){
+        // 继续发送挂起的响应体，可能再次超过高水位
+        http2Conn->setWritePaused(false);
+    }
+    // 暂停期间留下的请求不会再有新数据触发，这里主动处理；
+    // HTTPS连接解密后的明文在SslConnection中，明文连接的在输入缓冲区中
+    muduo::net::Buffer *buf = context->sslConnection() ? context->sslConnection()->getDecryptedBuffer()
+                                                       : conn->inputBuffer();
+    if(!context->writePaused() && buf->readableBytes() > 0){
+        onMessage(conn, buf, muduo::Timestamp::now());
+    }
+}
+
+void HttpServer::onDeferredRequest(const muduo::net::TcpConnectionPtr &conn){
+    HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
+    if(!conn->connected() || !context || !context->requestDeferred()){
+        return;
+    }
+    context->setRequestDeferred(false);
+    // 处理推迟的请求，以及之后留在缓冲区中的流水线请求
+    muduo::net::Buffer *buf = context->sslConnection() ? context->sslConnection()->getDecryptedBuffer()
+                                                       : conn->inputBuffer();
+    onMessage(conn, buf, muduo::Timestamp::now());
+}
+
+void HttpServer::onThreadInit(muduo::net::EventLoop *loop){
+    auto state = std::make_unique<LoopState>();
+    state->loop = loop;
+    int maxTimeout = std::max({idleTimeout_, headerTimeout_, bodyTimeout_});
+    if(maxTimeout > 0){
+        state->timingWheel = std::make_unique<TimingWheel>(loop, maxTimeout);
+    }
+    if(admissionConfig_.loadShedding){
+        state->loadShedder = std::make_unique<LoadShedder>(loop, admissionConfig_.targetQueueDelay,
+                                                           admissionConfig_.interval);
+    }
+    // 在loop开始处理连接之前设置，之后只有这个线程访问
+    loop->setContext(state.get());
+    std::lock_guard<std::mutex> lock(loopStatesMutex_);
+    loopStates_.push_back(std::move(state));
+}
+
+HttpServer::LoopState *HttpServer::loopState(muduo::net::EventLoop *loop) const{
+    if(!loop){
+        return nullptr;
+    }
+    LoopState *const *state = boost::any_cast<LoopState *>(&loop->getContext());
+    return state ? *state : nullptr;
+}
+
+void HttpServer::updateTimeout(const muduo::net::TcpConnectionPtr &conn, HttpContext *context,
+                               HttpContext::TimeoutPhase phase){
+    TimingWheel *wheel = context->timingWheel();
+    if(!wheel || context->timeoutPhase() == phase){
+        return;
+    }
+    int timeout = phase == HttpContext::kTimeoutIdle ? idleTimeout_
+                : phase == HttpContext::kTimeoutHeaders ? headerTimeout_
+                : bodyTimeout_;
+    // 连接一直用同一个条目，只是重新计时；条目在上次到期或取消后已经释放时才新建
+    TimingWheel::WeakEntryPtr entry = context->timeoutEntry();
+    if(timeout <= 0){
+        TimingWheel::cancel(entry);
+    }
+    else if(!wheel->rearm(entry, timeout)){
+        entry = wheel->add(conn, timeout);
+    }
+    context->setTimeout(phase, entry);
+}
+
+bool HttpServer::maybeStartHttp2(const muduo::net::TcpConnectionPtr &conn, HttpContext *context,
+                                 muduo::net::Buffer *buf){
+    ssl::SslConnection *sslConn = context->sslConnection();
+    if(sslConn){
+        // HTTPS连接由握手时的ALPN结果决定
+        if(sslConn->alpnProtocol() != "h2"){
+            return true;
+        }
+    }
+    else{
+        // 明文连接只在两个请求之间检查连接前言；前言的前几个字节就和所有HTTP/1.x方法不同
+        if(!http2Enabled_ || !context->expectRequestLine()){
+            return true;
+        }
+        size_t n = std::min(buf->readableBytes(), http2::Http2Connection::kClientPrefaceLength);
+        if(n == 0 || memcmp(buf->peek(), http2::Http2Connection::kClientPreface, n) != 0){
+            return true;
+        }
+        if(n < http2::Http2Connection::kClientPrefaceLength){
+            return false;
+        }
+    }
+
+    http2::Http2Connection::WriteCallback writeCb;
+    if(sslConn){
+        writeCb = [sslConn](muduo::net::Buffer *output){
+            sslConn->send(output->peek(), output->readableBytes());
+            output->retrieveAll();
+        };
+    }
+    else{
+        // Http2Connection挂在连接的context上，生命周期不会超过连接本身
+        muduo::net::TcpConnection *tcpConn = conn.get();
+        writeCb = [tcpConn](muduo::net::Buffer *output){
+            tcpConn->send(output);
+        };
+    }
+    muduo::net::EventLoop *loop = conn->getLoop();
+    auto requestCb = [this, loop](const HttpRequest &req, HttpResponse *resp){
+        serve(loop, req, resp);
+    };
+    context->setHttp2Connection(std::make_shared<http2::Http2Connection>(writeCb, requestCb, maxBodySize_));
+    return true;
+}
+
 void HttpServer::onRequest(const muduo::net::TcpConnectionPTr &conn, const HttpRequest &req){
     // 检查Connection头部字段是否为close，决定当前响应之后是否关闭TCP链接
     const std::string &connection = req.getHeader("Connection");
-    bool close = ((connection == "close") || (req.getVersion() == "HTTP/1.0" && connection != "Keep-Alive"));
+    // 排空期间每个响应之后都关闭连接
+    bool close = ((connection == "close") || (req.getVersion() == "HTTP/1.0" && connection != "Keep-Alive"))
+              || draining_.load(std::memory_order_relaxed);
     HttpResponse response(close);
 
-    // 调用请求处理回调， 实际就是执行handleRequest
-    httpCallback_(req, &response);
+    // 准入检查通过后调用请求处理回调， 实际就是执行handleRequest
+    serve(conn->getLoop(), req, &response);
 
     // 准备数据，发送响应
     muduo::net::Buffer buf;
     response.appendToBuffer(&buf);
-    LOG_INFO << "Sending response:\n" << buf.toStringPiece().as_string();
-    conn->send(&buf);
+    if(useSSL_){
+        // HTTPS连接的响应要经过SslConnection加密后再发出
+        HttpContext *context = boost::any_cast<HttpContext>(conn->getMutableContext());
+        if(context && context->sslConnection()){
+            context->sslConnection()->send(buf.peek(), buf.readableBytes());
+        }
+    }
+    else{
+        conn->send(&buf);
+    }
 
     // 如果是短连接，则返回响应报文后就断开连接
     if(response.closeConnection()){
@@ -153,6 +823,50 @@ void HttpServer::onRequest(const muduo::net::TcpConnectionPTr &conn, const HttpR
     }
 }
 
+void HttpServer::serve(muduo::net::EventLoop *loop, const HttpRequest &req, HttpResponse *resp){
+    admitAndHandle(loop, req, resp);
+    if(accessLog_){
+        accessLog_->log(req, *resp);
+    }
+}
+
+void HttpServer::admitAndHandle(muduo::net::EventLoop *loop, const HttpRequest &req, HttpResponse *resp){
+    if(admissionConfig_.loadShedding){
+        // 排队时间从读到请求数据算起，包括在同一批数据中排在前面的请求的处理时间
+        LoopState *state = loopState(loop);
+        if(state && state->loadShedder
+           && state->loadShedder->shouldShed(timeDifference(muduo::Timestamp::now(), req.receiveTime()))){
+            rejectRequest(resp);
+            return;
+        }
+    }
+    if(admissionConfig_.maxInflightRequests == 0){
+        httpCallback_(req, resp);
+        return;
+    }
+    // 先加再检查，超出时退回
+    if(inflightRequests_.fetch_add(1, std::memory_order_relaxed) >= admissionConfig_.maxInflightRequests){
+        inflightRequests_.fetch_sub(1, std::memory_order_relaxed);
+        rejectRequest(resp);
+        return;
+    }
+    try{
+        httpCallback_(req, resp);
+    }
+    catch(...){
+        inflightRequests_.fetch_sub(1, std::memory_order_relaxed);
+        throw;
+    }
+    inflightRequests_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void HttpServer::rejectRequest(HttpResponse *resp){
+    resp->setStatusCode(HttpResponse::k503ServiceUnavailable);
+    resp->setStatusMessage("Service Unavailable");
+    resp->addHeader("Retry-After", std::to_string(admissionConfig_.retryAfter));
+    resp->setContentLength(0);
+}
+
 void HttpServer::handleRequest(const HttpRequest &req, HttpResponse *resp){
     try{
         // 处理请求前的中间件
@@ -160,8 +874,7 @@ void HttpServer::handleRequest(const HttpRequest &req, HttpResponse *resp){
         middlewareChain_.processBefore(mutableReq);
         // 路由处理
         if(!router_.route(mutableReq, resp)){
-            LOG_INFO << "Request URL: " << req.method << " " << "" << req.path();
-            LOG_INFO << "Not found route, return 404";
+            LOG_DEBUG << "Not found route for " << req.path() << ", return 404";
             resp->setStatusCode(HttpResponse::k404NotFound);
             resp->setStatuesMessage("Not Found");
             resp->setCloseConnection(true); 
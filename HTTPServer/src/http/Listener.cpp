@@ -0,0 +1,145 @@
+#include "../../include/http/Listener.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <muduo/base/Logging.h>
+
+namespace http{
+
+int Listener::createSocket(const muduo::net::InetAddress &listenAddr, bool reusePort){
+    const struct sockaddr *addr = listenAddr.getSockAddr();
+    int fd = ::socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if(fd < 0){
+        LOG_SYSERR << "Failed to create listening socket";
+        return -1;
+    }
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(reusePort && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0){
+        LOG_SYSERR << "SO_REUSEPORT failed";
+    }
+    socklen_t len = addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    if(::bind(fd, addr, len) != 0){
+        LOG_SYSERR << "Failed to bind " << listenAddr.toIpPort();
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Listener::isListeningOn(int fd, uint16_t port){
+    int type = 0, accepting = 0;
+    socklen_t len = sizeof(int);
+    if(::getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) != 0 || type != SOCK_STREAM){
+        return false;
+    }
+    len = sizeof(int);
+    if(::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) != 0 || !accepting){
+        return false;
+    }
+    struct sockaddr_storage local;
+    socklen_t localLen = sizeof(local);
+    if(::getsockname(fd, reinterpret_cast<struct sockaddr *>(&local), &localLen) != 0){
+        return false;
+    }
+    if(local.ss_family == AF_INET){
+        return ntohs(reinterpret_cast<struct sockaddr_in *>(&local)->sin_port) == port;
+    }
+    if(local.ss_family == AF_INET6){
+        return ntohs(reinterpret_cast<struct sockaddr_in6 *>(&local)->sin6_port) == port;
+    }
+    return false;
+}
+
+Listener::Listener(muduo::net::EventLoop *loop, int fd)
+    : loop_(loop)
+    , fd_(fd)
+    , channel_(new muduo::net::Channel(loop, fd))
+    , idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC))
+{
+    // 前任可能是io_uring后端，它的监听socket是阻塞的
+    ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) | O_NONBLOCK);
+    channel_->setReadCallback(std::bind(&Listener::handleRead, this));
+}
+
+Listener::~Listener(){
+    if(channel_){
+        channel_->disableAll();
+        channel_->remove();
+    }
+    if(fd_ >= 0){
+        ::close(fd_);
+    }
+    if(idleFd_ >= 0){
+        ::close(idleFd_);
+    }
+}
+
+bool Listener::listen(){
+    if(::listen(fd_, SOMAXCONN) != 0){
+        LOG_SYSERR << "Failed to listen on socket " << fd_;
+        return false;
+    }
+    channel_->enableReading();
+    return true;
+}
+
+void Listener::stop(bool acceptQueued){
+    if(fd_ < 0){
+        return;
+    }
+    channel_->disableAll();
+    channel_->remove();
+    channel_.reset();
+    if(acceptQueued){
+        // 关闭之后内核会重置队列中的连接，而客户端已经认为连接建立，可能已经发出了请求
+        while(acceptOne()){
+        }
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void Listener::handleRead(){
+    acceptOne();
+}
+
+bool Listener::acceptOne(){
+    struct sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    int sockfd = ::accept4(fd_, reinterpret_cast<struct sockaddr *>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(sockfd >= 0){
+        muduo::net::InetAddress peerAddr;
+        peerAddr.setSockAddrInet6(addr);
+        if(newConnectionCallback_){
+            newConnectionCallback_(sockfd, peerAddr);
+        }
+        else{
+            ::close(sockfd);
+        }
+        return true;
+    }
+    if(errno == EMFILE && idleFd_ >= 0){
+        LOG_SYSERR << "Listener accept";
+        ::close(idleFd_);
+        idleFd_ = ::accept(fd_, nullptr, nullptr);
+        if(idleFd_ >= 0){
+            ::close(idleFd_);
+        }
+        idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        return true;
+    }
+    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED){
+        LOG_SYSERR << "Listener accept";
+    }
+    return errno == EINTR || errno == ECONNABORTED;
+}
+
+}
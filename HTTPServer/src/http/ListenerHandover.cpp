@@ -0,0 +1,221 @@
+#include "../../include/http/ListenerHandover.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <muduo/base/Logging.h>
+
+namespace http{
+
+namespace{
+
+// 一条消息最多能带的描述符数（内核的SCM_MAX_FD）
+const size_t kMaxFds = 253;
+
+bool fillUnixAddress(const std::string &path, struct sockaddr_un *addr){
+    if(path.size() >= sizeof(addr->sun_path)){
+        LOG_ERROR << "Handover path too long: " << path;
+        return false;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path.c_str(), path.size());
+    return true;
+}
+
+}
+
+ListenerHandover::ListenerHandover(muduo::net::EventLoop *loop, const std::string &path)
+    : loop_(loop)
+    , path_(path)
+    , listenFd_(-1)
+    , successorFd_(-1)
+{
+}
+
+ListenerHandover::~ListenerHandover(){
+    closeSuccessor();
+    if(listenChannel_){
+        listenChannel_->disableAll();
+        listenChannel_->remove();
+    }
+    if(listenFd_ >= 0){
+        // path不删除：交接之后它已经属于继任者
+        ::close(listenFd_);
+    }
+}
+
+bool ListenerHandover::takeOver(const std::string &path, std::vector<int> *fds, int *ackFd, double timeout){
+    struct sockaddr_un addr;
+    if(!fillUnixAddress(path, &addr)){
+        return false;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        return false;
+    }
+    if(::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0){
+        // 没有前任
+        ::close(fd);
+        return false;
+    }
+    struct timeval tv;
+    tv.tv_sec = static_cast<time_t>(timeout);
+    tv.tv_usec = static_cast<suseconds_t>((timeout - tv.tv_sec) * 1000000);
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // 正文是描述符的个数，描述符本身在控制消息里
+    uint32_t count = 0;
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(count);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFds));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+
+    fds->clear();
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const char *p = reinterpret_cast<const char *>(CMSG_DATA(cmsg));
+            for(size_t i = 0; i < received; ++i){
+                int receivedFd;
+                memcpy(&receivedFd, p + i * sizeof(int), sizeof(int));
+                fds->push_back(receivedFd);
+            }
+        }
+    }
+    if(n != static_cast<ssize_t>(sizeof(count)) || (msg.msg_flags & MSG_CTRUNC) || fds->size() != count){
+        LOG_WARN << "Handover from " << path << " failed, start with new listeners";
+        for(int received : *fds){
+            ::close(received);
+        }
+        fds->clear();
+        ::close(fd);
+        return false;
+    }
+    *ackFd = fd;
+    return true;
+}
+
+void ListenerHandover::confirm(int ackFd){
+    char ack = 1;
+    if(::write(ackFd, &ack, 1) != 1){
+        LOG_SYSERR << "Failed to confirm handover";
+    }
+    ::close(ackFd);
+}
+
+bool ListenerHandover::listen(const ListenersCallback &listenersCb, const HandedOverCallback &handedOverCb){
+    listenersCallback_ = listenersCb;
+    handedOverCallback_ = handedOverCb;
+    struct sockaddr_un addr;
+    if(!fillUnixAddress(path_, &addr)){
+        return false;
+    }
+    // 前任（如果有）已经交接完，它的socket文件换成我们的
+    ::unlink(path_.c_str());
+    listenFd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listenFd_ < 0 ||
+       ::bind(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+       ::listen(listenFd_, 4) != 0){
+        LOG_SYSERR << "Failed to listen for handover on " << path_;
+        return false;
+    }
+    listenChannel_.reset(new muduo::net::Channel(loop_, listenFd_));
+    listenChannel_->setReadCallback(std::bind(&ListenerHandover::onConnect, this));
+    listenChannel_->enableReading();
+    return true;
+}
+
+void ListenerHandover::onConnect(){
+    int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0){
+        return;
+    }
+    if(successorFd_ >= 0){
+        // 同时只和一个继任者交接
+        LOG_WARN << "Handover already in progress, reject another successor";
+        ::close(fd);
+        return;
+    }
+
+    std::vector<int> fds = listenersCallback_();
+    if(fds.size() > kMaxFds){
+        fds.resize(kMaxFds);
+    }
+    uint32_t count = static_cast<uint32_t>(fds.size());
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(count);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * std::max<size_t>(fds.size(), 1)));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(!fds.empty()){
+        msg.msg_control = control.data();
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+    // 新连接的发送缓冲区是空的，这一条小消息不会阻塞
+    if(::sendmsg(fd, &msg, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(count))){
+        LOG_SYSERR << "Failed to hand over listeners";
+        ::close(fd);
+        return;
+    }
+    LOG_WARN << "Sent " << fds.size() << " listeners to successor, waiting for it to start accepting";
+    successorFd_ = fd;
+    successorChannel_.reset(new muduo::net::Channel(loop_, successorFd_));
+    successorChannel_->setReadCallback(std::bind(&ListenerHandover::onAck, this));
+    successorChannel_->enableReading();
+}
+
+void ListenerHandover::onAck(){
+    char ack = 0;
+    ssize_t n = ::read(successorFd_, &ack, 1);
+    if(n < 0 && (errno == EAGAIN || errno == EINTR)){
+        return;
+    }
+    closeSuccessor();
+    if(n == 1){
+        LOG_WARN << "Successor is accepting, handover finished";
+        handedOverCallback_();
+    }
+    else{
+        // 继任者收到的只是副本，我们的监听socket不受影响
+        LOG_WARN << "Successor exited without confirming handover, keep serving";
+    }
+}
+
+void ListenerHandover::closeSuccessor(){
+    if(successorFd_ < 0){
+        return;
+    }
+    // 可能是在这个Channel自己的回调中，Channel对象推迟到回调返回后再释放
+    std::shared_ptr<muduo::net::Channel> channel(std::move(successorChannel_));
+    channel->disableAll();
+    channel->remove();
+    int fd = successorFd_;
+    successorFd_ = -1;
+    loop_->queueInLoop([channel, fd](){
+        ::close(fd);
+    });
+}
+
+}
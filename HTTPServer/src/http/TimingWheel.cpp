@@ -0,0 +1,77 @@
+#include "../../include/http/TimingWheel.h"
+
+#include <algorithm>
+
+namespace http{
+
+TimingWheel::TimingWheel(muduo::net::EventLoop *loop, int maxTimeout)
+    : loop_(loop)
+    , buckets_(std::max(maxTimeout, 1) + 1)
+    , ticks_(0)
+{
+    timerId_ = loop_->runEvery(1.0, std::bind(&TimingWheel::onTimer, this));
+}
+
+TimingWheel::~TimingWheel(){
+    loop_->cancel(timerId_);
+}
+
+TimingWheel::WeakEntryPtr TimingWheel::add(const muduo::net::TcpConnectionPtr &conn, int timeout){
+    EntryPtr entry = std::make_shared<Entry>(conn);
+    schedule(entry, deadlineAfter(timeout));
+    return entry;
+}
+
+bool TimingWheel::rearm(const WeakEntryPtr &weakEntry, int timeout){
+    EntryPtr entry = weakEntry.lock();
+    if(!entry){
+        return false;
+    }
+    schedule(entry, deadlineAfter(timeout));
+    return true;
+}
+
+void TimingWheel::refresh(const WeakEntryPtr &weakEntry, int timeout){
+    EntryPtr entry = weakEntry.lock();
+    if(entry && entry->deadline_ != 0){
+        schedule(entry, std::max(entry->deadline_, deadlineAfter(timeout)));
+    }
+}
+
+void TimingWheel::cancel(const WeakEntryPtr &weakEntry){
+    EntryPtr entry = weakEntry.lock();
+    if(entry){
+        entry->deadline_ = 0;
+    }
+}
+
+void TimingWheel::onTimer(){
+    ++ticks_;
+    // 关闭连接的过程中可能回调到add()/rearm()，先把桶换出来
+    std::unordered_set<EntryPtr> expired;
+    expired.swap(buckets_[ticks_ % buckets_.size()]);
+    for(const EntryPtr &entry : expired){
+        // 到期时刻不是现在的，是重新计时之前留下的，它在另一个桶里还有一份（或者已经取消）
+        if(entry->deadline_ != ticks_){
+            continue;
+        }
+        entry->deadline_ = 0;
+        muduo::net::TcpConnectionPtr conn = entry->weakConn_.lock();
+        if(conn){
+            // 超时的客户端多半不会配合关闭，直接关掉连接释放fd，不等对方读完
+            conn->forceClose();
+        }
+    }
+}
+
+void TimingWheel::schedule(const EntryPtr &entry, uint64_t deadline){
+    entry->deadline_ = deadline;
+    buckets_[deadline % buckets_.size()].insert(entry);
+}
+
+uint64_t TimingWheel::deadlineAfter(int timeout) const{
+    uint64_t ticks = std::min(static_cast<uint64_t>(std::max(timeout, 1)), static_cast<uint64_t>(buckets_.size() - 1));
+    return ticks_ + ticks;
+}
+
+}
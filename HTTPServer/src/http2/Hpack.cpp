@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+
+#include "../../include/http2/Hpack.h"
+
+namespace http{
+namespace http2{
+
+namespace{
+
+struct StaticEntry{
+    const char *name;
+    const char *value;
+};
+
+// RFC 7541 附录A，索引从1开始
+const StaticEntry kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+const size_t kStaticTableSize = sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+const size_t kDefaultTableSize = 4096;
+
+// RFC 7541 附录B的Huffman码表，下标256为EOS
+const uint32_t kHuffmanCodes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+
+const uint8_t kHuffmanCodeLengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+
+// 由码表构造的二叉解码树，每个内部节点有两个子节点，叶子上是符号
+struct HuffmanTree{
+    struct Node{
+        int16_t children[2];
+        int16_t symbol;     // -1表示内部节点
+    };
+    std::vector<Node> nodes;
+
+    HuffmanTree(){
+        nodes.reserve(512);
+        nodes.push_back(Node{{-1, -1}, -1});
+        for(int sym = 0; sym < 257; ++sym){
+            uint32_t code = kHuffmanCodes[sym];
+            int len = kHuffmanCodeLengths[sym];
+            int16_t cur = 0;
+            for(int i = len - 1; i >= 0; --i){
+                int bit = (code >> i) & 1;
+                if(nodes[cur].children[bit] < 0){
+                    nodes[cur].children[bit] = static_cast<int16_t>(nodes.size());
+                    nodes.push_back(Node{{-1, -1}, -1});
+                }
+                cur = nodes[cur].children[bit];
+            }
+            nodes[cur].symbol = static_cast<int16_t>(sym);
+        }
+    }
+};
+
+const HuffmanTree &huffmanTree(){
+    static const HuffmanTree tree;
+    return tree;
+}
+
+bool huffmanDecode(const unsigned char *p, size_t len, std::string *out){
+    const HuffmanTree &tree = huffmanTree();
+    int16_t cur = 0;
+    int bitsSinceSymbol = 0;    // 最后一个完整符号之后读过的位数
+    bool allOnes = true;        // 这些位是否全为1（EOS的前缀）
+    for(size_t i = 0; i < len; ++i){
+        for(int b = 7; b >= 0; --b){
+            int bit = (p[i] >> b) & 1;
+            cur = tree.nodes[cur].children[bit];
+            if(cur < 0){
+                return false;
+            }
+            ++bitsSinceSymbol;
+            allOnes = allOnes && bit;
+            int16_t sym = tree.nodes[cur].symbol;
+            if(sym >= 0){
+                if(sym == 256){
+                    // 头部中不允许出现EOS
+                    return false;
+                }
+                out->push_back(static_cast<char>(sym));
+                cur = 0;
+                bitsSinceSymbol = 0;
+                allOnes = true;
+            }
+        }
+    }
+    // 结尾的填充必须是不超过7位的EOS前缀
+    return bitsSinceSymbol < 8 && allOnes;
+}
+
+size_t huffmanLength(const std::string &s){
+    size_t bits = 0;
+    for(unsigned char c : s){
+        bits += kHuffmanCodeLengths[c];
+    }
+    return (bits + 7) / 8;
+}
+
+void huffmanEncode(const std::string &s, std::string *out){
+    uint64_t acc = 0;
+    int bits = 0;
+    for(unsigned char c : s){
+        acc = (acc << kHuffmanCodeLengths[c]) | kHuffmanCodes[c];
+        bits += kHuffmanCodeLengths[c];
+        while(bits >= 8){
+            bits -= 8;
+            out->push_back(static_cast<char>(acc >> bits));
+        }
+    }
+    if(bits > 0){
+        // 用EOS的高位（全1）填满最后一个字节
+        out->push_back(static_cast<char>((acc << (8 - bits)) | (0xff >> bits)));
+    }
+}
+
+// 带N位前缀的整数（RFC 7541 5.1），flags为第一个字节中前缀之外的高位
+void encodeInteger(uint64_t value, int prefixBits, unsigned char flags, std::string *out){
+    uint64_t maxPrefix = (1u << prefixBits) - 1;
+    if(value < maxPrefix){
+        out->push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out->push_back(static_cast<char>(flags | maxPrefix));
+    value -= maxPrefix;
+    while(value >= 0x80){
+        out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+bool decodeInteger(const unsigned char *&p, const unsigned char *end, int prefixBits, uint64_t *value){
+    if(p >= end){
+        return false;
+    }
+    uint64_t maxPrefix = (1u << prefixBits) - 1;
+    *value = *p++ & maxPrefix;
+    if(*value < maxPrefix){
+        return true;
+    }
+    for(int shift = 0; p < end; shift += 7){
+        if(shift > 56){
+            return false;
+        }
+        unsigned char c = *p++;
+        *value += static_cast<uint64_t>(c & 0x7f) << shift;
+        if(!(c & 0x80)){
+            return true;
+        }
+    }
+    return false;
+}
+
+void encodeString(const std::string &s, std::string *out){
+    size_t huffLen = huffmanLength(s);
+    if(huffLen < s.size()){
+        encodeInteger(huffLen, 7, 0x80, out);
+        huffmanEncode(s, out);
+    }
+    else{
+        encodeInteger(s.size(), 7, 0, out);
+        out->append(s);
+    }
+}
+
+bool decodeString(const unsigned char *&p, const unsigned char *end, std::string *out){
+    if(p >= end){
+        return false;
+    }
+    bool huffman = *p & 0x80;
+    uint64_t len;
+    if(!decodeInteger(p, end, 7, &len) || len > static_cast<uint64_t>(end - p)){
+        return false;
+    }
+    out->clear();
+    if(huffman){
+        if(!huffmanDecode(p, len, out)){
+            return false;
+        }
+    }
+    else{
+        out->assign(reinterpret_cast<const char *>(p), len);
+    }
+    p += len;
+    return true;
+}
+
+// 静态表中每个头部名第一次出现的索引；同名的条目在表中是连续的
+const std::unordered_map<std::string, size_t> &staticNameIndex(){
+    static const std::unordered_map<std::string, size_t> index = [](){
+        std::unordered_map<std::string, size_t> m;
+        for(size_t i = 0; i < kStaticTableSize; ++i){
+            m.emplace(kStaticTable[i].name, i + 1);
+        }
+        return m;
+    }();
+    return index;
+}
+
+// 每个响应都不同、放进动态表只会挤掉有用条目的头部
+bool isVolatileHeader(const std::string &name){
+    return name == "content-length" || name == "date" || name == "etag" || name == "last-modified";
+}
+
+// 不允许任何中间节点压缩进动态表的敏感头部（RFC 7541 7.1.3）
+bool isSensitiveHeader(const std::string &name){
+    return name == "set-cookie" || name == "authorization" || name == "cookie";
+}
+
+}
+
+HpackDynamicTable::HpackDynamicTable(size_t maxSize)
+    : size_(0)
+    , maxSize_(maxSize)
+{
+}
+
+void HpackDynamicTable::add(const std::string &name, const std::string &value){
+    size_t entry = entrySize(name, value);
+    if(entry > maxSize_){
+        // 比整张表还大的条目会清空表，自己也不加入（RFC 7541 4.4）
+        evictTo(0);
+        return;
+    }
+    evictTo(maxSize_ - entry);
+    entries_.push_front(HeaderField{name, value});
+    size_ += entry;
+}
+
+void HpackDynamicTable::setMaxSize(size_t maxSize){
+    maxSize_ = maxSize;
+    evictTo(maxSize);
+}
+
+void HpackDynamicTable::evictTo(size_t maxSize){
+    while(size_ > maxSize){
+        const HeaderField &oldest = entries_.back();
+        size_ -= entrySize(oldest.name, oldest.value);
+        entries_.pop_back();
+    }
+}
+
+HpackDecoder::HpackDecoder(size_t maxTableSize, size_t maxHeaderListSize)
+    : table_(maxTableSize)
+    , maxTableSize_(maxTableSize)
+    , maxHeaderListSize_(maxHeaderListSize)
+{
+}
+
+bool HpackDecoder::lookup(uint64_t index, std::string *name, std::string *value) const{
+    if(index == 0){
+        return false;
+    }
+    if(index <= kStaticTableSize){
+        name->assign(kStaticTable[index - 1].name);
+        if(value){
+            value->assign(kStaticTable[index - 1].value);
+        }
+        return true;
+    }
+    index -= kStaticTableSize + 1;
+    if(index >= table_.count()){
+        return false;
+    }
+    *name = table_.at(index).name;
+    if(value){
+        *value = table_.at(index).value;
+    }
+    return true;
+}
+
+bool HpackDecoder::decode(const char *data, size_t len, HeaderList *headers){
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    const unsigned char *end = p + len;
+    size_t listSize = 0;
+    std::string name, value;
+    while(p < end){
+        unsigned char first = *p;
+        uint64_t index;
+        if(first & 0x80){
+            // 1xxxxxxx：索引头部
+            if(!decodeInteger(p, end, 7, &index) || !lookup(index, &name, &value)){
+                return false;
+            }
+        }
+        else if((first & 0xe0) == 0x20){
+            // 001xxxxx：动态表大小更新
+            if(!decodeInteger(p, end, 5, &index) || index > maxTableSize_){
+                return false;
+            }
+            table_.setMaxSize(index);
+            continue;
+        }
+        else{
+            // 01xxxxxx：增量索引；0001xxxx：永不索引；0000xxxx：不索引
+            bool incremental = (first & 0xc0) == 0x40;
+            if(!decodeInteger(p, end, incremental ? 6 : 4, &index)){
+                return false;
+            }
+            if(index == 0){
+                if(!decodeString(p, end, &name)){
+                    return false;
+                }
+            }
+            else if(!lookup(index, &name, nullptr)){
+                return false;
+            }
+            if(!decodeString(p, end, &value)){
+                return false;
+            }
+            if(incremental){
+                table_.add(name, value);
+            }
+        }
+        listSize += HpackDynamicTable::entrySize(name, value);
+        if(listSize > maxHeaderListSize_){
+            return false;
+        }
+        headers->push_back(HeaderField{name, value});
+    }
+    return true;
+}
+
+HpackEncoder::HpackEncoder()
+    : table_(kDefaultTableSize)
+    , minTableSize_(kDefaultTableSize)
+    , tableSizeChanged_(false)
+{
+}
+
+void HpackEncoder::setMaxTableSize(size_t maxSize){
+    // 对端允许更大的表也只用默认大小，限制每条连接上编码端的内存
+    size_t size = std::min(maxSize, kDefaultTableSize);
+    // 两次编码之间对端可能先调小再调大，更新时要先告知其中的最小值（RFC 7541 4.2）
+    minTableSize_ = std::min(minTableSize_, size);
+    if(size != table_.maxSize()){
+        table_.setMaxSize(size);
+        tableSizeChanged_ = true;
+    }
+}
+
+void HpackEncoder::encode(const HeaderList &headers, std::string *out){
+    if(tableSizeChanged_){
+        if(minTableSize_ < table_.maxSize()){
+            encodeInteger(minTableSize_, 5, 0x20, out);
+        }
+        encodeInteger(table_.maxSize(), 5, 0x20, out);
+        tableSizeChanged_ = false;
+    }
+    minTableSize_ = table_.maxSize();
+    for(const HeaderField &field : headers){
+        encodeField(field, out);
+    }
+}
+
+void HpackEncoder::encodeField(const HeaderField &field, std::string *out){
+    size_t nameIndex = 0;
+    auto it = staticNameIndex().find(field.name);
+    if(it != staticNameIndex().end()){
+        nameIndex = it->second;
+        for(size_t i = it->second; i <= kStaticTableSize && field.name == kStaticTable[i - 1].name; ++i){
+            if(field.value == kStaticTable[i - 1].value){
+                encodeInteger(i, 7, 0x80, out);
+                return;
+            }
+        }
+    }
+
+    bool sensitive = isSensitiveHeader(field.name);
+    if(!sensitive){
+        for(size_t i = 0; i < table_.count(); ++i){
+            const HeaderField &entry = table_.at(i);
+            if(entry.name == field.name){
+                if(entry.value == field.value){
+                    encodeInteger(kStaticTableSize + 1 + i, 7, 0x80, out);
+                    return;
+                }
+                if(nameIndex == 0){
+                    nameIndex = kStaticTableSize + 1 + i;
+                }
+            }
+        }
+    }
+
+    if(sensitive){
+        encodeInteger(nameIndex, 4, 0x10, out);
+    }
+    else if(isVolatileHeader(field.name)){
+        encodeInteger(nameIndex, 4, 0x00, out);
+    }
+    else{
+        encodeInteger(nameIndex, 6, 0x40, out);
+    }
+    if(nameIndex == 0){
+        encodeString(field.name, out);
+    }
+    encodeString(field.value, out);
+
+    if(!sensitive && !isVolatileHeader(field.name)){
+        table_.add(field.name, field.value);
+    }
+}
+
+}
+}
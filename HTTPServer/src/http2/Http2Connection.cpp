@@ -0,0 +1,772 @@
+#include <algorithm>
+#include <cstring>
+
+#include <muduo/base/Logging.h>
+
+#include "../../include/http2/Http2Connection.h"
+
+namespace http{
+namespace http2{
+
+namespace{
+
+const uint8_t kFlagEndStream = 0x1;
+const uint8_t kFlagAck = 0x1;
+const uint8_t kFlagEndHeaders = 0x4;
+const uint8_t kFlagPadded = 0x8;
+const uint8_t kFlagPriority = 0x20;
+
+const uint16_t kSettingsHeaderTableSize = 0x1;
+const uint16_t kSettingsEnablePush = 0x2;
+const uint16_t kSettingsMaxConcurrentStreams = 0x3;
+const uint16_t kSettingsInitialWindowSize = 0x4;
+const uint16_t kSettingsMaxFrameSize = 0x5;
+
+const size_t kFrameHeaderLength = 9;
+
+uint32_t readUint32(const char *p){
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return (static_cast<uint32_t>(u[0]) << 24) | (static_cast<uint32_t>(u[1]) << 16) |
+           (static_cast<uint32_t>(u[2]) << 8) | u[3];
+}
+
+void appendUint32(muduo::net::Buffer *buf, uint32_t v){
+    char b[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16),
+                 static_cast<char>(v >> 8), static_cast<char>(v)};
+    buf->append(b, sizeof b);
+}
+
+// 去掉DATA/HEADERS帧的填充，填充长度不合法时返回false
+bool stripPadding(uint8_t flags, const char *&payload, size_t &length){
+    if(!(flags & kFlagPadded)){
+        return true;
+    }
+    if(length < 1){
+        return false;
+    }
+    size_t padLength = static_cast<unsigned char>(payload[0]);
+    ++payload;
+    --length;
+    if(padLength > length){
+        return false;
+    }
+    length -= padLength;
+    return true;
+}
+
+// HTTP/2的头部名都是小写，转成HTTP/1.x的写法（content-type -> Content-Type），
+// 中间件和业务代码按 "Origin"、"Cookie" 这样的名字取头部，两种协议的请求看起来一样
+std::string canonicalHeaderName(const std::string &name){
+    std::string result(name);
+    bool upper = true;
+    for(char &c : result){
+        if(upper && c >= 'a' && c <= 'z'){
+            c = static_cast<char>(c - 'a' + 'A');
+        }
+        upper = (c == '-');
+    }
+    return result;
+}
+
+// HTTP/2中禁止出现的逐跳头部（RFC 7540 8.1.2.2）
+bool isConnectionSpecificHeader(const std::string &name){
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+}
+
+const char Http2Connection::kClientPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+Http2Connection::Http2Connection(const WriteCallback &writeCb, const RequestCallback &requestCb, size_t maxBodySize)
+    : writeCallback_(writeCb)
+    , requestCallback_(requestCb)
+    , prefaceReceived_(false)
+    , settingsReceived_(false)
+    , closed_(false)
+    , writePaused_(false)
+    , goingAway_(false)
+    , lastStreamId_(0)
+    , goAwayStreamId_(0)
+    , continuationStreamId_(0)
+    , continuationEndStream_(false)
+    , peerMaxFrameSize_(kMaxFrameSize)
+    , peerInitialWindow_(kDefaultWindow)
+    , sendWindow_(kDefaultWindow)
+    , recvWindow_(kDefaultWindow)
+    , recvUnacked_(0)
+    , maxBodySize_(maxBodySize)
+    , bufferedBody_(0)
+{
+}
+
+bool Http2Connection::onData(muduo::net::Buffer *buf, muduo::Timestamp receiveTime){
+    if(closed_){
+        buf->retrieveAll();
+        return false;
+    }
+    receiveTime_ = receiveTime;
+
+    bool ok = true;
+    if(!prefaceReceived_){
+        size_t n = std::min(buf->readableBytes(), kClientPrefaceLength);
+        if(memcmp(buf->peek(), kClientPreface, n) != 0){
+            ok = connectionError(kProtocolError);
+        }
+        else if(n == kClientPrefaceLength){
+            buf->retrieve(kClientPrefaceLength);
+            prefaceReceived_ = true;
+            // 服务端的连接前言就是一个SETTINGS帧
+            writeSettings();
+        }
+    }
+
+    while(ok && prefaceReceived_ && buf->readableBytes() >= kFrameHeaderLength){
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(buf->peek());
+        FrameHeader header;
+        header.length = (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+        header.type = p[3];
+        header.flags = p[4];
+        header.streamId = readUint32(buf->peek() + 5) & 0x7fffffff;
+        if(header.length > kMaxFrameSize){
+            ok = connectionError(kFrameSizeError);
+            break;
+        }
+        if(buf->readableBytes() < kFrameHeaderLength + header.length){
+            break;
+        }
+        ok = processFrame(header, buf->peek() + kFrameHeaderLength);
+        buf->retrieve(kFrameHeaderLength + header.length);
+    }
+    if(!ok){
+        buf->retrieveAll();
+    }
+    flush();
+    return ok;
+}
+
+void Http2Connection::setWritePaused(bool paused){
+    writePaused_ = paused;
+    if(!paused && !closed_){
+        resumePendingStreams();
+        flush();
+    }
+}
+
+bool Http2Connection::processFrame(const FrameHeader &header, const char *payload){
+    // 头部块必须连续发送，中间不能夹杂其他帧
+    if(continuationStreamId_ != 0 &&
+       (header.type != kContinuation || header.streamId != continuationStreamId_)){
+        return connectionError(kProtocolError);
+    }
+    // 客户端前言之后的第一帧必须是SETTINGS
+    if(!settingsReceived_ && header.type != kSettings){
+        return connectionError(kProtocolError);
+    }
+
+    switch(header.type){
+    case kData:
+        return onDataFrame(header, payload);
+    case kHeaders:
+        return onHeadersFrame(header, payload);
+    case kPriority:
+        // 不做优先级调度，只检查格式
+        if(header.streamId == 0){
+            return connectionError(kProtocolError);
+        }
+        if(header.length != 5){
+            resetStream(header.streamId, kFrameSizeError);
+        }
+        return true;
+    case kRstStream:
+        return onRstStreamFrame(header, payload);
+    case kSettings:
+        return onSettingsFrame(header, payload);
+    case kPushPromise:
+        // 客户端不能推送
+        return connectionError(kProtocolError);
+    case kPing:
+        return onPingFrame(header, payload);
+    case kGoAway:
+        // 对端不会再打开新的流，已经打开的流照常完成
+        if(header.streamId != 0){
+            return connectionError(kProtocolError);
+        }
+        return true;
+    case kWindowUpdate:
+        return onWindowUpdateFrame(header, payload);
+    case kContinuation:
+        return onContinuationFrame(header, payload);
+    default:
+        // 未知类型的帧直接忽略
+        return true;
+    }
+}
+
+bool Http2Connection::onHeadersFrame(const FrameHeader &header, const char *payload){
+    if(header.streamId == 0){
+        return connectionError(kProtocolError);
+    }
+    size_t length = header.length;
+    if(!stripPadding(header.flags, payload, length)){
+        return connectionError(kProtocolError);
+    }
+    if(header.flags & kFlagPriority){
+        if(length < 5){
+            return connectionError(kFrameSizeError);
+        }
+        payload += 5;
+        length -= 5;
+    }
+    headerBlock_.assign(payload, length);
+    bool endStream = header.flags & kFlagEndStream;
+    if(header.flags & kFlagEndHeaders){
+        return onHeaderBlock(header.streamId, endStream);
+    }
+    continuationStreamId_ = header.streamId;
+    continuationEndStream_ = endStream;
+    return true;
+}
+
+bool Http2Connection::onContinuationFrame(const FrameHeader &header, const char *payload){
+    if(continuationStreamId_ == 0){
+        return connectionError(kProtocolError);
+    }
+    if(headerBlock_.size() + header.length > kMaxHeaderBlockSize){
+        return connectionError(kEnhanceYourCalm);
+    }
+    headerBlock_.append(payload, header.length);
+    if(header.flags & kFlagEndHeaders){
+        uint32_t streamId = continuationStreamId_;
+        continuationStreamId_ = 0;
+        return onHeaderBlock(streamId, continuationEndStream_);
+    }
+    return true;
+}
+
+bool Http2Connection::onHeaderBlock(uint32_t streamId, bool endStream){
+    // 不管这个流最后是否被接受都要解码，保持两端的动态表一致
+    HeaderList headers;
+    bool decoded = decoder_.decode(headerBlock_.data(), headerBlock_.size(), &headers);
+    headerBlock_.clear();
+    if(!decoded){
+        return connectionError(kCompressionError);
+    }
+
+    auto it = streams_.find(streamId);
+    if(it != streams_.end()){
+        // 已有的流上又收到头部块，只能是请求体之后的trailer，必须结束流；trailer的内容不使用
+        if(it->second.endStream || !endStream){
+            resetStream(streamId, it->second.endStream ? kStreamClosed : kProtocolError);
+            eraseStream(it);
+            return true;
+        }
+        it->second.endStream = true;
+        dispatchRequest(it);
+        return true;
+    }
+
+    // 客户端发起的流ID是奇数并且单调递增
+    if(streamId % 2 == 0){
+        return connectionError(kProtocolError);
+    }
+    if(streamId <= lastStreamId_){
+        return connectionError(kStreamClosed);
+    }
+    lastStreamId_ = streamId;
+    if((goingAway_ && streamId > goAwayStreamId_) || streams_.size() >= kMaxConcurrentStreams){
+        resetStream(streamId, kRefusedStream);
+        return true;
+    }
+
+    it = streams_.emplace(streamId, Stream()).first;
+    Stream &stream = it->second;
+    stream.headers.swap(headers);
+    stream.sendWindow = peerInitialWindow_;
+    stream.recvWindow = kStreamWindow;
+    if(endStream){
+        stream.endStream = true;
+        dispatchRequest(it);
+    }
+    return true;
+}
+
+bool Http2Connection::onDataFrame(const FrameHeader &header, const char *payload){
+    if(header.streamId == 0){
+        return connectionError(kProtocolError);
+    }
+    size_t length = header.length;
+    if(!stripPadding(header.flags, payload, length)){
+        return connectionError(kProtocolError);
+    }
+
+    // 流量控制按整个帧的长度（包括填充）计算；数据收下后立即消费，累计到窗口的一半时一次性归还
+    if(header.length > recvWindow_){
+        return connectionError(kFlowControlError);
+    }
+    recvWindow_ -= header.length;
+    recvUnacked_ += header.length;
+    if(recvUnacked_ >= static_cast<size_t>(kConnectionWindow / 2)){
+        writeWindowUpdate(0, static_cast<uint32_t>(recvUnacked_));
+        recvWindow_ += recvUnacked_;
+        recvUnacked_ = 0;
+    }
+
+    auto it = streams_.find(header.streamId);
+    if(it == streams_.end()){
+        if(header.streamId > lastStreamId_){
+            return connectionError(kProtocolError);
+        }
+        resetStream(header.streamId, kStreamClosed);
+        return true;
+    }
+    Stream &stream = it->second;
+    if(stream.endStream){
+        resetStream(header.streamId, kStreamClosed);
+        eraseStream(it);
+        return true;
+    }
+    if(header.length > stream.recvWindow){
+        resetStream(header.streamId, kFlowControlError);
+        eraseStream(it);
+        return true;
+    }
+    if(maxBodySize_ > 0){
+        // 单个流超过上限回复413；合计超过上限说明同时上传的流太多，拒绝这个流，客户端可以稍后重试
+        if(stream.body.size() + length > maxBodySize_){
+            rejectBody(it);
+            return true;
+        }
+        if(bufferedBody_ + length > maxBodySize_ * kMaxBufferedBodies){
+            resetStream(header.streamId, kRefusedStream);
+            eraseStream(it);
+            return true;
+        }
+    }
+    stream.recvWindow -= header.length;
+    stream.body.append(payload, length);
+    bufferedBody_ += length;
+
+    if(header.flags & kFlagEndStream){
+        stream.endStream = true;
+        dispatchRequest(it);
+        return true;
+    }
+    stream.recvUnacked += header.length;
+    if(stream.recvUnacked >= static_cast<size_t>(kStreamWindow / 2)){
+        writeWindowUpdate(header.streamId, static_cast<uint32_t>(stream.recvUnacked));
+        stream.recvWindow += stream.recvUnacked;
+        stream.recvUnacked = 0;
+    }
+    return true;
+}
+
+bool Http2Connection::onSettingsFrame(const FrameHeader &header, const char *payload){
+    if(header.streamId != 0){
+        return connectionError(kProtocolError);
+    }
+    if(header.flags & kFlagAck){
+        return header.length == 0 ? true : connectionError(kFrameSizeError);
+    }
+    if(header.length % 6 != 0){
+        return connectionError(kFrameSizeError);
+    }
+
+    bool windowGrew = false;
+    for(size_t offset = 0; offset < header.length; offset += 6){
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(payload + offset);
+        uint16_t id = static_cast<uint16_t>((p[0] << 8) | p[1]);
+        uint32_t value = readUint32(payload + offset + 2);
+        switch(id){
+        case kSettingsHeaderTableSize:
+            encoder_.setMaxTableSize(value);
+            break;
+        case kSettingsEnablePush:
+            if(value > 1){
+                return connectionError(kProtocolError);
+            }
+            break;
+        case kSettingsInitialWindowSize:{
+            if(value > kMaxWindow){
+                return connectionError(kFlowControlError);
+            }
+            // 初始窗口的变化同样作用于所有已打开的流（RFC 7540 6.9.2）
+            int64_t delta = static_cast<int64_t>(value) - peerInitialWindow_;
+            for(auto &entry : streams_){
+                entry.second.sendWindow += delta;
+                if(entry.second.sendWindow > kMaxWindow){
+                    return connectionError(kFlowControlError);
+                }
+            }
+            peerInitialWindow_ = value;
+            windowGrew = windowGrew || delta > 0;
+            break;
+        }
+        case kSettingsMaxFrameSize:
+            if(value < 16384 || value > 16777215){
+                return connectionError(kProtocolError);
+            }
+            peerMaxFrameSize_ = value;
+            break;
+        default:
+            // MAX_CONCURRENT_STREAMS只约束服务端推送，其余未知设置按协议忽略
+            break;
+        }
+    }
+    settingsReceived_ = true;
+    writeFrameHeader(0, kSettings, kFlagAck, 0);
+    if(windowGrew){
+        resumePendingStreams();
+    }
+    return true;
+}
+
+bool Http2Connection::onPingFrame(const FrameHeader &header, const char *payload){
+    if(header.streamId != 0){
+        return connectionError(kProtocolError);
+    }
+    if(header.length != 8){
+        return connectionError(kFrameSizeError);
+    }
+    if(!(header.flags & kFlagAck)){
+        writeFrameHeader(8, kPing, kFlagAck, 0);
+        output_.append(payload, 8);
+    }
+    return true;
+}
+
+bool Http2Connection::onWindowUpdateFrame(const FrameHeader &header, const char *payload){
+    if(header.length != 4){
+        return connectionError(kFrameSizeError);
+    }
+    uint32_t increment = readUint32(payload) & 0x7fffffff;
+    if(header.streamId == 0){
+        if(increment == 0){
+            return connectionError(kProtocolError);
+        }
+        sendWindow_ += increment;
+        if(sendWindow_ > kMaxWindow){
+            return connectionError(kFlowControlError);
+        }
+        resumePendingStreams();
+        return true;
+    }
+
+    auto it = streams_.find(header.streamId);
+    if(it == streams_.end()){
+        // 刚关闭的流上还会陆续收到WINDOW_UPDATE，忽略即可
+        return header.streamId > lastStreamId_ ? connectionError(kProtocolError) : true;
+    }
+    if(increment == 0 || it->second.sendWindow + increment > kMaxWindow){
+        resetStream(header.streamId, increment == 0 ? kProtocolError : kFlowControlError);
+        eraseStream(it);
+        return true;
+    }
+    it->second.sendWindow += increment;
+    if(!it->second.pending.empty()){
+        sendPendingData(it);
+    }
+    return true;
+}
+
+bool Http2Connection::onRstStreamFrame(const FrameHeader &header, const char *payload){
+    if(header.streamId == 0 || header.streamId > lastStreamId_){
+        return connectionError(kProtocolError);
+    }
+    if(header.length != 4){
+        return connectionError(kFrameSizeError);
+    }
+    auto it = streams_.find(header.streamId);
+    if(it != streams_.end()){
+        eraseStream(it);
+    }
+    return true;
+}
+
+void Http2Connection::dispatchRequest(StreamMap::iterator it){
+    HttpRequest req;
+    if(!buildRequest(it->second, &req)){
+        resetStream(it->first, kProtocolError);
+        eraseStream(it);
+        return;
+    }
+    // 请求已经映射到HttpRequest，流上只保留发送响应需要的状态
+    bufferedBody_ -= it->second.body.size();
+    HeaderList().swap(it->second.headers);
+    std::string().swap(it->second.body);
+
+    HttpResponse response(false);
+    if(req.method() == HttpRequest::kInvalid){
+        // 和HTTP/1.x一样，不支持的方法返回400，但只影响这一个流
+        response.setStatusCode(HttpResponse::k400BadRequest);
+        response.setStatusMessage("Bad Request");
+    }
+    else{
+        requestCallback_(req, &response);
+    }
+    sendResponse(it, response);
+}
+
+void Http2Connection::rejectBody(StreamMap::iterator it){
+    uint32_t streamId = it->first;
+    LOG_WARN << "HTTP/2 stream " << streamId << " request body exceeds " << maxBodySize_ << " bytes";
+    bufferedBody_ -= it->second.body.size();
+    HeaderList().swap(it->second.headers);
+    std::string().swap(it->second.body);
+
+    HttpResponse response(false);
+    response.setStatusCode(HttpResponse::k413PayloadTooLarge);
+    response.setStatusMessage("Payload Too Large");
+    // 响应没有响应体，发出HEADERS后流就被移除，不会再为它归还接收窗口
+    sendResponse(it, response);
+    // 请求还没有发完，告诉客户端不必再发（RFC 9113 8.1）
+    resetStream(streamId, kNoError);
+}
+
+void Http2Connection::eraseStream(StreamMap::iterator it){
+    bufferedBody_ -= it->second.body.size();
+    streams_.erase(it);
+}
+
+bool Http2Connection::buildRequest(const Stream &stream, HttpRequest *req) const{
+    std::string method, path, authority, cookie;
+    for(const HeaderField &field : stream.headers){
+        // 头部名必须是小写，否则是畸形请求（RFC 7540 8.1.2）
+        if(field.name.empty() || std::any_of(field.name.begin(), field.name.end(),
+                                             [](char c){return c >= 'A' && c <= 'Z';})){
+            return false;
+        }
+        // 值中不能有NUL、CR、LF（RFC 9113 8.2.1），否则转成HTTP/1.x风格的请求后可以伪造出别的头部或者日志行
+        if(field.value.find_first_of(std::string("\0\r\n", 3)) != std::string::npos){
+            return false;
+        }
+        if(field.name[0] == ':'){
+            if(field.name == ":method"){
+                method = field.value;
+            }
+            else if(field.name == ":path"){
+                path = field.value;
+            }
+            else if(field.name == ":authority"){
+                authority = field.value;
+            }
+            else if(field.name != ":scheme"){
+                return false;
+            }
+            continue;
+        }
+        if(isConnectionSpecificHeader(field.name)){
+            return false;
+        }
+        if(field.name == "cookie"){
+            // HTTP/2允许把Cookie拆成多个头部发送，交给上层前重新拼起来（RFC 7540 8.1.2.5）
+            if(!cookie.empty()){
+                cookie.append("; ");
+            }
+            cookie.append(field.value);
+            continue;
+        }
+        req->addHeader(canonicalHeaderName(field.name), field.value);
+    }
+    if(method.empty() || path.empty()){
+        return false;
+    }
+    // 请求行中的路径不能含有空白和控制字符
+    if(std::any_of(path.begin(), path.end(), [](char c){
+        return static_cast<unsigned char>(c) <= ' ' || c == 0x7f;
+    })){
+        return false;
+    }
+    if(!authority.empty() && req->getHeader("Host").empty()){
+        req->addHeader("Host", authority);
+    }
+    if(!cookie.empty()){
+        req->addHeader("Cookie", cookie);
+    }
+
+    req->setMethod(method.data(), method.data() + method.size());
+    size_t question = path.find('?');
+    if(question != std::string::npos){
+        req->setPath(path.data(), path.data() + question);
+        req->setQueryParameters(path.data() + question + 1, path.data() + path.size());
+    }
+    else{
+        req->setPath(path.data(), path.data() + path.size());
+    }
+    req->setVersion("HTTP/2.0");
+    req->setReceiveTime(receiveTime_);
+    req->setBody(stream.body);
+    req->setContentLength(stream.body.size());
+    return true;
+}
+
+void Http2Connection::sendResponse(StreamMap::iterator it, const HttpResponse &resp){
+    HeaderList fields;
+    int status = resp.getStatusCode();
+    if(status < 100 || status > 999){
+        LOG_WARN << "Invalid status code " << status << " on HTTP/2 stream " << it->first;
+        status = HttpResponse::k500InternalServerError;
+    }
+    fields.push_back(HeaderField{":status", std::to_string(status)});
+
+    bool hasContentLength = false;
+    auto addField = [&](std::string name, std::string value){
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](char c){return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;});
+        if(isConnectionSpecificHeader(name)){
+            return;
+        }
+        hasContentLength = hasContentLength || name == "content-length";
+        fields.push_back(HeaderField{std::move(name), std::move(value)});
+    };
+    for(const auto &header : resp.headers()){
+        addField(header.first, header.second);
+    }
+    // 预格式化的头部块是 "Key: Value\r\n" 的序列，拆开后逐个编码
+    const std::string &raw = resp.rawHeaders();
+    size_t lineStart = 0;
+    while(lineStart < raw.size()){
+        size_t lineEnd = raw.find("\r\n", lineStart);
+        if(lineEnd == std::string::npos){
+            lineEnd = raw.size();
+        }
+        size_t colon = raw.find(':', lineStart);
+        if(colon != std::string::npos && colon < lineEnd){
+            size_t valueStart = raw.find_first_not_of(' ', colon + 1);
+            if(valueStart == std::string::npos || valueStart > lineEnd){
+                valueStart = lineEnd;
+            }
+            addField(raw.substr(lineStart, colon - lineStart), raw.substr(valueStart, lineEnd - valueStart));
+        }
+        lineStart = lineEnd + 2;
+    }
+    const std::string &body = resp.body();
+    if(!hasContentLength){
+        fields.push_back(HeaderField{"content-length", std::to_string(body.size())});
+    }
+
+    std::string block;
+    encoder_.encode(fields, &block);
+    // 头部块超过对端的帧长度上限时拆成HEADERS + CONTINUATION
+    size_t offset = 0;
+    do{
+        size_t n = std::min<size_t>(block.size() - offset, peerMaxFrameSize_);
+        bool first = offset == 0;
+        uint8_t flags = 0;
+        if(offset + n == block.size()){
+            flags |= kFlagEndHeaders;
+        }
+        if(first && body.empty()){
+            flags |= kFlagEndStream;
+        }
+        writeFrameHeader(static_cast<uint32_t>(n), first ? kHeaders : kContinuation, flags, it->first);
+        output_.append(block.data() + offset, n);
+        offset += n;
+    }while(offset < block.size());
+
+    if(body.empty()){
+        eraseStream(it);
+        return;
+    }
+    it->second.pending = body;
+    it->second.pendingOffset = 0;
+    sendPendingData(it);
+}
+
+void Http2Connection::sendPendingData(StreamMap::iterator it){
+    Stream &stream = it->second;
+    while(stream.pendingOffset < stream.pending.size()){
+        if(writePaused_){
+            return;
+        }
+        int64_t n = std::min<int64_t>({static_cast<int64_t>(stream.pending.size() - stream.pendingOffset),
+                                       static_cast<int64_t>(peerMaxFrameSize_), sendWindow_, stream.sendWindow});
+        if(n <= 0){
+            // 窗口用完了，等WINDOW_UPDATE
+            return;
+        }
+        bool last = stream.pendingOffset + n == stream.pending.size();
+        writeFrameHeader(static_cast<uint32_t>(n), kData, last ? kFlagEndStream : 0, it->first);
+        output_.append(stream.pending.data() + stream.pendingOffset, n);
+        stream.pendingOffset += n;
+        sendWindow_ -= n;
+        stream.sendWindow -= n;
+    }
+    eraseStream(it);
+}
+
+void Http2Connection::resumePendingStreams(){
+    for(auto it = streams_.begin(); it != streams_.end() && sendWindow_ > 0 && !writePaused_;){
+        auto next = std::next(it);
+        if(!it->second.pending.empty()){
+            sendPendingData(it);
+        }
+        it = next;
+    }
+}
+
+void Http2Connection::writeFrameHeader(uint32_t length, uint8_t type, uint8_t flags, uint32_t streamId){
+    char header[kFrameHeaderLength] = {
+        static_cast<char>(length >> 16), static_cast<char>(length >> 8), static_cast<char>(length),
+        static_cast<char>(type), static_cast<char>(flags),
+    };
+    output_.append(header, 5);
+    appendUint32(&output_, streamId & 0x7fffffff);
+}
+
+void Http2Connection::writeSettings(){
+    const uint16_t ids[] = {kSettingsMaxConcurrentStreams, kSettingsInitialWindowSize};
+    const uint32_t values[] = {kMaxConcurrentStreams, static_cast<uint32_t>(kStreamWindow)};
+    writeFrameHeader(sizeof(ids) / sizeof(ids[0]) * 6, kSettings, 0, 0);
+    for(size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i){
+        char id[2] = {static_cast<char>(ids[i] >> 8), static_cast<char>(ids[i])};
+        output_.append(id, sizeof id);
+        appendUint32(&output_, values[i]);
+    }
+    // 连接级窗口不受SETTINGS控制，只能用WINDOW_UPDATE调大
+    writeWindowUpdate(0, static_cast<uint32_t>(kConnectionWindow - kDefaultWindow));
+    recvWindow_ = kConnectionWindow;
+}
+
+void Http2Connection::writeWindowUpdate(uint32_t streamId, uint32_t increment){
+    writeFrameHeader(4, kWindowUpdate, 0, streamId);
+    appendUint32(&output_, increment);
+}
+
+void Http2Connection::resetStream(uint32_t streamId, ErrorCode code){
+    writeFrameHeader(4, kRstStream, 0, streamId);
+    appendUint32(&output_, code);
+}
+
+void Http2Connection::goAway(){
+    if(closed_ || goingAway_){
+        return;
+    }
+    goingAway_ = true;
+    goAwayStreamId_ = lastStreamId_;
+    writeFrameHeader(8, kGoAway, 0, 0);
+    appendUint32(&output_, goAwayStreamId_);
+    appendUint32(&output_, kNoError);
+    flush();
+}
+
+bool Http2Connection::connectionError(ErrorCode code){
+    if(!closed_){
+        LOG_WARN << "HTTP/2 connection error " << code << ", last stream " << lastStreamId_;
+        writeFrameHeader(8, kGoAway, 0, 0);
+        appendUint32(&output_, lastStreamId_);
+        appendUint32(&output_, code);
+        closed_ = true;
+    }
+    return false;
+}
+
+void Http2Connection::flush(){
+    if(output_.readableBytes() > 0){
+        writeCallback_(&output_);
+        output_.retrieveAll();
+    }
+}
+
+}
+}
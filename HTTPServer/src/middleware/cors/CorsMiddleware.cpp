@@ -1,6 +1,7 @@
 #include <algorithm> // 使用 STL 算法，如 std::find 来查找特定元素。
 #include <sstream>  //用于构建返回的拼接字符串。
 #include <iostream>
+#include <unordered_map>
 
 #include "../../../include/middleware/cors/CorsMiddleware.h"
 #include <muduo/base/Logging.h>
@@ -8,15 +9,93 @@
 namespace http{
 namespace middleware{
 
-CorsMiddleware::CorsMiddleware(const CorsConfig &config) : config_(config) {}
+namespace{
+
+// before()与after()在同一个IO线程中同步执行（见HttpServer::handleRequest），
+// 用thread_local在两者之间传递本次请求匹配到的Origin；按实例区分，链上有多个CorsMiddleware时互不覆盖
+thread_local std::unordered_map<const CorsMiddleware *, std::string> t_currentOrigins;
+
+// Origin会原样回显到响应头中，含有空白或控制字符（比如裸的LF）的一律不匹配，防止响应拆分
+bool hasControlChars(const std::string &origin){
+    return std::any_of(origin.begin(), origin.end(), [](char c){
+        return static_cast<unsigned char>(c) <= ' ' || c == 0x7f;
+    });
+}
+
+bool isHostnameChar(char c){
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.';
+}
+
+}
+
+CorsMiddleware::CorsMiddleware(const CorsConfig &config)
+    : config_(config)
+    , allowAnyOrigin_(false)
+{
+    compile();
+}
+
+// 配置只在构造时解析一次，后续每个响应只做几次append
+void CorsMiddleware::compile(){
+    // 若没有设置允许来源（allowedOrigins 为空），则视为允许所有源
+    allowAnyOrigin_ = config_.allowOrigins.empty();
+    for(const auto &origin : config_.allowOrigins){
+        if(origin == "*"){
+            allowAnyOrigin_ = true;
+            continue;
+        }
+        // "https://*.example.com" 形式的通配子域名
+        std::string::size_type star = origin.find("*.");
+        if(star != std::string::npos){
+            wildcardOrigins_.push_back({origin.substr(0, star), origin.substr(star + 1)});
+        }
+        else{
+            exactOrigins_.insert(origin);
+        }
+    }
+
+    wildcardOriginHeader_ = "Access-Control-Allow-Origin: *\r\n";
+
+    // 任意来源加凭证等于允许任何站点读取带cookie的响应；浏览器本就拒绝"*"与凭证同时出现，
+    // 这里不回显任意Origin来绕过，而是放弃凭证，仍然只发"*"
+    if(allowAnyOrigin_ && config_.allowCredential){
+        LOG_ERROR << "CORS allowCredential cannot be combined with any origin, credentials disabled";
+        config_.allowCredential = false;
+    }
+    if(config_.allowCredential){
+        commonHeaders_ += "Access-Control-Allow-Credentials: true\r\n";
+    }
+
+    if(!config_.allowMethods.empty()){
+        preflightHeaders_ += "Access-Control-Allow-Methods: " + join(config_.allowMethods, ",") + "\r\n";
+    }
+    if(!config_.allowHeaders.empty()){
+        preflightHeaders_ += "Access-Control-Allow-Headers: " + join(config_.allowHeaders, ",") + "\r\n";
+    }
+    preflightHeaders_ += "Access-Control-Max-Age: " + std::to_string(config_.maxAge) + "\r\n";
+}
 
 void CorsMiddleware::before(HttpRequest &request){
     LOG_DEBUG << "CorsMiddleware::before - Processing request";
 
+    // 记录本次请求应当回显的Origin，供after()使用
+    // 允许任意来源时直接用"*"（compile()保证此时不带凭证），响应可以被共享缓存，无需Vary
+    const std::string &origin = request.getHeader("Origin");
+    std::string &current = currentOrigin();
+    if(allowAnyOrigin_){
+        current = "*";
+    }
+    else if(!origin.empty() && isOriginAllowed(origin)){
+        current = origin;
+    }
+    else{
+        current.clear();
+    }
+
     // 如果是预检请求，则调用handlePreflightRequest 处理预检请求，
     // 然后通过 throw response 抛出响应，避免进入后续的处理流程。
     if(request.method() == HttpRequest::Method::kOptions){
-        LOG_INFO << "Processing CORS preflight request";
+        LOG_DEBUG << "Processing CORS preflight request";
         HttpResponse response;
         handlePreflightRequest(request, response);
         throw response;
@@ -26,23 +105,36 @@ void CorsMiddleware::before(HttpRequest &request){
 void CorsMiddleware::after(HttpResponse &response){
     LOG_DEBUG << "CoreMiddleware::after - Processing response";
 
-    if(!config_.allowOrigins.empty()){
-        // 如果允许所有源
-        if(std::find(config_.allowOrigins.begin(), config_.allowOrigins.end(), "*") != config_.allowOrigins.end()){
-            addCorsHeaders(response, "*");
-        }
-        else{
-            // 添加第一个允许的源
-            addCorsHeaders(response, config_.allowOrigins[0]);
-        }
+    const std::string &origin = currentOrigin();
+    if(!origin.empty()){
+        addCorsHeaders(response, origin, false);
     }
 }
 
 bool CorsMiddleware::isOriginAllowed(const std::string &origin) const{
-    // 若没有设置允许来源（allowedOrigins 为空），则视为允许所有源
-    return config_.allowOrigins.empty() ||
-           std::find(config_.allowOrigins.begin(), config_.allowOrigins.end(), "*") != config_.allowOrigins.end() ||
-           std::find(config_.allowOrigins.begin(), config_.allowOrigins.end(), origin) != config_.allowOrigins.end();
+    if(hasControlChars(origin)){
+        return false;
+    }
+    if(allowAnyOrigin_ || exactOrigins_.count(origin)){
+        return true;
+    }
+    for(const auto &pattern : wildcardOrigins_){
+        // 子域名部分至少一个字符，且前缀(协议)和后缀(主域名)都要吻合
+        if(origin.size() > pattern.prefix.size() + pattern.suffix.size() &&
+           origin.compare(0, pattern.prefix.size(), pattern.prefix) == 0 &&
+           origin.compare(origin.size() - pattern.suffix.size(), pattern.suffix.size(), pattern.suffix) == 0){
+            // 子域名只能由主机名字符组成，避免 "https://evil.com/.example.com" 之类的绕过
+            std::string::size_type end = origin.size() - pattern.suffix.size();
+            if(std::all_of(origin.begin() + pattern.prefix.size(), origin.begin() + end, isHostnameChar)){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::string &CorsMiddleware::currentOrigin() const{
+    return t_currentOrigins[this];
 }
 
 void CorsMiddleware::handlePreflightRequest(const HttpRequest &request, HttpResponse &response){
@@ -50,40 +142,35 @@ void CorsMiddleware::handlePreflightRequest(const HttpRequest &request, HttpResp
     const std::string &origin = request.getHeader("Origin");
 
     // 源不在允许范围内
-    if(!isOriginAllowed(origin)){
+    const std::string &current = currentOrigin();
+    if(current.empty()){
         LOG_WARN << "Origin not allowed: " << origin;
         // 返回403
         response.setStatusCode(HttpResponse::k403Forbidden);
         return;
     }
     
-    addCorsHeaders(response, origin);
+    addCorsHeaders(response, current, true);
     response.setStatusCode(HttpResponse::k204NoContent);
-    LOG_INFO << "Preflight request processed successfully";
+    LOG_DEBUG << "Preflight request processed successfully";
 }
 
-void CorsMiddleware::addCorsHeaders(HttpResponse &response, const std::string &origin){
-    try{
-        response.addHeader("Access-Control-Allow-Origin", origin);
-
-        if(config_.allowCredential){
-            response.addHeader("Access-Control-Allow-Credentials", "true");
-        }
-
-        if(!config_.allowMethods.empty()){
-            response.addHeader("Access-Control-Allow-Methods", join(config_.allowMethods, ","));
-        }
-
-        if(!config_.allowHeaders,empty()){
-            response.addHeader("Access-Control-Allow-Headers", join(config_.allowHeaders), ",");
-        }
-
-        response.addHeader("Access-Control-Max-Age", std::to_string(config_.maxAge));
+void CorsMiddleware::addCorsHeaders(HttpResponse &response, const std::string &origin, bool preflight){
+    if(origin == "*"){
+        response.appendRawHeaders(wildcardOriginHeader_);
+    }
+    else{
+        // 回显具体的Origin时，响应随请求头变化，必须带上Vary: Origin，防止缓存串用
+        response.appendRawHeaders("Access-Control-Allow-Origin: ", 29);
+        response.appendRawHeaders(origin);
+        response.appendRawHeaders("\r\nVary: Origin\r\n", 16);
+    }
 
-        LOG_DEBUG << "CORS heades added succesfully";
+    if(!commonHeaders_.empty()){
+        response.appendRawHeaders(commonHeaders_);
     }
-    catch(cosnt std::exception &e){
-        LOG_ERROR << "Eroor adding CORS headers" << e.what();
+    if(preflight){
+        response.appendRawHeaders(preflightHeaders_);
     }
 }
 
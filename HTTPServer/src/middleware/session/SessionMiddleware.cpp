@@ -0,0 +1,24 @@
+#include "../../../include/middleware/session/SessionMiddleware.h"
+#include <muduo/base/Logging.h>
+
+namespace http{
+namespace middleware{
+
+SessionMiddleware::SessionMiddleware(session::SessionManager *manager)
+    : sessionManager_(manager)
+{
+}
+
+void SessionMiddleware::before(HttpRequest &request){
+    // 处理器抛异常时不会走到after()，遗留的会话在下一个请求开始时写回，修改不会丢
+    // 这时已经拿不到上一个请求的响应，Cookie型存储的这次修改无法下发
+    sessionManager_->flushPendingSessions();
+}
+
+void SessionMiddleware::after(HttpResponse &response){
+    LOG_DEBUG << "SessionMiddleware::after - Flushing sessions";
+    sessionManager_->flushPendingSessions(&response);
+}
+
+}
+}
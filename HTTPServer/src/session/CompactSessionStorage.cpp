@@ -0,0 +1,408 @@
+#include <malloc.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "../../include/session/CompactSessionStorage.h"
+#include <muduo/base/Logging.h>
+
+namespace http{
+namespace session{
+
+namespace{
+
+// 编码会话时复用的缓冲区，避免每次save都重新分配
+thread_local std::string t_blob;
+// 槽中存放形式的id，16字节超出了std::string的内联容量，同样复用
+thread_local std::string t_id;
+
+int hexValue(char c){
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+size_t roundUpPowerOfTwo(size_t n){
+    size_t result = 1;
+    while(result < n){
+        result <<= 1;
+    }
+    return result;
+}
+
+int64_t toSeconds(std::chrono::system_clock::time_point tp){
+    return std::chrono::duration_cast<std::chrono::seconds>(tp.time_since_epoch()).count();
+}
+
+std::chrono::system_clock::time_point fromSeconds(int64_t seconds){
+    return std::chrono::system_clock::time_point(std::chrono::seconds(seconds));
+}
+
+const size_t kMinTableSize = 16;
+
+}
+
+const uint32_t CompactSessionStorage::kNoSlot;
+const uint32_t CompactSessionStorage::kEmptyEntry;
+const uint32_t CompactSessionStorage::kTombstoneEntry;
+const uint32_t CompactSessionStorage::kMaxSlots;
+
+CompactSessionStorage::CompactSessionStorage(size_t memoryBudget, size_t shardCount)
+    : shards_(roundUpPowerOfTwo(shardCount == 0 ? 1 : shardCount))
+    , shardMask_(shards_.size() - 1)
+    , shardBits_(0)
+    , shardBudget_(memoryBudget / shards_.size())
+    , evictCursor_(0)
+{
+    while((size_t(1) << shardBits_) < shards_.size()){
+        ++shardBits_;
+    }
+    for(auto &shard : shards_){
+        shard.table.assign(kMinTableSize, kEmptyEntry);
+    }
+}
+
+CompactSessionStorage::~CompactSessionStorage(){
+    for(auto &shard : shards_){
+        for(auto &slot : shard.slots){
+            if(slot.hash != 0 && !slot.isInline()){
+                ::free(slot.heapData());
+            }
+        }
+    }
+}
+
+uint64_t CompactSessionStorage::hashOf(const std::string &sessionId){
+    uint64_t hash = std::hash<std::string>{}(sessionId);
+    return hash == 0 ? 1 : hash;   // 0留给空闲槽
+}
+
+bool CompactSessionStorage::packId(const std::string &sessionId, std::string *out){
+    // 只接受小写：每个字节只有一种十六进制写法，压缩前后一一对应
+    out->clear();
+    if(sessionId.size() % 2 == 0 && sessionId.size() <= 2 * UINT8_MAX){
+        for(size_t i = 0; i < sessionId.size(); i += 2){
+            int high = hexValue(sessionId[i]);
+            int low = hexValue(sessionId[i + 1]);
+            if(high < 0 || low < 0){
+                break;
+            }
+            out->push_back(static_cast<char>((high << 4) | low));
+        }
+        if(out->size() * 2 == sessionId.size()){
+            return true;
+        }
+    }
+    out->assign(sessionId);
+    return false;
+}
+
+void CompactSessionStorage::save(std::shared_ptr<Session> session){
+    const std::string &sessionId = session->getId();
+    std::string &storedId = t_id;
+    bool packed = packId(sessionId, &storedId);
+    if(storedId.size() > UINT8_MAX){
+        LOG_ERROR << "Session id too long for CompactSessionStorage: " << sessionId.size();
+        return;
+    }
+    // 锁外编码：sessionId + 键值对
+    std::string &blob = t_blob;
+    blob.assign(storedId);
+    SessionCodec::encodeValues(session->getValues(), &blob);
+    size_t newHeap = blob.size() > kInlineBytes ? blob.size() : 0;
+
+    uint64_t hash = hashOf(sessionId);
+    Shard &shard = shardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint32_t index = find(shard, hash, storedId, packed);
+    if(index == kNoSlot){
+        makeRoom(shard, sizeof(Slot) + newHeap, kNoSlot);
+        if(shard.freeHead != kNoSlot){
+            index = shard.freeHead;
+            shard.freeHead = static_cast<uint32_t>(shard.slots[index].expiry);
+        }
+        else{
+            if(shard.slots.size() >= kMaxSlots){
+                LOG_ERROR << "CompactSessionStorage shard is full, session not saved: " << sessionId;
+                return;
+            }
+            shard.slots.push_back(Slot());
+            index = static_cast<uint32_t>(shard.slots.size() - 1);
+        }
+        Slot &slot = shard.slots[index];
+        slot.hash = hash;
+        slot.size = 0;
+        slot.idLen = static_cast<uint8_t>(storedId.size());
+        slot.packedId = packed;
+        // 新会话的引用位为0：只访问过一次的会话（例如爬虫）在下一圈就会被淘汰，不会挤掉经常访问的会话
+        slot.referenced = 0;
+        ++shard.live;
+        insertIndex(shard, hash, index);
+    }
+    else{
+        const Slot &slot = shard.slots[index];
+        size_t oldHeap = slot.isInline() ? 0 : malloc_usable_size(slot.heapData());
+        if(newHeap > oldHeap){
+            makeRoom(shard, newHeap - oldHeap, index);
+        }
+        shard.slots[index].referenced = 1;
+    }
+
+    Slot &slot = shard.slots[index];
+    slot.expiry = toSeconds(session->getExpiryTime());
+    slot.maxAge = session->getMaxAge();
+    assignData(shard, slot, blob);
+}
+
+std::shared_ptr<Session> CompactSessionStorage::load(const std::string &sessionId){
+    uint64_t hash = hashOf(sessionId);
+    Shard &shard = shardFor(hash);
+    std::unordered_map<std::string, std::string> values;
+    int64_t expiry;
+    int maxAge;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        bool packed = packId(sessionId, &t_id);
+        uint32_t index = find(shard, hash, t_id, packed);
+        if(index == kNoSlot){
+            return nullptr;
+        }
+        Slot &slot = shard.slots[index];
+        if(std::chrono::system_clock::now() > fromSeconds(slot.expiry)){
+            eraseSlot(shard, index);
+            return nullptr;
+        }
+        if(!SessionCodec::decodeValues(slot.data() + slot.idLen, slot.size - slot.idLen, &values)){
+            LOG_ERROR << "Corrupted session data in CompactSessionStorage: " << sessionId;
+            eraseSlot(shard, index);
+            return nullptr;
+        }
+        slot.referenced = 1;
+        expiry = slot.expiry;
+        maxAge = slot.maxAge;
+    }
+    auto session = std::make_shared<Session>(sessionId, nullptr, maxAge);
+    session->restore(std::move(values), fromSeconds(expiry));
+    return session;
+}
+
+void CompactSessionStorage::remove(const std::string &sessionId){
+    uint64_t hash = hashOf(sessionId);
+    Shard &shard = shardFor(hash);
+    bool packed = packId(sessionId, &t_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint32_t index = find(shard, hash, t_id, packed);
+    if(index != kNoSlot){
+        eraseSlot(shard, index);
+    }
+}
+
+void CompactSessionStorage::touch(std::shared_ptr<Session> session){
+    uint64_t hash = hashOf(session->getId());
+    Shard &shard = shardFor(hash);
+    bool packed = packId(session->getId(), &t_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint32_t index = find(shard, hash, t_id, packed);
+    if(index == kNoSlot){
+        return;     // 已被淘汰：数据没有变化时不值得为它重新占用预算
+    }
+    Slot &slot = shard.slots[index];
+    slot.expiry = toSeconds(session->getExpiryTime());
+    slot.referenced = 1;
+}
+
+size_t CompactSessionStorage::evictExpired(size_t budget){
+    size_t evicted = 0;
+    auto now = std::chrono::system_clock::now();
+    for(size_t i = 0; i < shards_.size() && budget > 0; ++i){
+        Shard &shard = shards_[evictCursor_];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            // 每个分片最多扫一圈，budget按检查过的槽计数
+            size_t count = shard.slots.size();
+            for(size_t j = 0; j < count && budget > 0; ++j){
+                if(shard.scanCursor >= count){
+                    shard.scanCursor = 0;
+                }
+                uint32_t index = static_cast<uint32_t>(shard.scanCursor++);
+                --budget;
+                const Slot &slot = shard.slots[index];
+                if(slot.hash != 0 && now > fromSeconds(slot.expiry)){
+                    eraseSlot(shard, index);
+                    ++evicted;
+                }
+            }
+        }
+        evictCursor_ = (evictCursor_ + 1) & shardMask_;
+    }
+    return evicted;
+}
+
+uint32_t CompactSessionStorage::find(const Shard &shard, uint64_t hash, const std::string &storedId, bool packed) const{
+    size_t mask = shard.table.size() - 1;
+    // 索引表的装载率（含墓碑）不超过1/2，一定能探测到空位
+    for(size_t pos = (hash >> shardBits_) & mask; ; pos = (pos + 1) & mask){
+        uint32_t entry = shard.table[pos];
+        if(entry == kEmptyEntry){
+            return kNoSlot;
+        }
+        if(entry == kTombstoneEntry){
+            continue;
+        }
+        const Slot &slot = shard.slots[entry - 1];
+        if(slot.hash == hash && slot.packedId == packed && slot.idLen == storedId.size() &&
+           memcmp(slot.data(), storedId.data(), storedId.size()) == 0){
+            return entry - 1;
+        }
+    }
+}
+
+void CompactSessionStorage::insertIndex(Shard &shard, uint64_t hash, uint32_t slot){
+    if((shard.tableUsed + 1) * 2 > shard.table.size()){
+        // 按活跃数重建，同时清掉墓碑；删除多时索引表也会随之缩小
+        rehash(shard, std::max(kMinTableSize, roundUpPowerOfTwo(shard.live * 4)));
+        return;     // rehash已经把所有活跃槽（包括这一个）放进去了
+    }
+    size_t mask = shard.table.size() - 1;
+    size_t pos = (hash >> shardBits_) & mask;
+    while(shard.table[pos] != kEmptyEntry && shard.table[pos] != kTombstoneEntry){
+        pos = (pos + 1) & mask;
+    }
+    if(shard.table[pos] == kEmptyEntry){
+        ++shard.tableUsed;
+    }
+    shard.table[pos] = slot + 1;
+}
+
+void CompactSessionStorage::rehash(Shard &shard, size_t tableSize){
+    std::vector<uint32_t> table(tableSize, kEmptyEntry);
+    size_t mask = tableSize - 1;
+    for(size_t i = 0; i < shard.slots.size(); ++i){
+        if(shard.slots[i].hash == 0){
+            continue;
+        }
+        size_t pos = (shard.slots[i].hash >> shardBits_) & mask;
+        while(table[pos] != kEmptyEntry){
+            pos = (pos + 1) & mask;
+        }
+        table[pos] = static_cast<uint32_t>(i + 1);
+    }
+    shard.table.swap(table);
+    shard.tableUsed = shard.live;
+}
+
+void CompactSessionStorage::eraseSlot(Shard &shard, uint32_t index){
+    Slot &slot = shard.slots[index];
+    size_t mask = shard.table.size() - 1;
+    size_t pos = (slot.hash >> shardBits_) & mask;
+    while(shard.table[pos] != index + 1){
+        pos = (pos + 1) & mask;
+    }
+    shard.table[pos] = kTombstoneEntry;
+
+    if(!slot.isInline()){
+        shard.heapBytes -= malloc_usable_size(slot.heapData());
+        ::free(slot.heapData());
+    }
+    slot.hash = 0;
+    slot.size = 0;
+    slot.referenced = 0;
+    slot.expiry = shard.freeHead;
+    shard.freeHead = index;
+    --shard.live;
+}
+
+void CompactSessionStorage::assignData(Shard &shard, Slot &slot, const std::string &blob){
+    if(!slot.isInline()){
+        if(blob.size() > kInlineBytes && blob.size() <= malloc_usable_size(slot.heapData())){
+            // 原来的堆块放得下，原地覆盖
+            memcpy(slot.heapData(), blob.data(), blob.size());
+            slot.size = static_cast<uint32_t>(blob.size());
+            return;
+        }
+        shard.heapBytes -= malloc_usable_size(slot.heapData());
+        ::free(slot.heapData());
+    }
+    slot.size = static_cast<uint32_t>(blob.size());
+    if(slot.isInline()){
+        memcpy(slot.storage, blob.data(), blob.size());
+        return;
+    }
+    char *data = static_cast<char *>(::malloc(blob.size()));
+    if(data == nullptr){
+        throw std::bad_alloc();
+    }
+    memcpy(data, blob.data(), blob.size());
+    slot.setHeapData(data);
+    shard.heapBytes += malloc_usable_size(data);
+}
+
+void CompactSessionStorage::makeRoom(Shard &shard, size_t incoming, uint32_t keep){
+    // 最多转两圈：第一圈清引用位，第二圈一定能找到可淘汰的槽
+    size_t steps = shard.slots.size() * 2;
+    while(accountedBytes(shard) + incoming > shardBudget_ && shard.live > 0 && steps-- > 0){
+        if(shard.hand >= shard.slots.size()){
+            shard.hand = 0;
+        }
+        uint32_t index = static_cast<uint32_t>(shard.hand++);
+        Slot &slot = shard.slots[index];
+        if(slot.hash == 0 || index == keep){
+            continue;
+        }
+        if(slot.referenced){
+            slot.referenced = 0;
+            continue;
+        }
+        eraseSlot(shard, index);
+        ++shard.evictions;
+    }
+}
+
+size_t CompactSessionStorage::accountedBytes(const Shard &shard) const{
+    return shard.live * sizeof(Slot) + shard.table.size() * sizeof(uint32_t) + shard.heapBytes;
+}
+
+size_t CompactSessionStorage::size() const{
+    size_t total = 0;
+    for(const auto &shard : shards_){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.live;
+    }
+    return total;
+}
+
+size_t CompactSessionStorage::memoryUsage() const{
+    size_t total = 0;
+    for(const auto &shard : shards_){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += accountedBytes(shard);
+    }
+    return total;
+}
+
+size_t CompactSessionStorage::memoryFootprint() const{
+    size_t total = sizeof(Shard) * shards_.size();
+    for(const auto &shard : shards_){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.slots.capacity() * sizeof(Slot) + shard.table.capacity() * sizeof(uint32_t) + shard.heapBytes;
+    }
+    return total;
+}
+
+size_t CompactSessionStorage::evictions() const{
+    size_t total = 0;
+    for(const auto &shard : shards_){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.evictions;
+    }
+    return total;
+}
+
+}
+}
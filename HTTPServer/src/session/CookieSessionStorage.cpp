@@ -0,0 +1,299 @@
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include "../../include/session/CookieSessionStorage.h"
+#include <muduo/base/Logging.h>
+
+namespace http{
+namespace session{
+
+namespace{
+
+const size_t kMacLen = 32;      // HMAC-SHA256
+const size_t kIvLen = 12;       // GCM推荐的IV长度
+const size_t kTagLen = 16;      // GCM认证标签
+
+// 给每个存储实例编号，线程本地的cipher上下文据此判断已加载的密钥是不是自己的
+std::atomic<uint64_t> g_nextInstanceId{1};
+
+// 每个线程复用的OpenSSL上下文，避免每次签名/加解密都重新分配
+// GCM的密钥扩展只在密钥变化时做一次，之后每次只重设IV
+struct ThreadCryptoContexts{
+    EVP_MD_CTX *md;
+    EVP_CIPHER_CTX *enc;
+    EVP_CIPHER_CTX *dec;
+    uint64_t encOwner;
+    uint64_t decOwner;
+
+    ThreadCryptoContexts()
+        : md(EVP_MD_CTX_new())
+        , enc(EVP_CIPHER_CTX_new())
+        , dec(EVP_CIPHER_CTX_new())
+        , encOwner(0)
+        , decOwner(0)
+    {
+    }
+
+    ~ThreadCryptoContexts(){
+        EVP_MD_CTX_free(md);
+        EVP_CIPHER_CTX_free(enc);
+        EVP_CIPHER_CTX_free(dec);
+    }
+};
+
+thread_local ThreadCryptoContexts t_crypto;
+
+// ---------- base64url（无填充） ----------
+const char kBase64Url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+void appendBase64Url(std::string &out, const unsigned char *data, size_t len){
+    size_t i = 0;
+    for(; i + 3 <= len; i += 3){
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out.push_back(kBase64Url[(v >> 18) & 0x3f]);
+        out.push_back(kBase64Url[(v >> 12) & 0x3f]);
+        out.push_back(kBase64Url[(v >> 6) & 0x3f]);
+        out.push_back(kBase64Url[v & 0x3f]);
+    }
+    if(len - i == 1){
+        uint32_t v = data[i] << 16;
+        out.push_back(kBase64Url[(v >> 18) & 0x3f]);
+        out.push_back(kBase64Url[(v >> 12) & 0x3f]);
+    }
+    else if(len - i == 2){
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8);
+        out.push_back(kBase64Url[(v >> 18) & 0x3f]);
+        out.push_back(kBase64Url[(v >> 12) & 0x3f]);
+        out.push_back(kBase64Url[(v >> 6) & 0x3f]);
+    }
+}
+
+int base64UrlValue(char c){
+    if(c >= 'A' && c <= 'Z') return c - 'A';
+    if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if(c >= '0' && c <= '9') return c - '0' + 52;
+    if(c == '-') return 62;
+    if(c == '_') return 63;
+    return -1;
+}
+
+bool decodeBase64Url(const char *begin, const char *end, std::string *out){
+    out->clear();
+    out->reserve((end - begin) * 3 / 4);
+    uint32_t acc = 0;
+    int bits = 0;
+    for(const char *p = begin; p != end; ++p){
+        int v = base64UrlValue(*p);
+        if(v < 0){
+            return false;
+        }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if(bits >= 8){
+            bits -= 8;
+            out->push_back(static_cast<char>((acc >> bits) & 0xff));
+        }
+    }
+    // 合法的无填充编码最后最多剩4位
+    return bits < 6;
+}
+
+}  // namespace
+
+CookieSessionStorage::CookieSessionStorage(const std::string &secret,
+                                           std::unique_ptr<SessionStorage> fallback,
+                                           bool encrypt,
+                                           size_t maxCookieBytes)
+    : fallback_(std::move(fallback))
+    , encrypt_(encrypt)
+    , maxCookieBytes_(maxCookieBytes)
+    , macKey_(nullptr)
+    , instanceId_(g_nextInstanceId.fetch_add(1))
+{
+    if(secret.size() < 32){
+        LOG_FATAL << "CookieSessionStorage secret must be at least 32 bytes";
+    }
+    if(!fallback_){
+        LOG_FATAL << "CookieSessionStorage requires a fallback storage";
+    }
+
+    // 用不同的标签从同一个secret派生签名密钥和加密密钥
+    unsigned char macRaw[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    static const char kMacLabel[] = "session-cookie-mac";
+    static const char kEncLabel[] = "session-cookie-enc";
+    HMAC(EVP_sha256(), secret.data(), static_cast<int>(secret.size()),
+         reinterpret_cast<const unsigned char *>(kMacLabel), sizeof(kMacLabel) - 1, macRaw, &len);
+    macKey_ = EVP_PKEY_new_raw_private_key(EVP_PKEY_HMAC, nullptr, macRaw, len);
+    OPENSSL_cleanse(macRaw, sizeof(macRaw));
+
+    HMAC(EVP_sha256(), secret.data(), static_cast<int>(secret.size()),
+         reinterpret_cast<const unsigned char *>(kEncLabel), sizeof(kEncLabel) - 1, encKey_, &len);
+
+    if(!macKey_){
+        LOG_FATAL << "Failed to create session cookie MAC key";
+    }
+}
+
+CookieSessionStorage::~CookieSessionStorage(){
+    EVP_PKEY_free(macKey_);
+    OPENSSL_cleanse(encKey_, sizeof(encKey_));
+}
+
+std::shared_ptr<Session> CookieSessionStorage::load(const std::string &cookieValue){
+    // 不是我们编码的格式，说明是存在fallback中的大会话
+    if(cookieValue.size() < 2 || cookieValue[1] != '.' ||
+       (cookieValue[0] != 's' && cookieValue[0] != 'e')){
+        return fallback_->load(cookieValue);
+    }
+
+    const char *begin = cookieValue.data() + 2;
+    const char *end = cookieValue.data() + cookieValue.size();
+    std::string payload;
+
+    if(cookieValue[0] == 's'){
+        const char *dot = std::find(begin, end, '.');
+        std::string mac;
+        if(dot == end ||
+           !decodeBase64Url(begin, dot, &payload) ||
+           !decodeBase64Url(dot + 1, end, &mac) ||
+           mac.size() != kMacLen){
+            return nullptr;
+        }
+        unsigned char expected[kMacLen];
+        // 常数时间比较，防止时序攻击
+        if(!sign(payload, expected) || CRYPTO_memcmp(expected, mac.data(), kMacLen) != 0){
+            LOG_WARN << "Session cookie signature mismatch";
+            return nullptr;
+        }
+    }
+    else{
+        std::string sealed;
+        if(!decodeBase64Url(begin, end, &sealed) ||
+           !unseal(reinterpret_cast<const unsigned char *>(sealed.data()), sealed.size(), &payload)){
+            LOG_WARN << "Session cookie decryption failed";
+            return nullptr;
+        }
+    }
+
+    return SessionCodec::decode(payload.data(), payload.size());
+}
+
+void CookieSessionStorage::remove(const std::string &sessionId){
+    fallback_->remove(sessionId);
+}
+
+size_t CookieSessionStorage::evictExpired(size_t budget){
+    return fallback_->evictExpired(budget);
+}
+
+bool CookieSessionStorage::cookieValue(const std::shared_ptr<Session> &session, std::string *value){
+    std::string payload;
+    SessionCodec::encode(*session, &payload);
+
+    value->clear();
+    if(encrypt_){
+        std::string sealed;
+        if(!seal(payload, &sealed)){
+            LOG_ERROR << "Failed to encrypt session cookie";
+            return false;
+        }
+        value->reserve(2 + (sealed.size() * 4 + 2) / 3);
+        value->append("e.");
+        appendBase64Url(*value, reinterpret_cast<const unsigned char *>(sealed.data()), sealed.size());
+    }
+    else{
+        unsigned char mac[kMacLen];
+        if(!sign(payload, mac)){
+            LOG_ERROR << "Failed to sign session cookie";
+            return false;
+        }
+        value->reserve(3 + (payload.size() * 4 + 2) / 3 + (kMacLen * 4 + 2) / 3);
+        value->append("s.");
+        appendBase64Url(*value, reinterpret_cast<const unsigned char *>(payload.data()), payload.size());
+        value->push_back('.');
+        appendBase64Url(*value, mac, kMacLen);
+    }
+
+    // 超过大小上限就退回服务端存储，Cookie中只放sessionId
+    if(value->size() > maxCookieBytes_){
+        fallback_->save(session);
+        *value = session->getId();
+    }
+    return true;
+}
+
+bool CookieSessionStorage::sign(const std::string &payload, unsigned char *mac){
+    EVP_MD_CTX *ctx = t_crypto.md;
+    size_t len = kMacLen;
+    EVP_MD_CTX_reset(ctx);
+    return EVP_DigestSignInit(ctx, nullptr, EVP_sha256(), nullptr, macKey_) == 1 &&
+           EVP_DigestSignUpdate(ctx, payload.data(), payload.size()) == 1 &&
+           EVP_DigestSignFinal(ctx, mac, &len) == 1 &&
+           len == kMacLen;
+}
+
+bool CookieSessionStorage::seal(const std::string &payload, std::string *out){
+    EVP_CIPHER_CTX *ctx = t_crypto.enc;
+    // 本线程的上下文里装的不是本实例的密钥，才需要重新做密钥扩展
+    if(t_crypto.encOwner != instanceId_){
+        if(EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, encKey_, nullptr) != 1){
+            return false;
+        }
+        t_crypto.encOwner = instanceId_;
+    }
+
+    out->resize(kIvLen + payload.size() + kTagLen);
+    unsigned char *iv = reinterpret_cast<unsigned char *>(&(*out)[0]);
+    unsigned char *cipher = iv + kIvLen;
+    int len = 0, finalLen = 0;
+    if(RAND_bytes(iv, kIvLen) != 1 ||
+       EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) != 1 ||
+       EVP_EncryptUpdate(ctx, cipher, &len,
+                         reinterpret_cast<const unsigned char *>(payload.data()),
+                         static_cast<int>(payload.size())) != 1 ||
+       EVP_EncryptFinal_ex(ctx, cipher + len, &finalLen) != 1 ||
+       EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, kTagLen, cipher + payload.size()) != 1){
+        t_crypto.encOwner = 0;
+        return false;
+    }
+    return true;
+}
+
+bool CookieSessionStorage::unseal(const unsigned char *data, size_t len, std::string *payload){
+    if(len < kIvLen + kTagLen){
+        return false;
+    }
+    EVP_CIPHER_CTX *ctx = t_crypto.dec;
+    if(t_crypto.decOwner != instanceId_){
+        if(EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, encKey_, nullptr) != 1){
+            return false;
+        }
+        t_crypto.decOwner = instanceId_;
+    }
+
+    size_t cipherLen = len - kIvLen - kTagLen;
+    const unsigned char *iv = data;
+    const unsigned char *cipher = data + kIvLen;
+    const unsigned char *tag = cipher + cipherLen;
+    payload->resize(cipherLen);
+    unsigned char *plain = reinterpret_cast<unsigned char *>(&(*payload)[0]);
+    int outLen = 0, finalLen = 0;
+    if(EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, iv) != 1 ||
+       EVP_DecryptUpdate(ctx, plain, &outLen, cipher, static_cast<int>(cipherLen)) != 1 ||
+       EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, kTagLen, const_cast<unsigned char *>(tag)) != 1){
+        t_crypto.decOwner = 0;
+        return false;
+    }
+    // 认证失败时Final返回0，上下文本身仍可继续使用
+    return EVP_DecryptFinal_ex(ctx, plain + outLen, &finalLen) == 1;
+}
+
+}
+}
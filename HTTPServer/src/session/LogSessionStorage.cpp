@@ -0,0 +1,502 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "../../include/session/LogSessionStorage.h"
+#include <muduo/base/Logging.h>
+
+namespace http{
+namespace session{
+
+namespace{
+
+const char kPut = 1;
+const char kDel = 2;
+const size_t kHeaderLen = 8;    // u32长度 + u32 CRC32
+
+// 查表法CRC32（IEEE多项式），用来识别写了一半的尾部记录
+struct Crc32Table{
+    uint32_t table[256];
+    Crc32Table(){
+        for(uint32_t i = 0; i < 256; ++i){
+            uint32_t c = i;
+            for(int k = 0; k < 8; ++k){
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+    }
+};
+const Crc32Table kCrcTable;
+
+uint32_t crc32Update(uint32_t crc, const char *data, size_t len){
+    crc = ~crc;
+    for(size_t i = 0; i < len; ++i){
+        crc = kCrcTable.table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t readU32(const char *p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void writeU32(char *p, uint32_t v){
+    memcpy(p, &v, sizeof(v));
+}
+
+// 每个线程复用的编码缓冲区
+thread_local std::string t_encodeBuffer;
+
+}  // namespace
+
+LogSessionStorage::LogSessionStorage(const std::string &directory, size_t segmentSize)
+    : directory_(directory)
+    , segmentSize_(segmentSize)
+    , compactThreshold_(0.5)
+    , compactCursor_(0)
+    , running_(true)
+{
+    // Location中的段内偏移和记录长度是32位的
+    if(segmentSize_ > UINT32_MAX){
+        LOG_FATAL << "Session log segment size " << segmentSize_ << " exceeds 4GB";
+    }
+    if(::mkdir(directory_.c_str(), 0755) < 0 && errno != EEXIST){
+        LOG_SYSFATAL << "Failed to create session directory " << directory_;
+    }
+
+    recover();
+    if(segments_.empty()){
+        Segment segment;
+        if(!openSegment(1, true, &segment)){
+            LOG_FATAL << "Failed to create session log segment in " << directory_;
+        }
+        segments_.push_back(segment);
+    }
+    LOG_INFO << "LogSessionStorage recovered " << index_.size() << " sessions from "
+             << segments_.size() << " segments";
+
+    compactThread_ = std::thread(&LogSessionStorage::compactThreadFunc, this);
+}
+
+LogSessionStorage::~LogSessionStorage(){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    compactCond_.notify_all();
+    compactThread_.join();
+
+    for(auto &segment : segments_){
+        closeSegment(segment, false);
+    }
+}
+
+void LogSessionStorage::recover(){
+    DIR *dir = ::opendir(directory_.c_str());
+    if(!dir){
+        LOG_SYSERR << "Failed to open session directory " << directory_;
+        return;
+    }
+    std::vector<uint64_t> seqs;
+    while(struct dirent *entry = ::readdir(dir)){
+        unsigned long long seq;
+        char tail;
+        // 要求文件名恰好是 session-<序号>.log
+        if(sscanf(entry->d_name, "session-%llu.lo%c", &seq, &tail) == 2 && tail == 'g' &&
+           strlen(entry->d_name) == strlen("session-.log") + 16){
+            seqs.push_back(seq);
+        }
+    }
+    ::closedir(dir);
+    std::sort(seqs.begin(), seqs.end());
+
+    // 按写入顺序从老到新重放，后面的记录覆盖前面的
+    for(uint64_t seq : seqs){
+        Segment segment;
+        if(!openSegment(seq, false, &segment)){
+            continue;
+        }
+        segments_.push_back(segment);
+        replaySegment(segments_.back());
+    }
+}
+
+void LogSessionStorage::replaySegment(Segment &segment){
+    auto now = std::chrono::system_clock::now();
+    size_t offset = 0;
+    while(offset + kHeaderLen <= segment.capacity){
+        const char *header = segment.base + offset;
+        uint32_t len = readU32(header);
+        if(len == 0 || offset + kHeaderLen + len > segment.capacity){
+            break;  // 预分配的空白区域
+        }
+        const char *body = header + kHeaderLen;
+        if(crc32Update(0, body, len) != readU32(header + 4)){
+            LOG_WARN << "Truncating torn record in " << segment.path << " at offset " << offset;
+            break;
+        }
+
+        uint32_t recordLen = static_cast<uint32_t>(kHeaderLen + len);
+        std::string sessionId;
+        if(body[0] == kPut){
+            TimePoint expiry;
+            if(SessionCodec::peek(body + 1, len - 1, &sessionId, &expiry)){
+                auto it = index_.find(sessionId);
+                if(it != index_.end()){
+                    dropLocation(it->second);
+                }
+                if(expiry < now){
+                    // 最新的一条已经过期，整个会话作废
+                    if(it != index_.end()){
+                        index_.erase(it);
+                    }
+                }
+                else{
+                    Location location{segment.seq, static_cast<uint32_t>(offset), recordLen, expiry};
+                    segment.liveBytes += recordLen;
+                    if(it == index_.end()){
+                        index_.emplace(sessionId, location);
+                        expiryHeap_.emplace(expiry, sessionId);
+                    }
+                    else{
+                        it->second = location;
+                    }
+                }
+            }
+        }
+        else if(body[0] == kDel){
+            sessionId.assign(body + 1, len - 1);
+            auto it = index_.find(sessionId);
+            if(it != index_.end()){
+                dropLocation(it->second);
+                index_.erase(it);
+            }
+        }
+        offset += recordLen;
+    }
+    segment.size = offset;
+}
+
+bool LogSessionStorage::openSegment(uint64_t seq, bool create, Segment *segment){
+    char name[64];
+    snprintf(name, sizeof(name), "/session-%016llu.log", static_cast<unsigned long long>(seq));
+    segment->seq = seq;
+    segment->path = directory_ + name;
+    segment->size = 0;
+    segment->liveBytes = 0;
+
+    int flags = O_RDWR | O_CLOEXEC | (create ? (O_CREAT | O_EXCL) : 0);
+    segment->fd = ::open(segment->path.c_str(), flags, 0644);
+    if(segment->fd < 0){
+        LOG_SYSERR << "Failed to open " << segment->path;
+        return false;
+    }
+
+    if(create){
+        // 先占好磁盘块：映射中写到没有分配块的位置时磁盘已满会收到SIGBUS，在这里失败才能走写满的处理
+        int err = ::posix_fallocate(segment->fd, 0, static_cast<off_t>(segmentSize_));
+        if(err != 0){
+            errno = err;
+            LOG_SYSERR << "Failed to allocate " << segment->path;
+            ::close(segment->fd);
+            ::unlink(segment->path.c_str());
+            return false;
+        }
+        segment->capacity = segmentSize_;
+    }
+    else{
+        struct stat st;
+        if(::fstat(segment->fd, &st) < 0 || st.st_size == 0){
+            ::close(segment->fd);
+            return false;
+        }
+        segment->capacity = static_cast<size_t>(st.st_size);
+    }
+
+    void *base = ::mmap(nullptr, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if(base == MAP_FAILED){
+        LOG_SYSERR << "Failed to mmap " << segment->path;
+        ::close(segment->fd);
+        return false;
+    }
+    segment->base = static_cast<char *>(base);
+    return true;
+}
+
+void LogSessionStorage::closeSegment(Segment &segment, bool unlink){
+    if(segment.base){
+        ::msync(segment.base, segment.size, MS_ASYNC);
+        ::munmap(segment.base, segment.capacity);
+        segment.base = nullptr;
+    }
+    if(segment.fd >= 0){
+        ::close(segment.fd);
+        segment.fd = -1;
+    }
+    if(unlink){
+        ::unlink(segment.path.c_str());
+    }
+}
+
+LogSessionStorage::Segment *LogSessionStorage::findSegment(uint64_t seq){
+    // 段的序号连续递增，可以直接算出下标
+    if(segments_.empty() || seq < segments_.front().seq){
+        return nullptr;
+    }
+    size_t i = seq - segments_.front().seq;
+    if(i < segments_.size() && segments_[i].seq == seq){
+        return &segments_[i];
+    }
+    for(auto &segment : segments_){
+        if(segment.seq == seq){
+            return &segment;
+        }
+    }
+    return nullptr;
+}
+
+bool LogSessionStorage::appendRecord(char type, const char *data, size_t len, Location *location){
+    size_t recordLen = kHeaderLen + 1 + len;
+    if(recordLen > segmentSize_){
+        LOG_ERROR << "Session record of " << recordLen << " bytes exceeds segment size";
+        return false;
+    }
+
+    Segment *active = &segments_.back();
+    if(active->size + recordLen > active->capacity){
+        // 当前段写满，封存并开启新段
+        ::msync(active->base, active->size, MS_ASYNC);
+        Segment segment;
+        if(!openSegment(active->seq + 1, true, &segment)){
+            return false;
+        }
+        segments_.push_back(segment);
+        active = &segments_.back();
+        compactCond_.notify_one();
+    }
+
+    // 先写数据再写长度，断电时写了一半的记录长度为0或校验不过，重放时会被截掉
+    char *header = active->base + active->size;
+    char *body = header + kHeaderLen;
+    body[0] = type;
+    memcpy(body + 1, data, len);
+    uint32_t crc = crc32Update(0, body, len + 1);
+    writeU32(header + 4, crc);
+    writeU32(header, static_cast<uint32_t>(len + 1));
+
+    location->seq = active->seq;
+    location->offset = static_cast<uint32_t>(active->size);
+    location->length = static_cast<uint32_t>(recordLen);
+    active->size += recordLen;
+    return true;
+}
+
+void LogSessionStorage::dropLocation(const Location &location){
+    Segment *segment = findSegment(location.seq);
+    if(segment){
+        segment->liveBytes -= std::min<size_t>(segment->liveBytes, location.length);
+    }
+}
+
+void LogSessionStorage::save(std::shared_ptr<Session> session){
+    // 在锁外完成编码，持锁期间只做memcpy和索引更新
+    std::string &buf = t_encodeBuffer;
+    buf.clear();
+    SessionCodec::encode(*session, &buf);
+    TimePoint expiry = session->getExpiryTime();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Location location;
+    if(!appendRecord(kPut, buf.data(), buf.size(), &location)){
+        LOG_ERROR << "Failed to persist session " << session->getId();
+        return;
+    }
+    location.expiry = expiry;
+    segments_.back().liveBytes += location.length;
+
+    auto it = index_.find(session->getId());
+    if(it != index_.end()){
+        dropLocation(it->second);
+        it->second = location;
+    }
+    else{
+        index_.emplace(session->getId(), location);
+        expiryHeap_.emplace(expiry, session->getId());
+    }
+}
+
+std::shared_ptr<Session> LogSessionStorage::load(const std::string &sessionId){
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(sessionId);
+    if(it == index_.end()){
+        return nullptr;
+    }
+    Segment *segment = findSegment(it->second.seq);
+    if(!segment){
+        return nullptr;
+    }
+    // 直接从映射的内存中解码，跳过记录头和类型字节；过期的会话decode会返回nullptr
+    const char *body = segment->base + it->second.offset + kHeaderLen + 1;
+    return SessionCodec::decode(body, it->second.length - kHeaderLen - 1);
+}
+
+void LogSessionStorage::remove(const std::string &sessionId){
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(sessionId);
+    if(it == index_.end()){
+        return;
+    }
+    // 写一条删除记录，保证重启后不会复活
+    Location tombstone;
+    appendRecord(kDel, sessionId.data(), sessionId.size(), &tombstone);
+    dropLocation(it->second);
+    index_.erase(it);
+}
+
+size_t LogSessionStorage::evictExpired(size_t budget){
+    size_t evicted = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::system_clock::now();
+        while(!expiryHeap_.empty() && budget > 0 && expiryHeap_.top().first <= now){
+            --budget;
+            std::string sessionId = expiryHeap_.top().second;
+            expiryHeap_.pop();
+
+            auto it = index_.find(sessionId);
+            if(it == index_.end()){
+                continue;
+            }
+            if(it->second.expiry <= now){
+                // 过期时间就在记录里，重放时会自动跳过，不需要写删除记录
+                dropLocation(it->second);
+                index_.erase(it);
+                ++evicted;
+            }
+            else{
+                expiryHeap_.emplace(it->second.expiry, std::move(sessionId));
+            }
+        }
+    }
+    if(evicted > 0){
+        compactCond_.notify_one();
+    }
+    sync();
+    return evicted;
+}
+
+void LogSessionStorage::sync(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Segment &active = segments_.back();
+    ::msync(active.base, active.size, MS_ASYNC);
+}
+
+size_t LogSessionStorage::size() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size();
+}
+
+bool LogSessionStorage::shouldCompact() const{
+    // 只压缩已封存的段；按所有封存段整体的有效比例判断，
+    // 这样即使最老的段大部分有效，也会被“搬”到后面，为后面的段腾出压缩机会
+    if(segments_.size() < 2){
+        return false;
+    }
+    size_t live = 0, total = 0;
+    for(size_t i = 0; i + 1 < segments_.size(); ++i){
+        live += segments_[i].liveBytes;
+        total += segments_[i].size;
+    }
+    return total > 0 && static_cast<double>(live) < compactThreshold_ * static_cast<double>(total);
+}
+
+bool LogSessionStorage::compactStep(size_t batch, bool *failed){
+    std::lock_guard<std::mutex> lock(mutex_);
+    *failed = false;
+    // 正在压缩中的段要做完，新段开始前才判断阈值
+    if(compactCursor_ == 0 && !shouldCompact()){
+        return false;
+    }
+
+    Segment &oldest = segments_.front();
+    auto now = std::chrono::system_clock::now();
+    size_t offset = compactCursor_;
+    for(size_t n = 0; n < batch && offset + kHeaderLen <= oldest.size; ++n){
+        const char *header = oldest.base + offset;
+        uint32_t len = readU32(header);
+        const char *body = header + kHeaderLen;
+        uint32_t recordLen = static_cast<uint32_t>(kHeaderLen + len);
+
+        std::string sessionId;
+        TimePoint expiry;
+        if(body[0] == kPut && SessionCodec::peek(body + 1, len - 1, &sessionId, &expiry)){
+            auto it = index_.find(sessionId);
+            // 索引仍指向这条记录才是有效数据
+            if(it != index_.end() && it->second.seq == oldest.seq && it->second.offset == offset){
+                if(it->second.expiry <= now){
+                    index_.erase(it);
+                }
+                else{
+                    Location location;
+                    if(!appendRecord(kPut, body + 1, len - 1, &location)){
+                        // 磁盘空间不足等，游标停在这条记录上，过一个周期再试
+                        compactCursor_ = offset;
+                        *failed = true;
+                        return false;
+                    }
+                    location.expiry = it->second.expiry;
+                    segments_.back().liveBytes += location.length;
+                    it->second = location;
+                }
+                oldest.liveBytes -= std::min<size_t>(oldest.liveBytes, recordLen);
+            }
+        }
+        // 删除记录直接丢弃：比它更老的段都已经压缩掉了
+        offset += recordLen;
+    }
+
+    if(offset >= oldest.size){
+        LOG_INFO << "Compacted session log segment " << oldest.path;
+        closeSegment(oldest, true);
+        segments_.pop_front();
+        compactCursor_ = 0;
+    }
+    else{
+        compactCursor_ = offset;
+    }
+    return true;
+}
+
+void LogSessionStorage::compactThreadFunc(){
+    bool failed = false;
+    while(running_){
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if(failed){
+                // 上一步失败时压缩条件仍然成立，按条件等待会立即返回而空转，等满一个周期
+                compactCond_.wait_for(lock, std::chrono::seconds(1), [this](){return !running_;});
+            }
+            else{
+                compactCond_.wait_for(lock, std::chrono::seconds(1), [this](){
+                    return !running_ || shouldCompact() || compactCursor_ != 0;
+                });
+            }
+        }
+        // 每一步只持锁处理一小批记录，请求线程可以在两步之间插进来
+        while(running_ && compactStep(256, &failed)){
+        }
+    }
+}
+
+}
+}
@@ -0,0 +1,740 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+
+#include "../../include/session/RespSessionStorage.h"
+#include <muduo/base/Logging.h>
+#include <muduo/net/Buffer.h>
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+
+namespace http{
+namespace session{
+
+namespace{
+
+std::atomic<uint64_t> g_nextInstanceId{1};
+
+struct RespReply{
+    char type = 0;          // '+' '-' ':' '$' '*'
+    bool null = false;      // $-1 / *-1
+    std::string str;        // 简单字符串、错误信息或bulk string内容
+};
+
+// 解析一条完整的回复，返回消耗的字节数；数据不完整返回0，协议错误返回-1
+// 只有顶层的内容会被保存，数组元素只跳过（会话存储用不到数组回复）
+long parseReply(const char *begin, const char *end, RespReply *reply){
+    if(begin == end){
+        return 0;
+    }
+    const char *crlf = nullptr;
+    for(const char *p = begin + 1; p + 1 < end; ++p){
+        if(p[0] == '\r' && p[1] == '\n'){
+            crlf = p;
+            break;
+        }
+    }
+    if(!crlf){
+        return 0;
+    }
+    const char *line = begin + 1;
+    const char *next = crlf + 2;
+    if(reply){
+        reply->type = *begin;
+        reply->null = false;
+        reply->str.clear();
+    }
+
+    switch(*begin){
+        case '+':
+        case '-':
+        case ':':
+            if(reply){
+                reply->str.assign(line, crlf);
+            }
+            return next - begin;
+        case '$':{
+            long len = strtol(line, nullptr, 10);
+            if(len < 0){
+                if(reply){
+                    reply->null = true;
+                }
+                return next - begin;
+            }
+            if(end - next < len + 2){
+                return 0;
+            }
+            if(reply){
+                reply->str.assign(next, len);
+            }
+            return next + len + 2 - begin;
+        }
+        case '*':{
+            long count = strtol(line, nullptr, 10);
+            if(count < 0){
+                if(reply){
+                    reply->null = true;
+                }
+                return next - begin;
+            }
+            const char *p = next;
+            for(long i = 0; i < count; ++i){
+                long n = parseReply(p, end, nullptr);
+                if(n <= 0){
+                    return n;
+                }
+                p += n;
+            }
+            return p - begin;
+        }
+        default:
+            return -1;
+    }
+}
+
+// 连接失败后的退避：从kMinBackoffMs开始每次翻倍，最长kMaxBackoffMs；退避期间的命令直接失败，不阻塞IO线程
+const int kMinBackoffMs = 100;
+const int kMaxBackoffMs = 5000;
+
+}  // namespace
+
+// 一条到RESP服务器的非阻塞连接，只在创建它的IO线程中使用
+// 在IO线程的EventLoop上登记一个Channel：可读时消费回复（包括只写命令的回复），
+// 发送缓冲区没写完时关注可写，由事件驱动把剩下的命令写出去；
+// 带回调的回复（预取的GET）在可读事件中收齐后回调，IO线程不为它们等待
+class RespConnection{
+public:
+    // 回复到达时调用，连接失败或超时时reply为空
+    using ReplyCallback = std::function<void(const RespReply *reply)>;
+
+    explicit RespConnection(const RespConfig &config)
+        : config_(config)
+        , loop_(muduo::net::EventLoop::getEventLoopOfCurrentThread())
+        , fd_(-1)
+        , connecting_(false)
+        , sent_(0)
+        , received_(0)
+        , flushScheduled_(false)
+        , completionScheduled_(false)
+        , timerArmed_(false)
+        , backoffMs_(0)
+    {
+    }
+
+    ~RespConnection(){
+        if(muduo::net::EventLoop::getEventLoopOfCurrentThread() != loop_){
+            // 随线程本地变量在线程退出时析构，EventLoop已经不在了，Channel不能再访问它
+            channel_.release();
+        }
+        else if(timerArmed_){
+            loop_->cancel(timerId_);
+        }
+        // 还在等待的回调不再调用
+        kept_.clear();
+        close();
+    }
+
+    // 追加一条命令，返回它的序号（第几条等待回复的命令）
+    uint64_t appendCommand(std::initializer_list<std::pair<const char *, size_t>> args){
+        char head[32];
+        int n = snprintf(head, sizeof(head), "*%zu\r\n", args.size());
+        output_.append(head, n);
+        for(const auto &arg : args){
+            n = snprintf(head, sizeof(head), "$%zu\r\n", arg.second);
+            output_.append(head, n);
+            output_.append(arg.first, arg.second);
+            output_.append("\r\n", 2);
+        }
+        return sent_++;
+    }
+
+    // 保留序号为seq的回复：没有cb时之后由waitFor()取走；有cb时收到后在IO线程中回调，最多等待timeoutMs
+    void expectReply(uint64_t seq, const ReplyCallback &cb = ReplyCallback()){
+        KeptReply &kept = kept_[seq];
+        kept.callback = cb;
+        if(cb){
+            kept.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.timeoutMs);
+            if(!timerArmed_){
+                armTimer(config_.timeoutMs);
+            }
+        }
+    }
+
+    // 尽量把发送缓冲区写出去，并顺带读走已经到达的回复，不阻塞
+    void flush(){
+        flushScheduled_ = false;
+        if(!ensureConnected(false)){
+            if(fd_ < 0){
+                dropPending();
+            }
+            // 正在连接：命令留在缓冲区中，连接建立后由可写事件发出
+            return;
+        }
+        if(!writeSome() || !readSome()){
+            fail();
+            return;
+        }
+        updateWriteInterest();
+    }
+
+    // 发送所有排队的命令，并等待序号为seq的回复，放弃时不留下seq的记录
+    // 只用于没能预取的读取（比如HTTP/2的请求），会阻塞IO线程最多timeoutMs；
+    // 服务端不可用时在退避期内立即返回false
+    bool waitFor(uint64_t seq, RespReply *reply){
+        expectReply(seq);
+        bool ok = waitReply(seq);
+        auto it = kept_.find(seq);
+        ok = ok && it != kept_.end() && it->second.done;
+        if(ok){
+            *reply = std::move(it->second.reply);
+        }
+        if(it != kept_.end()){
+            kept_.erase(it);
+        }
+        return ok;
+    }
+
+    bool flushScheduled() const {return flushScheduled_;}
+    void setFlushScheduled() {flushScheduled_ = true;}
+
+private:
+    struct KeptReply{
+        bool done = false;
+        RespReply reply;
+        ReplyCallback callback;
+        std::chrono::steady_clock::time_point deadline;     // 只对带回调的回复有效
+    };
+
+    // 收齐、等待回调的回复；reply为空表示失败
+    struct Completion{
+        ReplyCallback callback;
+        bool ok;
+        RespReply reply;
+    };
+
+    bool waitReply(uint64_t seq){
+        if(received_ <= seq && !ensureConnected(true)){
+            dropPending();
+            return false;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.timeoutMs);
+        while(received_ <= seq){
+            if(!writeSome() || !readSome()){
+                fail();
+                return false;
+            }
+            if(received_ > seq){
+                break;
+            }
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                deadline - std::chrono::steady_clock::now()).count();
+            if(remaining <= 0){
+                LOG_ERROR << "RESP request timed out";
+                fail();
+                return false;
+            }
+            struct pollfd pfd;
+            pfd.fd = fd_;
+            pfd.events = POLLIN | (output_.readableBytes() > 0 ? POLLOUT : 0);
+            if(::poll(&pfd, 1, static_cast<int>(remaining)) < 0 && errno != EINTR){
+                fail();
+                return false;
+            }
+        }
+        updateWriteInterest();
+        return true;
+    }
+
+    // 回调推迟到本轮事件循环末尾执行：回调中会继续处理请求、追加命令，不能在解析回复的过程中进行
+    void complete(ReplyCallback callback, RespReply *reply){
+        completed_.push_back(Completion{std::move(callback), reply != nullptr, reply ? std::move(*reply) : RespReply()});
+        if(!completionScheduled_ && loop_){
+            completionScheduled_ = true;
+            loop_->queueInLoop([this](){
+                runCompletions();
+            });
+        }
+    }
+
+    void runCompletions(){
+        completionScheduled_ = false;
+        std::vector<Completion> completed;
+        completed.swap(completed_);
+        for(Completion &completion : completed){
+            completion.callback(completion.ok ? &completion.reply : nullptr);
+        }
+    }
+
+    void armTimer(int delayMs){
+        timerArmed_ = true;
+        timerId_ = loop_->runAfter(std::max(delayMs, 1) / 1000.0, std::bind(&RespConnection::onTimer, this));
+    }
+
+    // 带回调的回复超过期限还没到，按连接失败处理：回复按顺序到达，后面的也不会按时到
+    void onTimer(){
+        timerArmed_ = false;
+        auto now = std::chrono::steady_clock::now();
+        bool pending = false;
+        std::chrono::steady_clock::time_point earliest;
+        for(const auto &entry : kept_){
+            if(!entry.second.callback){
+                continue;
+            }
+            if(entry.second.deadline <= now){
+                LOG_ERROR << "RESP request timed out";
+                fail();
+                return;
+            }
+            if(!pending || entry.second.deadline < earliest){
+                earliest = entry.second.deadline;
+            }
+            pending = true;
+        }
+        if(pending){
+            armTimer(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(earliest - now).count()) + 1);
+        }
+    }
+
+    // 返回连接是否可用；wait为true时最多等待timeoutMs完成正在进行的连接，
+    // 否则在IO线程中交给可写事件完成，不等待
+    bool ensureConnected(bool wait){
+        if(fd_ >= 0 && !connecting_){
+            return true;
+        }
+        if(fd_ < 0){
+            if(std::chrono::steady_clock::now() < retryAt_){
+                return false;
+            }
+            if(!startConnect()){
+                fail();
+                return false;
+            }
+            if(!connecting_){
+                return true;
+            }
+        }
+        if(!wait && loop_){
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        if(::poll(&pfd, 1, wait ? config_.timeoutMs : 0) != 1){
+            if(wait){
+                LOG_ERROR << "Timed out connecting to RESP server " << config_.host << ":" << config_.port;
+                fail();
+            }
+            return false;
+        }
+        return finishConnect();
+    }
+
+    bool startConnect(){
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config_.port);
+        if(::inet_pton(AF_INET, config_.host.c_str(), &addr.sin_addr) != 1){
+            LOG_ERROR << "Invalid RESP server address " << config_.host;
+            return false;
+        }
+
+        fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if(fd_ < 0){
+            LOG_SYSERR << "socket";
+            return false;
+        }
+        int one = 1;
+        ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if(::connect(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0){
+            if(errno != EINPROGRESS){
+                LOG_SYSERR << "Failed to connect to RESP server " << config_.host << ":" << config_.port;
+                return false;
+            }
+            connecting_ = true;
+        }
+        if(loop_){
+            channel_.reset(new muduo::net::Channel(loop_, fd_));
+            channel_->setReadCallback(std::bind(&RespConnection::onReadable, this));
+            channel_->setWriteCallback(std::bind(&RespConnection::onWritable, this));
+            channel_->enableReading();
+            updateWriteInterest();
+        }
+        if(!connecting_){
+            backoffMs_ = 0;
+        }
+        return true;
+    }
+
+    bool finishConnect(){
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if(::getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0){
+            LOG_ERROR << "Failed to connect to RESP server " << config_.host << ":" << config_.port
+                      << ": " << strerror(err);
+            fail();
+            return false;
+        }
+        connecting_ = false;
+        backoffMs_ = 0;
+        updateWriteInterest();
+        return true;
+    }
+
+    void onReadable(){
+        if(connecting_ || !readSome()){
+            if(!connecting_){
+                fail();
+            }
+            return;
+        }
+    }
+
+    void onWritable(){
+        if(connecting_ && !finishConnect()){
+            return;
+        }
+        if(!writeSome()){
+            fail();
+            return;
+        }
+        updateWriteInterest();
+    }
+
+    // 连接中或者还有没写完的命令时关注可写
+    void updateWriteInterest(){
+        if(!channel_){
+            return;
+        }
+        bool want = connecting_ || output_.readableBytes() > 0;
+        if(want && !channel_->isWriting()){
+            channel_->enableWriting();
+        }
+        else if(!want && channel_->isWriting()){
+            channel_->disableWriting();
+        }
+    }
+
+    // 连接出错：关闭并进入退避，退避期内的命令直接失败
+    void fail(){
+        close();
+        backoffMs_ = backoffMs_ == 0 ? kMinBackoffMs : std::min(backoffMs_ * 2, kMaxBackoffMs);
+        retryAt_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoffMs_);
+        LOG_ERROR << "RESP connection to " << config_.host << ":" << config_.port
+                  << " failed, retrying in " << backoffMs_ << "ms";
+    }
+
+    void close(){
+        if(channel_){
+            // 可能是在这个Channel自己的回调中，Channel对象和fd推迟到回调返回后再释放
+            std::shared_ptr<muduo::net::Channel> channel(std::move(channel_));
+            channel->disableAll();
+            channel->remove();
+            int fd = fd_;
+            loop_->queueInLoop([channel, fd](){
+                ::close(fd);
+            });
+        }
+        else if(fd_ >= 0){
+            ::close(fd_);
+        }
+        fd_ = -1;
+        connecting_ = false;
+        dropPending();
+    }
+
+    // 连接断开时，已发出和未发出的命令都作废，等待回调的回复以失败回调
+    void dropPending(){
+        output_.retrieveAll();
+        input_.retrieveAll();
+        received_ = sent_;
+        for(auto &entry : kept_){
+            if(entry.second.callback){
+                complete(std::move(entry.second.callback), nullptr);
+            }
+        }
+        kept_.clear();
+    }
+
+    bool writeSome(){
+        while(output_.readableBytes() > 0){
+            ssize_t n = ::write(fd_, output_.peek(), output_.readableBytes());
+            if(n > 0){
+                output_.retrieve(n);
+            }
+            else if(n < 0 && errno == EINTR){
+                continue;
+            }
+            else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                return true;  // 发送缓冲区满了，可写时再写
+            }
+            else{
+                LOG_SYSERR << "RESP write failed";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 读取并解析所有已到达的回复，保留expectReply()登记过的
+    bool readSome(){
+        char extra[65536];
+        while(true){
+            ssize_t n = ::read(fd_, extra, sizeof(extra));
+            if(n > 0){
+                input_.append(extra, n);
+                continue;
+            }
+            if(n == 0){
+                LOG_ERROR << "RESP server closed the connection";
+                return false;
+            }
+            if(errno == EINTR){
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            LOG_SYSERR << "RESP read failed";
+            return false;
+        }
+
+        RespReply scratch;
+        while(input_.readableBytes() > 0){
+            auto kept = kept_.find(received_);
+            RespReply *target = kept != kept_.end() ? &kept->second.reply : &scratch;
+            long n = parseReply(input_.peek(), input_.peek() + input_.readableBytes(), target);
+            if(n == 0){
+                break;
+            }
+            if(n < 0){
+                LOG_ERROR << "RESP protocol error";
+                return false;
+            }
+            if(target->type == '-'){
+                LOG_ERROR << "RESP error reply: " << target->str;
+            }
+            if(kept != kept_.end()){
+                if(kept->second.callback){
+                    complete(std::move(kept->second.callback), &kept->second.reply);
+                    kept_.erase(kept);
+                }
+                else{
+                    kept->second.done = true;
+                }
+            }
+            input_.retrieve(n);
+            ++received_;
+        }
+        return true;
+    }
+
+private:
+    RespConfig config_;
+    muduo::net::EventLoop *loop_;   // 创建连接的IO线程的EventLoop，不在IO线程中时为空（不登记Channel）
+    int fd_;
+    bool connecting_;
+    std::unique_ptr<muduo::net::Channel> channel_;
+    muduo::net::Buffer output_;
+    muduo::net::Buffer input_;
+    uint64_t sent_;         // 已排队的命令数
+    uint64_t received_;     // 已收到的回复数
+    bool flushScheduled_;   // 本轮事件循环是否已经安排过发送
+    // 需要保留的回复：load()等待的和预取的GET，其它回复解析后直接丢弃
+    std::unordered_map<uint64_t, KeptReply> kept_;
+    std::vector<Completion> completed_;
+    bool completionScheduled_;
+    // 检查带回调的回复是否超时，有这样的回复时才启动
+    bool timerArmed_;
+    muduo::net::TimerId timerId_;
+    int backoffMs_;
+    std::chrono::steady_clock::time_point retryAt_;
+};
+
+namespace{
+
+// 一次预取：同一个会话的多个请求共用一个GET，结果到达后依次处理这些请求
+struct Prefetch{
+    bool done = false;
+    bool found = false;
+    std::string value;
+    std::vector<std::function<void()>> waiters;
+};
+
+// 当前线程上一个存储实例的连接，以及还没有完成的预取
+struct RespPool{
+    std::vector<std::unique_ptr<RespConnection>> connections;
+    std::unordered_map<std::string, Prefetch> prefetched;
+};
+
+// 当前线程上每个存储实例的连接池
+thread_local std::unordered_map<uint64_t, RespPool> t_pools;
+
+// 预取的GET有了结果：在回调中处理等待的请求，它们的load()直接取结果，处理完后丢弃
+void onPrefetched(uint64_t instanceId, const std::string &sessionId, const RespReply *reply){
+    auto pool = t_pools.find(instanceId);
+    if(pool == t_pools.end()){
+        return;  // 存储实例已经销毁
+    }
+    auto it = pool->second.prefetched.find(sessionId);
+    if(it == pool->second.prefetched.end()){
+        return;
+    }
+    Prefetch &prefetch = it->second;
+    prefetch.done = true;
+    prefetch.found = reply && reply->type == '$' && !reply->null;
+    if(prefetch.found){
+        prefetch.value = reply->str;
+    }
+    std::vector<std::function<void()>> waiters;
+    waiters.swap(prefetch.waiters);
+    for(const auto &waiter : waiters){
+        waiter();
+    }
+    // 回调中可能销毁了存储实例，重新查找
+    pool = t_pools.find(instanceId);
+    if(pool != t_pools.end()){
+        pool->second.prefetched.erase(sessionId);
+    }
+}
+
+}  // namespace
+
+RespSessionStorage::RespSessionStorage(const RespConfig &config)
+    : config_(config)
+    , instanceId_(g_nextInstanceId.fetch_add(1))
+{
+    if(config_.connectionsPerLoop < 1){
+        config_.connectionsPerLoop = 1;
+    }
+}
+
+RespSessionStorage::~RespSessionStorage(){
+    // 只能释放当前线程的连接；其它IO线程的连接在线程退出时随thread_local一起释放
+    t_pools.erase(instanceId_);
+}
+
+RespConnection *RespSessionStorage::connectionFor(const std::string &sessionId){
+    auto &pool = t_pools[instanceId_].connections;
+    if(pool.empty()){
+        for(int i = 0; i < config_.connectionsPerLoop; ++i){
+            pool.push_back(std::make_unique<RespConnection>(config_));
+        }
+    }
+    return pool[std::hash<std::string>{}(sessionId) % pool.size()].get();
+}
+
+void RespSessionStorage::scheduleFlush(RespConnection *conn){
+    if(conn->flushScheduled()){
+        return;  // 本轮已安排，新命令会跟着一起发出
+    }
+    muduo::net::EventLoop *loop = muduo::net::EventLoop::getEventLoopOfCurrentThread();
+    if(!loop){
+        // 不在IO线程中（比如启动阶段），直接发送
+        conn->flush();
+        return;
+    }
+    conn->setFlushScheduled();
+    // 连接对象是线程本地的，和IO线程同生命周期，可以安全地捕获裸指针
+    loop->queueInLoop([conn](){
+        conn->flush();
+    });
+}
+
+long long RespSessionStorage::ttlSeconds(const Session &session){
+    auto ttl = std::chrono::duration_cast<std::chrono::seconds>(
+                    session.getExpiryTime() - std::chrono::system_clock::now()).count();
+    return ttl > 0 ? ttl : 1;
+}
+
+void RespSessionStorage::save(std::shared_ptr<Session> session){
+    std::string key = config_.keyPrefix + session->getId();
+    std::string value;
+    SessionCodec::encode(*session, &value);
+    char ttl[24];
+    int ttlLen = snprintf(ttl, sizeof(ttl), "%lld", ttlSeconds(*session));
+
+    RespConnection *conn = connectionFor(session->getId());
+    conn->appendCommand({{"SET", 3}, {key.data(), key.size()}, {value.data(), value.size()},
+                         {"EX", 2}, {ttl, static_cast<size_t>(ttlLen)}});
+    scheduleFlush(conn);
+}
+
+bool RespSessionStorage::prefetch(const std::string &sessionId, const std::function<void()> &ready){
+    if(!muduo::net::EventLoop::getEventLoopOfCurrentThread()){
+        return false;
+    }
+    auto &prefetched = t_pools[instanceId_].prefetched;
+    auto it = prefetched.find(sessionId);
+    if(it != prefetched.end()){
+        if(it->second.done){
+            return false;  // 正在处理这个会话的预取结果，load()直接可以取到
+        }
+        it->second.waiters.push_back(ready);
+        return true;
+    }
+    std::string key = config_.keyPrefix + sessionId;
+    RespConnection *conn = connectionFor(sessionId);
+    uint64_t seq = conn->appendCommand({{"GET", 3}, {key.data(), key.size()}});
+    prefetched[sessionId].waiters.push_back(ready);
+    uint64_t instanceId = instanceId_;
+    conn->expectReply(seq, [instanceId, sessionId](const RespReply *reply){
+        onPrefetched(instanceId, sessionId, reply);
+    });
+    scheduleFlush(conn);
+    return true;
+}
+
+std::shared_ptr<Session> RespSessionStorage::load(const std::string &sessionId){
+    auto &pool = t_pools[instanceId_];
+    auto prefetched = pool.prefetched.find(sessionId);
+    if(prefetched != pool.prefetched.end() && prefetched->second.done){
+        if(!prefetched->second.found){
+            return nullptr;
+        }
+        return SessionCodec::decode(prefetched->second.value.data(), prefetched->second.value.size());
+    }
+
+    std::string key = config_.keyPrefix + sessionId;
+    RespConnection *conn = connectionFor(sessionId);
+    uint64_t seq = conn->appendCommand({{"GET", 3}, {key.data(), key.size()}});
+    RespReply reply;
+    if(!conn->waitFor(seq, &reply) || reply.type != '$' || reply.null){
+        return nullptr;
+    }
+    return SessionCodec::decode(reply.str.data(), reply.str.size());
+}
+
+void RespSessionStorage::remove(const std::string &sessionId){
+    std::string key = config_.keyPrefix + sessionId;
+    RespConnection *conn = connectionFor(sessionId);
+    conn->appendCommand({{"DEL", 3}, {key.data(), key.size()}});
+    scheduleFlush(conn);
+}
+
+void RespSessionStorage::touch(std::shared_ptr<Session> session){
+    std::string key = config_.keyPrefix + session->getId();
+    char ttl[24];
+    int ttlLen = snprintf(ttl, sizeof(ttl), "%lld", ttlSeconds(*session));
+
+    RespConnection *conn = connectionFor(session->getId());
+    conn->appendCommand({{"EXPIRE", 6}, {key.data(), key.size()}, {ttl, static_cast<size_t>(ttlLen)}});
+    scheduleFlush(conn);
+}
+
+}
+}
@@ -7,39 +7,106 @@ namespace session{
 Session::Session(const std::string &sessionId, SessionManager *sessionManager, int maxAge = 3600)
     : sessionId_(sessionId)
     , maxAge_(maxAge)
+    // 新建的会话还没有写入过存储，初始即为脏
+    , version_(1)
+    , persistedVersion_(0)
     , sessionManager_(sessionManager)
 {
     refresh();
 }
 
 bool Session::isExpired() const{
+    std::lock_guard<std::mutex> lock(mutex_);
     return std::chrono::system_clock::now() > expiryTime_;
 }
 
+std::chrono::system_clock::time_point Session::getExpiryTime() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return expiryTime_;
+}
+
 void Session::refresh(){
+    std::lock_guard<std::mutex> lock(mutex_);
     expiryTime_ = std::chrono::system_clock::now() + std::chrono::seconds(maxAge_);
 }
 
 
 void Session::setValue(const std::string &key, const std::string &value){
-    data_[key] = value;
-    // 如果设置了manager，则自动保存更改
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        data_[key] = value;
+        ++version_;
+    }
+    // 不在持有锁时回调manager，避免存储实现反过来访问本会话造成死锁
+    // 不再立即保存，只登记到本次请求的待写回列表，由请求结束时统一写回
     if(sessionManager_){
-        sessionManager_->updateSession(shared_from_this());
+        sessionManager_->scheduleFlush(shared_from_this());
     }
 }
 
 std::string Session::getValue(const std::string &key) const{
+    std::lock_guard<std::mutex> lock(mutex_);
     auto it = data_.find(key);
     return it != data_.end() ? it->second : std::string();
 }
 
 void Session::remove(const std::string &key){
-    data_.erase(key);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(data_.erase(key) > 0){
+        ++version_;
+    }
 }
 
 void Session::clear(){
-    data_.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!data_.empty()){
+        data_.clear();
+        ++version_;
+    }
+}
+
+std::unordered_map<std::string, std::string> Session::getValues() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return data_;
+}
+
+void Session::restore(std::unordered_map<std::string, std::string> data,
+                      std::chrono::system_clock::time_point expiryTime){
+    std::lock_guard<std::mutex> lock(mutex_);
+    data_ = std::move(data);
+    expiryTime_ = expiryTime;
+    persistedVersion_ = version_;
+    persistedExpiry_ = expiryTime;
+}
+
+bool Session::isDirty() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_ != persistedVersion_;
+}
+
+uint64_t Session::getVersion() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_;
+}
+
+void Session::markPersisted(uint64_t version){
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 并发写回时只允许版本前进
+    if(version > persistedVersion_){
+        persistedVersion_ = version;
+    }
+    // 整体保存时过期时间也一并写入了
+    persistedExpiry_ = expiryTime_;
+}
+
+bool Session::needsExpiryWrite() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return expiryTime_ - persistedExpiry_ >= std::chrono::seconds(maxAge_) / 4;
+}
+
+void Session::markExpiryPersisted(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    persistedExpiry_ = expiryTime_;
 }
 
 
@@ -0,0 +1,135 @@
+#include <chrono>
+
+#include "../../include/session/SessionCodec.h"
+
+namespace http{
+namespace session{
+
+namespace{
+
+const unsigned char kFormatVersion = 1;
+
+void appendVarint(std::string &out, uint64_t v){
+    while(v >= 0x80){
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+bool readVarint(const char *&p, const char *end, uint64_t *v){
+    *v = 0;
+    for(int shift = 0; shift < 64 && p < end; shift += 7){
+        unsigned char c = static_cast<unsigned char>(*p++);
+        *v |= static_cast<uint64_t>(c & 0x7f) << shift;
+        if(!(c & 0x80)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readBytes(const char *&p, const char *end, std::string *out){
+    uint64_t len;
+    if(!readVarint(p, end, &len) || len > static_cast<uint64_t>(end - p)){
+        return false;
+    }
+    out->assign(p, len);
+    p += len;
+    return true;
+}
+
+// 解析头部：版本、sessionId、过期时间，p前进到maxAge字段
+bool readHeader(const char *&p, const char *end, std::string *sessionId,
+                std::chrono::system_clock::time_point *expiryTime){
+    if(p == end || static_cast<unsigned char>(*p++) != kFormatVersion){
+        return false;
+    }
+    if(!readBytes(p, end, sessionId) || end - p < 8){
+        return false;
+    }
+    uint64_t expiry = 0;
+    for(int i = 0; i < 8; ++i){
+        expiry = (expiry << 8) | static_cast<unsigned char>(*p++);
+    }
+    *expiryTime = std::chrono::system_clock::time_point(std::chrono::seconds(static_cast<int64_t>(expiry)));
+    return true;
+}
+
+}  // namespace
+
+void SessionCodec::encode(const Session &session, std::string *out){
+    auto values = session.getValues();
+    int64_t expiry = std::chrono::duration_cast<std::chrono::seconds>(
+                        session.getExpiryTime().time_since_epoch()).count();
+
+    out->reserve(out->size() + 32 + session.getId().size() + values.size() * 16);
+    out->push_back(static_cast<char>(kFormatVersion));
+    appendVarint(*out, session.getId().size());
+    out->append(session.getId());
+    for(int shift = 56; shift >= 0; shift -= 8){
+        out->push_back(static_cast<char>((static_cast<uint64_t>(expiry) >> shift) & 0xff));
+    }
+    appendVarint(*out, static_cast<uint64_t>(session.getMaxAge()));
+    encodeValues(values, out);
+}
+
+void SessionCodec::encodeValues(const std::unordered_map<std::string, std::string> &values, std::string *out){
+    appendVarint(*out, values.size());
+    for(const auto &kv : values){
+        appendVarint(*out, kv.first.size());
+        out->append(kv.first);
+        appendVarint(*out, kv.second.size());
+        out->append(kv.second);
+    }
+}
+
+bool SessionCodec::decodeValues(const char *data, size_t len, std::unordered_map<std::string, std::string> *values){
+    const char *p = data;
+    const char *end = data + len;
+    uint64_t count;
+    if(!readVarint(p, end, &count)){
+        return false;
+    }
+    for(uint64_t i = 0; i < count; ++i){
+        std::string key, value;
+        if(!readBytes(p, end, &key) || !readBytes(p, end, &value)){
+            return false;
+        }
+        values->emplace(std::move(key), std::move(value));
+    }
+    return true;
+}
+
+std::shared_ptr<Session> SessionCodec::decode(const char *data, size_t len){
+    const char *p = data;
+    const char *end = data + len;
+
+    std::string sessionId;
+    std::chrono::system_clock::time_point expiryTime;
+    uint64_t maxAge;
+    if(!readHeader(p, end, &sessionId, &expiryTime) || !readVarint(p, end, &maxAge)){
+        return nullptr;
+    }
+    if(std::chrono::system_clock::now() > expiryTime){
+        return nullptr;  // 数据完好但已过期
+    }
+
+    std::unordered_map<std::string, std::string> values;
+    if(!decodeValues(p, end - p, &values)){
+        return nullptr;
+    }
+
+    auto session = std::make_shared<Session>(sessionId, nullptr, static_cast<int>(maxAge));
+    session->restore(std::move(values), expiryTime);
+    return session;
+}
+
+bool SessionCodec::peek(const char *data, size_t len, std::string *sessionId,
+                        std::chrono::system_clock::time_point *expiryTime){
+    const char *p = data;
+    return readHeader(p, data + len, sessionId, expiryTime);
+}
+
+}
+}
@@ -1,17 +1,98 @@
-#include <iomanip>
-#include <iosrteam>
-#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
 
 #include "../../include/session/SessionManager.h"
+#include <muduo/base/Logging.h>
 
 namespace http{
 namespace session{
 
+namespace{
+
+// 每个线程独享的随机字节池：一次从内核的CSPRNG（getrandom）取4KB，之后按需切出
+// 线程之间互不共享，不需要任何锁；取走的字节立即清零，避免之后被内存泄露读到
+class RandomBytePool{
+public:
+    RandomBytePool() : pos_(sizeof(buf_)) {}
+
+    void fill(unsigned char *out, size_t len){
+        while(len > 0){
+            if(pos_ == sizeof(buf_)){
+                refill();
+            }
+            size_t n = std::min(len, sizeof(buf_) - pos_);
+            memcpy(out, buf_ + pos_, n);
+            memset(buf_ + pos_, 0, n);
+            pos_ += n;
+            out += n;
+            len -= n;
+        }
+    }
+
+private:
+    void refill(){
+        size_t filled = 0;
+        while(filled < sizeof(buf_)){
+            ssize_t n = ::getrandom(buf_ + filled, sizeof(buf_) - filled, 0);
+            if(n > 0){
+                filled += n;
+            }
+            else if(n < 0 && errno == EINTR){
+                continue;
+            }
+            else if(n < 0 && errno == ENOSYS){
+                // 内核不支持getrandom（< 3.17），退回读/dev/urandom
+                readUrandom(buf_ + filled, sizeof(buf_) - filled);
+                break;
+            }
+            else{
+                LOG_SYSFATAL << "getrandom failed";
+            }
+        }
+        pos_ = 0;
+    }
+
+    static void readUrandom(unsigned char *out, size_t len){
+        int fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if(fd < 0){
+            LOG_SYSFATAL << "open /dev/urandom failed";
+        }
+        while(len > 0){
+            ssize_t n = ::read(fd, out, len);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                LOG_SYSFATAL << "read /dev/urandom failed";
+            }
+            out += n;
+            len -= n;
+        }
+        ::close(fd);
+    }
+
+private:
+    unsigned char buf_[4096];
+    size_t pos_;  // 下一个可用字节的位置，等于sizeof(buf_)表示已用完
+};
+
+thread_local RandomBytePool t_randomPool;
+
+const char kHexDigits[] = "0123456789abcdef";
+
+}  // namespace
+
+thread_local std::vector<std::shared_ptr<Session>> SessionManager::pendingSessions_;
+
 SessionManager::SessionManager(std::unique_ptr<SessionStorage> storage)
     // std::move(storage)：表示接收外部传入的 storage 实现权；
     : storage_(std::move(storage))
-    // rng_ 使用系统熵源初始化（通过 std::random_device），确保生成的 sessionId 随机性好，难以预测；
-    , rng_(std::random_device{}())
+    , cleanBatchSize_(1024)
 {
 }
 
@@ -38,37 +119,94 @@ std::shared_ptr<Session> SessionManager::getSession(const HttpRequest &req, Http
         session->setManager(this);
     }
 
-    session->refresh;
-    storage_->save(session);  // 这里可能有问题，需要确保正确保存会话
+    session->refresh();
+    // 不在这里保存，新会话（初始即为脏）和刷新后的过期时间都在请求结束时统一写回
+    scheduleFlush(session);
     return session;
 }
 
+void SessionManager::scheduleFlush(std::shared_ptr<Session> session){
+    // 一个请求通常只访问一两个会话，线性查重足够
+    for(const auto &pending : pendingSessions_){
+        if(pending == session){
+            return;
+        }
+    }
+    pendingSessions_.push_back(std::move(session));
+}
+
+void SessionManager::flushPendingSessions(HttpResponse *resp){
+    if(pendingSessions_.empty()){
+        return;
+    }
+    // 先换出来，防止存储实现在写回过程中再次登记
+    std::vector<std::shared_ptr<Session>> sessions;
+    sessions.swap(pendingSessions_);
+    for(const auto &session : sessions){
+        // 同一线程上可能有多个manager，只写回属于自己的会话
+        if(session->getManager() == this){
+            flushSession(session, resp);
+        }
+        else{
+            pendingSessions_.push_back(session);
+        }
+    }
+}
+
+void SessionManager::flushSession(const std::shared_ptr<Session> &session, HttpResponse *resp){
+    if(session->isDirty()){
+        // 先取版本号再保存，保存期间别的线程又修改了的话，会话仍然保持脏状态
+        uint64_t version = session->getVersion();
+        storage_->save(session);
+        session->markPersisted(version);
+    }
+    else if(session->needsExpiryWrite()){
+        storage_->touch(session);
+        session->markExpiryPersisted();
+    }
+    else{
+        return;
+    }
+
+    // 数据存放在Cookie中的存储，每次写回都要重新下发Cookie
+    std::string value;
+    if(resp && storage_->cookieValue(session, &value)){
+        setSessionCookie(value, resp);
+    }
+}
+
 void SessionManager::destroySession(const std::sting &sessionId){
     storage_->remove(sessionId);
 }
 
 void SessionManager::cleanExpiredSessions(){
-    // 注意：这个实现依赖于具体的存储实现
-    // 对于内存存储，可以在加载时检查是否过期 在MemorySessionStorage类中已经实现,这里就不用写了
-    // 对于其他存储的实现，可能需要定期清理过期会话
+    // 具体怎么清理依赖于存储实现：内存存储按过期堆增量清理，
+    // 自带TTL的外部存储默认什么都不做
+    size_t evicted = storage_->evictExpired(cleanBatchSize_);
+    if(evicted > 0){
+        LOG_DEBUG << "Evicted " << evicted << " expired sessions";
+    }
 }
 
 // 生成唯一的会话标识符，确保会话的唯一性和安全性
 // 生成一个长度为 32 的随机十六进制字符串
+// 随机字节取自线程独享的CSPRNG字节池，多线程并发创建会话时没有共享锁
 std::string SessionManager::generateSessionId(){
-    // 字符串流，像 std::cout 一样支持 << 操作；
-    std::stringstream ss;
-    // 这是 C++11 中的随机数分布器，用于生成均匀分布的随机整数；
-    // 它的意思是：每次调用 dist(...) 时，都会返回 0 到 15（含）的随机整数；这对应了十六进制的一个字符（0~f）。
-    std::uniform_int_distribution<> dist(0, 15);
-
-    // 
-    for(int i = 0; i < 32; ++i){
-        // std::hex 是格式控制符，告诉 stringstream 用十六进制格式写入；
-        // rng_ 是在构造函数中初始化的随机数引擎（Mersenne Twister 引擎）：
-        ss << std::hex <<dist(rng_);
-    }
-    return ss.str();
+    // 16字节（128位）来自CSPRNG的随机数，查表编码成32个十六进制字符
+    unsigned char bytes[kSessionIdBytes];
+    t_randomPool.fill(bytes, sizeof(bytes));
+
+    char id[kSessionIdBytes * 2];
+    for(size_t i = 0; i < kSessionIdBytes; ++i){
+        id[2 * i] = kHexDigits[bytes[i] >> 4];
+        id[2 * i + 1] = kHexDigits[bytes[i] & 0x0f];
+    }
+    return std::string(id, sizeof(id));
+}
+
+bool SessionManager::prefetchSession(const HttpRequest &req, const std::function<void()> &ready){
+    std::string sessionId = getSessionIdFromCookie(req);
+    return !sessionId.empty() && storage_->prefetch(sessionId, ready);
 }
 
 std::string SessionManager::getSessionIdFromCookie(const HttpRequest &req){
@@ -5,19 +5,48 @@
 namespace http{
 namespace session{
 
+// 把分片数向上取整为2的幂
+static size_t roundUpPowerOfTwo(size_t n){
+    size_t result = 1;
+    while(result < n){
+        result <<= 1;
+    }
+    return result;
+}
+
+MemorySessionStorage::MemorySessionStorage(size_t shardCount)
+    // std::mutex不可移动，所以分片数组一次性构造好，之后不再扩容
+    : shards_(roundUpPowerOfTwo(shardCount == 0 ? 1 : shardCount))
+    , shardMask_(shards_.size() - 1)
+    , evictCursor_(0)
+{
+}
+
 void MemorySessionStorage::save(std::shared_ptr<Session> session){
-    sessions_[session->getId()] = session;
+    Shard &shard = shardFor(session->getId());
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(session->getId());
+    if(it == shard.sessions.end()){
+        // 新会话才入堆；已有会话的过期时间变化在弹出堆顶时再处理
+        shard.expiryHeap.emplace(session->getExpiryTime(), session->getId());
+        shard.sessions.emplace(session->getId(), std::move(session));
+    }
+    else{
+        it->second = std::move(session);
+    }
 }
 
 std::shared_ptr<Session> MemorySessionStorage::load(const std::string &sessionId){
-    auto it = sessions_.find(sessionId);
-    if(it != sessions_.end()){
+    Shard &shard = shardFor(sessionId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(sessionId);
+    if(it != shard.sessions.end()){
         if(!it->second->isExpired()){
             return it->second;
         }
         else{
             // 会话过期，则从存储中移除
-            sessions_.erase(it);
+            shard.sessions.erase(it);
         }
     }
     // 会话不存在，返回nullptr
@@ -25,7 +54,61 @@ std::shared_ptr<Session> MemorySessionStorage::load(const std::string &sessionId
 }
 
 void MemorySessionStorage::remove(const std::string &sessionId){
-    sessions_.erase(sessionId);
+    Shard &shard = shardFor(sessionId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sessions.erase(sessionId);
+}
+
+size_t MemorySessionStorage::evictExpired(size_t budget){
+    size_t evicted = 0;
+    auto now = std::chrono::system_clock::now();
+    // 最多走一圈分片，budget用完就停，下次从停下的分片继续
+    for(size_t i = 0; i < shards_.size() && budget > 0; ++i){
+        Shard &shard = shards_[evictCursor_];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            evicted += evictShard(shard, now, budget);
+        }
+        evictCursor_ = (evictCursor_ + 1) & shardMask_;
+    }
+    return evicted;
+}
+
+size_t MemorySessionStorage::evictShard(Shard &shard, TimePoint now, size_t &budget){
+    size_t evicted = 0;
+    // budget按处理过的堆条目计数（包括重新入堆的），保证单次持锁时间有上界
+    while(!shard.expiryHeap.empty() && budget > 0){
+        const ExpiryEntry &top = shard.expiryHeap.top();
+        if(top.first > now){
+            break;  // 堆顶都没到期，本分片没有需要处理的
+        }
+        --budget;
+        std::string sessionId = top.second;
+        shard.expiryHeap.pop();
+
+        auto it = shard.sessions.find(sessionId);
+        if(it == shard.sessions.end()){
+            continue;  // 已经被remove或在load时清理掉了
+        }
+        if(it->second->isExpired()){
+            shard.sessions.erase(it);
+            ++evicted;
+        }
+        else{
+            // 会话在此期间被刷新过，按新的过期时间重新排队
+            shard.expiryHeap.emplace(it->second->getExpiryTime(), std::move(sessionId));
+        }
+    }
+    return evicted;
+}
+
+size_t MemorySessionStorage::size() const{
+    size_t total = 0;
+    for(const auto &shard : shards_){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.sessions.size();
+    }
+    return total;
 }
 
 }
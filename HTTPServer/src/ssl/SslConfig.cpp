@@ -13,10 +13,16 @@ SslConfig::SslConfig()
     , cipherList_("HIGH:!aNULL:!MDS")
     , verifyClient_(false)
     , verifyDepth_(4)
+    , enableKtls_(false)
+    , handshakeThreads_(0)
+    , enableHttp2_(false)
     , sessionTimeout_(300)
     // 指的是 SSL 会话缓存中最多能存储多少个会话条目。单位是“个条目”，而不是字节。
     // 启用会话缓存机制，默认缓存最多 20480 个 SSL 会话，以提升性能。
     , sessionCacheSize_(20480L)
+    , sessionTickets_(true)
+    // 票据密钥每小时轮换一次
+    , ticketKeyRotation_(3600)
 {
 }
 
@@ -1,53 +1,103 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
 #include <openssl/err.h>
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
 #include "../../include/ssl/SslConnection.h"
 
 namespace ssl{
 
-// 自定义 BIO 方法  250421看不懂
-// 本函数没被调用，可能是为后续扩展（比如非内存 BIO）预留的
-static BIOMETHOD *createCustomBioMethod(){
-    BIO_METHOD *method = BIO_meth_new(BIO_TYPE_MEM, "custom");
-    BIO_meth_set_write(method, SslConnection::bioWrite);
-    BIO_meth_set_read(method, SslConnection::bioRead);
-    BIO_meth_set_ctrl(method, SslConnection::bioCtrl);
+namespace{
+
+// 一个MSS（1460）减去TCP时间戳选项和TLS记录的头部/认证标签，保证一条记录正好装进一个TCP段，
+// 客户端收到一个段就能解密一条记录，不用等后续的段
+const size_t kSmallRecordSize = 1369;
+// 连接开始（或空闲后重新开始）发送的这么多字节使用小记录，此时TCP还在慢启动，拥塞窗口很小
+const size_t kSlowStartBytes = 64 * 1024;
+// 空闲超过这个时间，拥塞窗口会被重置，重新使用小记录
+const double kRecordSizeResetIdle = 1.0;
+
+int bioCreate(BIO *bio){
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+// 自定义 BIO 方法：读直接从muduo的输入缓冲区中取密文，写直接追加到writeBuffer_，
+// 代替两个内存BIO，省掉密文在BIO内部缓冲区中的一次拷贝
+// 全进程共用一个BIO_METHOD，第一次使用时创建（C++11保证局部静态变量的初始化是线程安全的）
+BIO_METHOD *customBioMethod(){
+    static BIO_METHOD *method = [](){
+        BIO_METHOD *m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "muduo buffer");
+        BIO_meth_set_write(m, SslConnection::bioWrite);
+        BIO_meth_set_read(m, SslConnection::bioRead);
+        BIO_meth_set_ctrl(m, SslConnection::bioCtrl);
+        BIO_meth_set_create(m, bioCreate);
+        return m;
+    }();
     return method;
 }
 
-SslConnection::SslConnection(const TcpConnectionPtr &conn, SslContext *ctx)
+}
+
+SslConnection::SslConnection(const TcpConnectionPtr &conn, SslContext *ctx, int sockfd)
     : ssl_(nullptr)
     , ctx_(ctx)
     , conn_(conn)
     , state_(SSLState::HANDSHAKE)
-    , readBio_(nullptr)
-    , writeBio_(nullptr)
+    , bio_(nullptr)
+    , inputBuffer_(nullptr)
+    , bytesSinceIdle_(0)
+    , sockfd_(-1)
+    , writeWaitFd_(-1)
+    , ktlsTx_(false)
+    , handshakeInFlight_(false)
     , messageCallback_(nullptr)
 {
     // 创建SSL实例
     ssl_ = SSL_new(ctx_->getNativeHandle());
     if(!ssl_){
-        LOG_ERROR << "Failed to create SSL object: " << ERR_error_string(Error_get_error(), nullptr);
+        LOG_ERROR << "Failed to create SSL object: " << ERR_error_string(ERR_get_error(), nullptr);
         return;
     }
 
-    // 创建两个内存BIO
-    readBio_ = BIO_new(BIO_s_mem());
-    writeBiio_ = BIO_new(BIO_s_mem());
-
-    if(!readBio_ || !writeBio_){
-        LOG_ERROR << "Failed to creadt BIO objects";
+    bio_ = BIO_new(customBioMethod());
+    if(!bio_){
+        LOG_ERROR << "Failed to create BIO object";
         SSL_free(ssl_);
         ssl_ = nullptr;
         return;
     }
-    // 设置BIO，readBio_用于接收TCP层来的密文，writeBio_用于传输加密后的数据，等待发送
-    SSL_set_bio(ssl_, readBio_, writrBio_);
+    BIO_set_data(bio_, this);
+    BIO *socketBio = nullptr;
+    if(ctx_->getConfig().getEnableKtls()){
+        // kTLS要求OpenSSL在切换到应用密钥时写的是真正的socket，握手期间写方向直接用socket BIO；
+        // 读方向仍然走自定义BIO，从muduo的输入缓冲区取数据
+        sockfd_ = sockfd;
+        if(sockfd_ >= 0){
+            socketBio = BIO_new_socket(sockfd_, BIO_NOCLOSE);
+        }
+        else{
+            LOG_WARN << "Socket of " << conn_->name() << " unknown, kTLS disabled for it";
+        }
+    }
+    if(socketBio){
+        SSL_set_bio(ssl_, bio_, socketBio);
+    }
+    else{
+        // 读写用同一个BIO，SSL_set_bio在两者相同时只接管一次引用
+        SSL_set_bio(ssl_, bio_, bio_);
+    }
     SSL_set_accept_state(ssl_); // 设置为服务器模式（等待客户端握手）
 
     // 设置SSL选项
-    SSL_set_mode(ssl_, SSL_MODE_ACCEPT_MOBING_WRITE_BUFFER);
-    SSK_set_mode(ssl_, SSL_MODE_ENABLE_PARTIAL_WRITE);
+    SSL_set_mode(ssl_, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     // 设置连接回调    
     conn_->setMessageCallback(
@@ -58,6 +108,8 @@ SslConnection::SslConnection(const TcpConnectionPtr &conn, SslContext *ctx)
 }
 
 SslConnection::~SslConnection(){
+    // 线程池中的握手任务持有shared_ptr，走到这里时已经没有任务在访问ssl_
+    stopWaitWritable();
     if(ssl_){
         SSL_free(ssl_); // 会同时释放BIO
     }
@@ -65,7 +117,20 @@ SslConnection::~SslConnection(){
 
 void SslConection::startHandshake(){
     SSL_set_accept_state(ssl_);
-    handleHandshake();
+    // 服务端要先收到ClientHello才有事可做；握手放在线程池时不为这一步单独提交任务
+    if(!ctx_->getHandshakePool()){
+        handleHandshake();
+    }
+}
+
+std::string SslConnection::alpnProtocol() const{
+    const unsigned char *protocol = nullptr;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(ssl_, &protocol, &len);
+    if(!protocol){
+        return std::string();
+    }
+    return std::string(reinterpret_cast<const char *>(protocol), len);
 }
 
 // const void* data 表示 “接受任意类型的原始内存数据”，这是为了让 send() 函数具备更强的通用性
@@ -77,61 +142,238 @@ void SslConnection::send(const void *data, size_t len){
         return;
     }
 
-    // SSL_write()会把明文写入SSL的加密层
-    int written = SSLwrite(ssl_, data, len);
-    if(written <= 0){
-        int err = SSL_get_error(ssl_, written);
-        LOG_ERROR << "SSL_write failed: " << ERROR_error_string(err, nullptr);
+    if(ktlsTx_){
+        // 内核负责切分记录和加密，明文直接交给muduo写socket
+        conn_->send(data, static_cast<int>(len));
         return;
     }
 
-    // 通过BIO_read(writeBio_) 取出加密好的密文 通过 conn_->send()发送出去
-    char buf[4096];
-    int pending;
-    // IO_pending() 是 OpenSSL 中的一个函数，用于检查 BIO 中还有多少“可读取”的字节数据。
-    while((pending = BIO_pending(writeBio_)) >0 ){
-        int bytes = BIO_read(writeBio_, buf, std::min(pending, static_cast<int>(sizeof(buf))));
-        if(bytes > 0){
-            conn_->send(buf, bytes);
+    muduo::Timestamp now = muduo::Timestamp::now();
+    if(timeDifference(now, lastSendTime_) > kRecordSizeResetIdle){
+        bytesSinceIdle_ = 0;
+    }
+    lastSendTime_ = now;
+
+    // 按记录大小切块调用SSL_write()，每次产生一条TLS记录，密文经bioWrite直接追加到writeBuffer_
+    // 慢启动阶段用小记录降低首字节延迟，之后用16KB的满记录减少记录开销和加密调用次数
+    const char *p = static_cast<const char *>(data);
+    while(len > 0){
+        size_t recordSize = bytesSinceIdle_ < kSlowStartBytes ? kSmallRecordSize : kMaxRecordPlaintext;
+        int chunk = static_cast<int>(std::min(len, recordSize));
+        int written = SSL_write(ssl_, p, chunk);
+        if(written <= 0){
+            LOG_ERROR << "SSL_write failed";
+            handleError(getLastError(written));
+            break;
         }
+        p += written;
+        len -= written;
+        bytesSinceIdle_ += written;
     }
+    // 整个响应的所有记录合并成一次send
+    flushWriteBuffer();
 }
 
 void SslConnection::onRead(const TcpConnectionPtr &conn, BufferPtr buf, muduo::Timestamp time){
-    if(state_ == SSLState::HANDSHAKE){
-        // 还在握手就把数据写到readBio_中，继续推进SSL_do_handshake()
-        BIO_write(readBio_, buf->peek(), buf->readableBytes());
-        buf->retrieve(buf->readableBytes());
-        handleHanshake();
+    if(state_ == SSLState::HANDSHAKE && ctx_->getHandshakePool()){
+        // 握手在加密线程池中进行：上一步还没完成时数据先留在连接的输入缓冲区，完成后再取
+        if(!handshakeInFlight_){
+            handshakeInput_.append(buf->peek(), buf->readableBytes());
+            buf->retrieveAll();
+            handleHandshake();
+        }
         return;
-    }else if(state_ == SSLState::ESTABLISHED){
-        // 解密数据
-        char decryptedData[4096];
-        // SSL_read()解密出明文数据，返回解密的字节数
-        int ret = SSL_read(ssl_, decryptedData, sizeof(decryptedData));
-        if(ret > 0){
-            // 创建一个新的Buffer存储解密后的数据
-            muduo::net::Buffer decryptedBuffer;
-            decryptedBuffer.append(decryptedData, ret);
+    }
 
-            // 调用用户设置的回调函数处理解密后的数据
-            if(messageCallback_){
-                messageCallback_(conn, &decryptedBuffer, time);
-            }
+    // 不管处于哪个阶段，bioRead都直接从连接的输入缓冲区中读取密文；
+    // 不完整的记录留在输入缓冲区里，等下一次数据到达时muduo会接在后面
+    inputBuffer_ = buf;
+    if(state_ == SSLState::HANDSHAKE){
+        // 还在握手就继续推进SSL_do_handshake()
+        handleHandshake();
+        // 客户端的Finished后面可能紧跟着第一个请求，握手完成后接着解密
+    }
+    if(state_ == SSLState::ESTABLISHED){
+        decryptInput(time);
+    }
+    inputBuffer_ = nullptr;
+}
+
+void SslConnection::decryptInput(muduo::Timestamp time){
+    // 一次可读事件里可能有多条TLS记录（大请求体、流水线请求），
+    // 循环SSL_read直到WANT_READ，明文直接写进常驻的decryptedBuffer_，不经过中间缓冲
+    bool peerClosed = false;
+    while(true){
+        decryptedBuffer_.ensureWritableBytes(kMaxRecordPlaintext);
+        int ret = SSL_read(ssl_, decryptedBuffer_.beginWrite(),
+                           static_cast<int>(decryptedBuffer_.writableBytes()));
+        if(ret > 0){
+            decryptedBuffer_.hasWritten(ret);
+            continue;
         }
+        int err = SSL_get_error(ssl_, ret);
+        if(err == SSL_ERROR_WANT_READ){
+            break;  // 剩下的密文不够一条完整的记录，等下一次可读
+        }
+        if(err == SSL_ERROR_ZERO_RETURN){
+            peerClosed = true;  // 对端发送了close_notify
+            break;
+        }
+        handleError(getLastError(ret));
+        return;
+    }
+    // SSL_read期间OpenSSL可能也要发数据（TLS 1.3的NewSessionTicket、KeyUpdate回应等）
+    flushWriteBuffer();
+
+    // 一次性把所有明文交给上层，没解析完的部分留在decryptedBuffer_中等待后续数据
+    if(decryptedBuffer_.readableBytes() > 0 && messageCallback_){
+        messageCallback_(conn_, &decryptedBuffer_, time);
+    }
+    if(peerClosed){
+        state_ = SSLState::SHUTDOWN;
+        conn_->shutdown();
+    }
+}
+
+void SslConnection::finishKtlsSetup(){
+    if(BIO_get_ktls_send(SSL_get_wbio(ssl_))){
+        ktlsTx_ = true;
+        LOG_DEBUG << "kTLS enabled for " << conn_->name();
+        return;
+    }
+    // 内核或密码套件不支持：写方向换回自定义BIO，之后的记录在用户态加密，经由muduo发送
+    BIO_up_ref(bio_);
+    SSL_set0_wbio(ssl_, bio_);
+    sockfd_ = -1;
+}
+
+void SslConnection::waitWritable(){
+    if(writeWaitChannel_){
+        return;
+    }
+    writeWaitFd_ = ::fcntl(sockfd_, F_DUPFD_CLOEXEC, 0);
+    if(writeWaitFd_ < 0){
+        LOG_SYSERR << "Failed to wait for " << conn_->name() << " to become writable";
+        state_ = SSLState::ERROR;
+        conn_->shutdown();
+        return;
+    }
+    writeWaitChannel_.reset(new muduo::net::Channel(conn_->getLoop(), writeWaitFd_));
+    writeWaitChannel_->setWriteCallback(std::bind(&SslConnection::onWritable, this));
+    writeWaitChannel_->enableWriting();
+}
+
+void SslConnection::onWritable(){
+    stopWaitWritable();
+    if(state_ == SSLState::HANDSHAKE && !handshakeInFlight_){
+        handleHandshake();
+    }
+}
+
+void SslConnection::stopWaitWritable(){
+    if(!writeWaitChannel_){
+        return;
+    }
+    // 可能是在这个Channel自己的回调中，Channel对象和描述符推迟到回调返回后再释放
+    std::shared_ptr<muduo::net::Channel> channel(std::move(writeWaitChannel_));
+    channel->disableAll();
+    channel->remove();
+    int fd = writeWaitFd_;
+    writeWaitFd_ = -1;
+    conn_->getLoop()->queueInLoop([channel, fd](){
+        ::close(fd);
+    });
+}
+
+void SslConnection::flushWriteBuffer(){
+    // muduo的send在输出队列为空时直接从writeBuffer_写socket，只有写不完的部分才会拷贝进输出缓冲区
+    if(writeBuffer_.readableBytes() > 0){
+        conn_->send(&writeBuffer_);
     }
 }
 
 
 void SslConnection::handleHandshake(){
+    if(muduo::ThreadPool *pool = ctx_->getHandshakePool()){
+        submitHandshake(pool);
+        return;
+    }
     // 进行SSL握手，返回1表示成功
     int ret = SSL_do_handshake(ssl_);
+    int err = SSL_ERROR_NONE;
+    unsigned long errCode = 0;
+    if(ret != 1){
+        err = SSL_get_error(ssl_, ret);
+        errCode = ERR_get_error();
+    }
+    onHandshakeStep(ret, err, errCode);
+}
+
+void SslConnection::submitHandshake(muduo::ThreadPool *pool){
+    // 私钥签名/解密等耗时的运算在线程池中完成，IO线程继续处理已建立连接上的请求
+    // 任务执行期间只有线程池线程访问ssl_、handshakeInput_和writeBuffer_
+    handshakeInFlight_ = true;
+    std::shared_ptr<SslConnection> self = shared_from_this();
+    muduo::net::EventLoop *loop = conn_->getLoop();
+    pool->run([self, loop]() mutable{
+        self->inputBuffer_ = &self->handshakeInput_;
+        int ret = SSL_do_handshake(self->ssl_);
+        int err = SSL_ERROR_NONE;
+        unsigned long errCode = 0;
+        if(ret != 1){
+            // OpenSSL的错误队列是线程局部的，必须在这个线程里取出来
+            err = SSL_get_error(self->ssl_, ret);
+            errCode = ERR_get_error();
+        }
+        self->inputBuffer_ = nullptr;
+
+        // 引用交给回到IO线程的任务，最后一个引用总在IO线程中释放，析构不会发生在线程池线程里
+        loop->queueInLoop([self = std::move(self), ret, err, errCode](){
+            // 连接已经断开时HttpContext已经放开了SslConnection，结果直接丢弃
+            if(self->conn_->connected()){
+                self->onHandshakeDone(ret, err, errCode);
+            }
+        });
+    });
+}
+
+void SslConnection::onHandshakeDone(int ret, int err, unsigned long errCode){
+    handshakeInFlight_ = false;
+    onHandshakeStep(ret, err, errCode);
+
+    // 任务执行期间到达的数据还留在连接的输入缓冲区中
+    muduo::net::Buffer *input = conn_->inputBuffer();
+    if(state_ == SSLState::HANDSHAKE){
+        if(err == SSL_ERROR_WANT_READ && input->readableBytes() > 0){
+            handshakeInput_.append(input->peek(), input->readableBytes());
+            input->retrieveAll();
+            handleHandshake();
+        }
+    }
+    else if(state_ == SSLState::ESTABLISHED){
+        // 之后改为直接从连接的输入缓冲区读：把没用完的密文按顺序放回去
+        handshakeInput_.append(input->peek(), input->readableBytes());
+        input->retrieveAll();
+        input->swap(handshakeInput_);
+        if(input->readableBytes() > 0){
+            inputBuffer_ = input;
+            decryptInput(muduo::Timestamp::now());
+            inputBuffer_ = nullptr;
+        }
+    }
+}
+
+void SslConnection::onHandshakeStep(int ret, int err, unsigned long errCode){
+    // 握手过程中产生的消息（ServerHello、证书等）都在writeBuffer_中，发给客户端
+    flushWriteBuffer();
 
     if(ret == 1){
         state_ = SSLState::ESTABLISHED;
-        LOG_INFO << "SSL handshake completed successfully";
-        LOG_INFO << "Using cipher: " << SSL_get_cipher(ssl_);
-        LOG_INFO << "Protocol version :" << SSL_get_version(ssl_);
+        if(sockfd_ >= 0){
+            finishKtlsSetup();
+        }
+        // 每个连接一次，只在DEBUG级别输出
+        LOG_DEBUG << "SSL handshake completed, " << SSL_get_version(ssl_) << " " << SSL_get_cipher(ssl_);
 
         // 握手完成后，确保设置了正确的回调
         if(!messageCallback_){
@@ -140,7 +382,12 @@ void SslConnection::handleHandshake(){
         return;
     }
 
-    int err = SSL_get_error(ssl_, ret);
+    if(err == SSL_ERROR_WANT_WRITE && sockfd_ >= 0){
+        // kTLS模式下握手消息直接写socket，发送缓冲区满时等它可写再继续
+        // （握手消息只有几KB，只有对端长时间不读时才会出现）
+        waitWritable();
+        return;
+    }
     switch(err){
         case SSL_ERROR_WANT_READ:
         case SSL_ERROR_WANT_WRITE:
@@ -149,9 +396,9 @@ void SslConnection::handleHandshake(){
         default:{
             // 获取错误信息
             char errBuf[256];
-            unsigned long errCode = ERR_get_error();
             ERR_error_string_n(errCode, errBuf, sizeof(errBuf));
             LOG_ERROR << "SSL handshake failed: " << errBuf;
+            state_ = SSLState::ERROR;
             conn_->shutdown();
             break; 
         }
@@ -208,32 +455,46 @@ int SslConnection::bioWrite(BIO *bio, const char *data, int len){
     SslConnection *conn = static_cast<SslConnection *>(BIO_get_data(bio));
     if(!conn) return -1;
 
-    conn->conn_->send(data, len);
+    // 加密后的记录直接追加到待发送的密文缓冲区
+    BIO_clear_retry_flags(bio);
+    conn->writeBuffer_.append(data, len);
     return len;
 }
 
-int SslConnection::bioRead(BIO *bio, const char *data, int len){
-    SslConection *conn = static_cast<SslConnecion *>(NIO_get_data(bio));
+int SslConnection::bioRead(BIO *bio, char *data, int len){
+    SslConnection *conn = static_cast<SslConnection *>(BIO_get_data(bio));
     if(!conn) return -1;
 
-    size_t readable = conn->readBuffer_.readableBytes();
+    BIO_clear_retry_flags(bio);
+    size_t readable = conn->inputBuffer_ ? conn->inputBuffer_->readableBytes() : 0;
     if(readable == 0){
+        // 告诉OpenSSL数据暂时读完了（SSL_ERROR_WANT_READ），而不是连接出错
+        BIO_set_retry_read(bio);
         return -1;
     }
 
     size_t toRead = std::min(static_cast<size_t>(len), readable);
-    memcpy(data, conn->readBuffer_.peek(), toRead);
-    conn->readBuffer_.retrieve(toRead);
-    return toRead;
+    memcpy(data, conn->inputBuffer_->peek(), toRead);
+    conn->inputBuffer_->retrieve(toRead);
+    return static_cast<int>(toRead);
 }
 
 long SslConnection::bioCtrl(BIO *bio, int cmd, long num, void *ptr){
     switch(cmd){
         case BIO_CTRL_FLUSH:
+            // 真正的发送由flushWriteBuffer()在一批记录写完后统一进行
             return 1;
+        case BIO_CTRL_PENDING:{
+            SslConnection *conn = static_cast<SslConnection *>(BIO_get_data(bio));
+            return conn && conn->inputBuffer_ ? static_cast<long>(conn->inputBuffer_->readableBytes()) : 0;
+        }
+        case BIO_CTRL_WPENDING:{
+            SslConnection *conn = static_cast<SslConnection *>(BIO_get_data(bio));
+            return conn ? static_cast<long>(conn->writeBuffer_.readableBytes()) : 0;
+        }
         default:
             return 0;
     }
 }
 
-}
\ No newline at end of file
+}
@@ -1,9 +1,22 @@
+#include <openssl/core_names.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <muduo/base/Logging.h>
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
 #include "../../include/ssl/SslContext.h"
 
 namespace ssl{
+
+namespace{
+// 密钥环中保留的密钥数：当前的一把加上前两个周期的，
+// 票据在签发后至少两个轮换周期内都能恢复
+const size_t kTicketKeyRingSize = 3;
+}
+
 SslContext::SslContext(const SslConfig &config)
     : ctx_(nullptr)
     , config_(config)
@@ -12,6 +25,10 @@ SslContext::SslContext(const SslConfig &config)
 
 SslContext::~SslConttext()
 {
+    // 先停掉握手线程池，保证没有任务还在使用ctx_
+    if(handshakePool_){
+        handshakePool_->stop();
+    }
     if(ctx_){
         SSL_CTX_free(ctx_);
     }
@@ -37,10 +54,20 @@ bool SslContext::initialize(){
                    SSL_OP_CIPHER_SEVER_PREFERENCE;
     SSL_CTX_set_options(ctx_, options);
 
+    // 内核TLS：OpenSSL在握手切换到应用密钥时，若写BIO是socket且内核支持，就把密钥交给内核
+    if(config_.getEnableKtls()){
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+#else
+        LOG_WARN << "kTLS requested but OpenSSL was built without it, using user-space TLS";
+#endif
+    }
+
     // 初始化流程三步骤
     
     // 加载证书和密钥
-    if(!loadCertificates()){
+    if(!loadCertificates(ctx_, config_.getCertificateFile(), config_.getPrivateKeyFile(),
+                         config_.getCertificateChainFile())){
         return false;
     }
     // 设置协议版本
@@ -49,36 +76,51 @@ bool SslContext::initialize(){
     }
     // 设置会话缓存
     setupSessionCache();
+    // 设置会话票据
+    setupSessionTickets();
+    // 设置应用层协议协商
+    setupAlpn(ctx_);
+
+    // 设置证书表和SNI回调
+    if(!reloadCertificates()){
+        return false;
+    }
+    SSL_CTX_set_tlsext_servername_callback(ctx_, &SslContext::serverNameCallback);
+    SSL_CTX_set_tlsext_servername_arg(ctx_, this);
+
+    if(config_.getHandshakeThreads() > 0){
+        handshakePool_.reset(new muduo::ThreadPool("SslHandshake"));
+        handshakePool_->start(config_.getHandshakeThreads());
+    }
 
     LOGINFO << "SSL context initialized successfully";
     return true;
 }
 
-bool SslContext::loadCertificates(){
+bool SslContext::loadCertificates(SSL_CTX *ctx, const std::string &certFile,
+                                  const std::string &keyFile, const std::string &chainFile){
     // 加载证书
-    if(SSL_CTX_use_certificate_file(ctx_, config_.getCertificateFile().c_str(),
-        SSL_FILETYPE_PEM) <= 0){
+    if(SSL_CTX_use_certificate_file(ctx, certFile.c_str(), SSL_FILETYPE_PEM) <= 0){
         handleSslError("Failed to load server certificate");
         return false;
     }
 
     // 加载服务器证书（.crt）
-    if(SSL_CTX_use_PrivateKey_file(ctx_, config_.getPrivateKeyFile().c_str(),
-        SSL_FILETYPE_PEM) <= 0){
+    if(SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) <= 0){
         handleSslError("Failed to load Private key");
         return false;
     }
 
     // 验证密钥（.key）
-    if(!SSL_CTX_check_private_key(ctx_)){
+    if(!SSL_CTX_check_private_key(ctx)){
         handleSslError("Private key does not match the certificate");
         return false;
     }
 
     // 加载证书链
-    if(!config_.getCertificateChainFile().empty()){
-        if(SSL_CTX_use_certificate_chain_file(ctx_, config_.getCertificateChainFile().c_str()) <= 0){
-            handleError("Failed to load certificate chain");
+    if(!chainFile.empty()){
+        if(SSL_CTX_use_certificate_chain_file(ctx, chainFile.c_str()) <= 0){
+            handleSslError("Failed to load certificate chain");
             return false;
         }
     }
@@ -123,6 +165,215 @@ void SslContext::setupSSessionCache(){
     SSL_CTX_set_timeout(ctx_, config_.getSessionTimeout());
 }
 
+SslContext::CertificateStore::~CertificateStore(){
+    if(defaultCtx){
+        SSL_CTX_free(defaultCtx);
+    }
+    for(auto &entry : exact){
+        SSL_CTX_free(entry.second);
+    }
+    for(auto &entry : wildcard){
+        SSL_CTX_free(entry.second);
+    }
+}
+
+SSL_CTX *SslContext::CertificateStore::select(const char *serverName) const{
+    if(!serverName){
+        return defaultCtx;
+    }
+    // 主机名不区分大小写
+    std::string host(serverName);
+    std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+    auto it = exact.find(host);
+    if(it != exact.end()){
+        return it->second;
+    }
+    // 通配符只匹配一级：a.example.com 匹配 *.example.com，a.b.example.com 不匹配
+    size_t dot = host.find('.');
+    if(dot != std::string::npos){
+        it = wildcard.find(host.substr(dot + 1));
+        if(it != wildcard.end()){
+            return it->second;
+        }
+    }
+    return defaultCtx;
+}
+
+SSL_CTX *SslContext::createCertificateContext(const std::string &certFile, const std::string &keyFile,
+                                              const std::string &chainFile){
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if(!ctx){
+        handleSslError("Failed to create SSL context");
+        return nullptr;
+    }
+    if(!loadCertificates(ctx, certFile, keyFile, chainFile)){
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+    // 切换后SSL_get_SSL_CTX返回的是这个SSL_CTX，票据回调要能从它找回SslContext
+    SSL_CTX_set_app_data(ctx, this);
+    setupAlpn(ctx);
+    return ctx;
+}
+
+bool SslContext::reloadCertificates(){
+    // 先在锁外把所有证书都加载好，任何一个失败都保留原来的证书表
+    auto store = std::make_shared<CertificateStore>();
+    store->defaultCtx = createCertificateContext(config_.getCertificateFile(),
+                                                 config_.getPrivateKeyFile(),
+                                                 config_.getCertificateChainFile());
+    if(!store->defaultCtx){
+        return false;
+    }
+    for(const auto &entry : config_.getCertificates()){
+        SSL_CTX *ctx = createCertificateContext(entry.certFile, entry.keyFile, entry.chainFile);
+        if(!ctx){
+            LOG_ERROR << "Failed to load certificate for " << entry.hostname;
+            return false;
+        }
+        std::string host = entry.hostname;
+        std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+        auto &table = host.compare(0, 2, "*.") == 0 ? store->wildcard : store->exact;
+        if(&table == &store->wildcard){
+            host.erase(0, 2);
+        }
+        auto result = table.emplace(host, ctx);
+        if(!result.second){
+            LOG_WARN << "Duplicate certificate for " << entry.hostname << ", keeping the first one";
+            SSL_CTX_free(ctx);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(certMutex_);
+    certStore_ = std::move(store);
+    return true;
+}
+
+std::shared_ptr<const SslContext::CertificateStore> SslContext::certificateStore() const{
+    std::lock_guard<std::mutex> lock(certMutex_);
+    return certStore_;
+}
+
+int SslContext::serverNameCallback(SSL *ssl, int *alert, void *arg){
+    SslContext *self = static_cast<SslContext *>(arg);
+    std::shared_ptr<const CertificateStore> store = self->certificateStore();
+    if(!store){
+        return SSL_TLSEXT_ERR_OK;
+    }
+    // SSL_set_SSL_CTX会增加新SSL_CTX的引用计数，之后证书表被替换释放也不影响这个连接
+    SSL_CTX *ctx = store->select(SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name));
+    if(ctx && ctx != SSL_get_SSL_CTX(ssl)){
+        SSL_set_SSL_CTX(ssl, ctx);
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+void SslContext::setupAlpn(SSL_CTX *ctx){
+    if(config_.getEnableHttp2()){
+        SSL_CTX_set_alpn_select_cb(ctx, &SslContext::alpnSelectCallback, this);
+    }
+}
+
+int SslContext::alpnSelectCallback(SSL *, const unsigned char **out, unsigned char *outlen,
+                                   const unsigned char *in, unsigned int inlen, void *){
+    // 按服务端的优先顺序选择：客户端支持h2就用h2
+    static const unsigned char kProtocols[] = "\x02h2\x08http/1.1";
+    unsigned char *selected = nullptr;
+    if(SSL_select_next_proto(&selected, outlen, kProtocols, sizeof(kProtocols) - 1, in, inlen)
+       != OPENSSL_NPN_NEGOTIATED){
+        // 没有共同的协议时不在ServerHello中带ALPN，按HTTP/1.1处理
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+void SslContext::setupSessionTickets(){
+    if(!config_.getSessionTickets()){
+        SSL_CTX_set_options(ctx_, SSL_OP_NO_TICKET);
+        return;
+    }
+    rotateTicketKeys();
+    // 回调中通过SSL_CTX找回SslContext
+    SSL_CTX_set_app_data(ctx_, this);
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx_, &SslContext::ticketKeyCallback);
+}
+
+void SslContext::rotateTicketKeys(){
+    TicketKey key;
+    if(RAND_bytes(key.name, sizeof(key.name)) != 1 ||
+       RAND_bytes(key.aesKey, sizeof(key.aesKey)) != 1 ||
+       RAND_bytes(key.hmacKey, sizeof(key.hmacKey)) != 1){
+        handleSslError("Failed to generate session ticket key");
+        return;     // 继续使用原来的密钥
+    }
+
+    auto ring = std::make_shared<TicketKeyRing>();
+    ring->push_back(key);
+    std::lock_guard<std::mutex> lock(ticketKeyMutex_);
+    if(ticketKeys_){
+        for(size_t i = 0; i < ticketKeys_->size() && ring->size() < kTicketKeyRingSize; ++i){
+            ring->push_back((*ticketKeys_)[i]);
+        }
+    }
+    ticketKeys_ = std::move(ring);
+}
+
+std::shared_ptr<const SslContext::TicketKeyRing> SslContext::ticketKeys() const{
+    std::lock_guard<std::mutex> lock(ticketKeyMutex_);
+    return ticketKeys_;
+}
+
+int SslContext::ticketKeyCallback(SSL *ssl, unsigned char *keyName, unsigned char *iv,
+                                  EVP_CIPHER_CTX *cipherCtx, EVP_MAC_CTX *macCtx, int enc){
+    SslContext *self = static_cast<SslContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    if(!self){
+        return -1;
+    }
+    // 拿到密钥环的快照后就不再持锁，轮换不会影响正在进行的握手
+    std::shared_ptr<const TicketKeyRing> ring = self->ticketKeys();
+    if(!ring || ring->empty()){
+        return -1;
+    }
+
+    const TicketKey *key = nullptr;
+    int result = 1;
+    if(enc){
+        // 签发票据：总是用当前密钥
+        key = &ring->front();
+        if(RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1){
+            return -1;
+        }
+        memcpy(keyName, key->name, sizeof(key->name));
+    }
+    else{
+        for(size_t i = 0; i < ring->size(); ++i){
+            if(memcmp(keyName, (*ring)[i].name, sizeof((*ring)[i].name)) == 0){
+                key = &(*ring)[i];
+                // 用旧密钥解开的票据，返回2让OpenSSL给客户端换发一张新的
+                result = (i == 0) ? 1 : 2;
+                break;
+            }
+        }
+        if(!key){
+            return 0;   // 密钥已被轮换掉，走完整握手
+        }
+    }
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                                          const_cast<unsigned char *>(key->hmacKey), sizeof(key->hmacKey)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0),
+        OSSL_PARAM_construct_end()
+    };
+    if(!EVP_MAC_CTX_set_params(macCtx, params)){
+        return -1;
+    }
+    int ok = enc ? EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key->aesKey, iv)
+                 : EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key->aesKey, iv);
+    return ok ? result : -1;
+}
+
 void SslContext::handleSslError(const char *msg){
     char buf[256];
     // ERR_error_string_n()将错误码转化为可读的字符串
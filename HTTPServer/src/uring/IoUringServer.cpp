@@ -0,0 +1,734 @@
+#include "../../include/uring/IoUringServer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+#include <muduo/base/Logging.h>
+
+namespace http{
+namespace uring{
+
+namespace{
+
+const uint64_t kIdMask = (static_cast<uint64_t>(1) << 56) - 1;
+
+// multishot accept的客户端地址拿不到，只在需要按IP限制连接数时查一次
+bool peerIp(int fd, std::string *ip){
+    struct sockaddr_storage peer;
+    socklen_t len = sizeof(peer);
+    if(::getpeername(fd, reinterpret_cast<struct sockaddr *>(&peer), &len) != 0){
+        return false;
+    }
+    char buf[INET6_ADDRSTRLEN] = "";
+    if(peer.ss_family == AF_INET){
+        ::inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in *>(&peer)->sin_addr, buf, sizeof(buf));
+    }
+    else{
+        ::inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6 *>(&peer)->sin6_addr, buf, sizeof(buf));
+    }
+    *ip = buf;
+    return true;
+}
+
+}
+
+IoUringLoop::IoUringLoop(const IoUringOptions &options, const RequestCallback &cb, size_t index)
+    : options_(options)
+    , requestCallback_(cb)
+    , index_(index)
+    , ringInitialized_(false)
+    , bufferRing_(nullptr)
+    , listenFd_(-1)
+    , wakeupFd_(-1)
+    , wakeupValue_(0)
+    , quit_(false)
+    , draining_(false)
+    , drainStarted_(false)
+    , acceptPaused_(false)
+    , nextId_(1)
+    , connectionCount_(0)
+{
+    tick_.tv_sec = 1;
+    tick_.tv_nsec = 0;
+}
+
+IoUringLoop::~IoUringLoop(){
+    for(auto &entry : connections_){
+        ::close(entry.second->fd);
+        if(options_.limiter && !entry.second->ip.empty()){
+            options_.limiter->release(entry.second->ip);
+        }
+    }
+    if(bufferRing_){
+        io_uring_free_buf_ring(&ring_, bufferRing_, kBufferCount, kBufferGroup);
+    }
+    // 退出ring时内核取消所有未完成的操作
+    if(ringInitialized_){
+        io_uring_queue_exit(&ring_);
+    }
+    if(listenFd_ >= 0){
+        ::close(listenFd_);
+    }
+    if(wakeupFd_ >= 0){
+        ::close(wakeupFd_);
+    }
+}
+
+bool IoUringLoop::init(){
+    if(index_ < options_.listenFds.size()){
+        // 接过来的监听socket已经在监听，继续使用它，accept队列中的连接不会丢失
+        listenFd_ = ::fcntl(options_.listenFds[index_], F_DUPFD_CLOEXEC, 0);
+        if(listenFd_ < 0){
+            LOG_ERROR << "io_uring inherited listener: " << strerror(errno);
+            return false;
+        }
+    }
+    else{
+        listenFd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(listenFd_ < 0){
+            LOG_ERROR << "io_uring listener socket: " << strerror(errno);
+            return false;
+        }
+        int on = 1;
+        ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(options_.port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if(::bind(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+           ::listen(listenFd_, SOMAXCONN) != 0){
+            LOG_ERROR << "io_uring listener on port " << options_.port << ": " << strerror(errno);
+            return false;
+        }
+    }
+    wakeupFd_ = ::eventfd(0, EFD_CLOEXEC);
+    if(wakeupFd_ < 0){
+        LOG_ERROR << "eventfd: " << strerror(errno);
+        return false;
+    }
+
+    // 只有本线程提交；完成处理推迟到本线程等待时批量进行，不打断正在处理请求的线程
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    int ret = io_uring_queue_init_params(kQueueDepth, &ring_, &params);
+    if(ret == -EINVAL){
+        // 6.1之前的内核不支持这两个标志
+        memset(&params, 0, sizeof(params));
+        ret = io_uring_queue_init_params(kQueueDepth, &ring_, &params);
+    }
+    if(ret < 0){
+        LOG_ERROR << "io_uring_queue_init: " << strerror(-ret);
+        return false;
+    }
+    ringInitialized_ = true;
+
+    bufferMemory_.resize(kBufferCount * kBufferSize);
+    bufferRing_ = io_uring_setup_buf_ring(&ring_, kBufferCount, kBufferGroup, 0, &ret);
+    if(!bufferRing_){
+        LOG_ERROR << "io_uring_setup_buf_ring: " << strerror(-ret);
+        return false;
+    }
+    for(unsigned i = 0; i < kBufferCount; ++i){
+        io_uring_buf_ring_add(bufferRing_, &bufferMemory_[i * kBufferSize], kBufferSize, static_cast<unsigned short>(i),
+                              io_uring_buf_ring_mask(kBufferCount), static_cast<int>(i));
+    }
+    io_uring_buf_ring_advance(bufferRing_, kBufferCount);
+
+    if(!probeMultishotRecv()){
+        LOG_WARN << "io_uring multishot recv is not supported by this kernel";
+        return false;
+    }
+
+    now_ = muduo::Timestamp::now();
+    armAccept();
+    // 不支持multishot accept时提交就以EINVAL完成，同样换用epoll后端；其它完成事件留给loop()处理
+    io_uring_submit(&ring_);
+    io_uring_cqe *cqe = nullptr;
+    if(io_uring_peek_cqe(&ring_, &cqe) == 0 && cqe->res == -EINVAL){
+        LOG_WARN << "io_uring multishot accept is not supported by this kernel";
+        return false;
+    }
+    armWakeup();
+    armTimer();
+    return true;
+}
+
+bool IoUringLoop::probeMultishotRecv(){
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0){
+        LOG_ERROR << "io_uring probe socketpair: " << strerror(errno);
+        return false;
+    }
+    // 先写入数据，recv提交时就能完成，下面的等待不会阻塞
+    char byte = 0;
+    ssize_t n = ::write(fds[1], &byte, 1);
+    (void)n;
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_recv_multishot(sqe, fds[0], nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    io_uring_sqe_set_data64(sqe, userData(kProbe, 0));
+    io_uring_submit(&ring_);
+
+    bool supported = false;
+    bool more = true;
+    while(more){
+        io_uring_cqe *cqe = nullptr;
+        int ret = io_uring_wait_cqe(&ring_, &cqe);
+        if(ret == -EINTR){
+            continue;
+        }
+        if(ret < 0){
+            LOG_ERROR << "io_uring probe: " << strerror(-ret);
+            break;
+        }
+        supported = supported || cqe->res > 0;
+        more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        if(cqe->flags & IORING_CQE_F_BUFFER){
+            returnBuffer(static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        io_uring_cqe_seen(&ring_, cqe);
+        if(more && fds[1] >= 0){
+            // 关闭对端，recv读到EOF后结束，不留下未完成的操作
+            ::close(fds[1]);
+            fds[1] = -1;
+        }
+    }
+    ::close(fds[0]);
+    if(fds[1] >= 0){
+        ::close(fds[1]);
+    }
+    return supported && !more;
+}
+
+void IoUringLoop::loop(){
+    while(!quit_.load(std::memory_order_acquire)){
+        // 提交上一轮产生的所有操作，同时等待至少一个完成事件，每轮只有这一次系统调用
+        int ret = io_uring_submit_and_wait(&ring_, 1);
+        if(ret < 0 && ret != -EINTR){
+            LOG_ERROR << "io_uring_submit_and_wait: " << strerror(-ret);
+            break;
+        }
+        now_ = muduo::Timestamp::now();
+        unsigned head;
+        unsigned count = 0;
+        io_uring_cqe *cqe;
+        io_uring_for_each_cqe(&ring_, head, cqe){
+            handleCompletion(cqe);
+            ++count;
+        }
+        io_uring_cq_advance(&ring_, count);
+
+        // 本轮处理的所有请求的响应，每个连接合并成一次send
+        for(uint64_t id : dirty_){
+            auto it = connections_.find(id);
+            if(it != connections_.end()){
+                armSend(it->second.get());
+            }
+        }
+        dirty_.clear();
+    }
+}
+
+void IoUringLoop::quit(){
+    quit_.store(true, std::memory_order_release);
+    if(wakeupFd_ >= 0){
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeupFd_, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+void IoUringLoop::drain(){
+    draining_.store(true, std::memory_order_release);
+    if(wakeupFd_ >= 0){
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeupFd_, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+io_uring_sqe *IoUringLoop::getSqe(){
+    io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+    if(!sqe){
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+    }
+    return sqe;
+}
+
+void IoUringLoop::armAccept(){
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_multishot_accept(sqe, listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, userData(kAccept, 0));
+}
+
+void IoUringLoop::armRecv(Connection *conn){
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_recv_multishot(sqe, conn->fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    io_uring_sqe_set_data64(sqe, userData(kRecv, conn->id));
+    conn->recvArmed = true;
+    ++conn->inflight;
+}
+
+void IoUringLoop::armSend(Connection *conn){
+    if(conn->sendArmed || conn->closing){
+        return;
+    }
+    if(conn->sending.readableBytes() == 0){
+        if(conn->output.readableBytes() == 0){
+            return;
+        }
+        conn->sending.swap(conn->output);
+    }
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_send(sqe, conn->fd, conn->sending.peek(), conn->sending.readableBytes(), MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, userData(kSend, conn->id));
+    conn->sendArmed = true;
+    ++conn->inflight;
+}
+
+void IoUringLoop::armTimer(){
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_timeout(sqe, &tick_, 0, 0);
+    io_uring_sqe_set_data64(sqe, userData(kTimer, 0));
+}
+
+void IoUringLoop::armWakeup(){
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_read(sqe, wakeupFd_, &wakeupValue_, sizeof(wakeupValue_), 0);
+    io_uring_sqe_set_data64(sqe, userData(kWakeup, 0));
+}
+
+void IoUringLoop::handleCompletion(io_uring_cqe *cqe){
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    OpType op = static_cast<OpType>(data >> 56);
+    switch(op){
+    case kAccept:
+        onAccept(cqe);
+        return;
+    case kTimer:
+        onTimer();
+        return;
+    case kWakeup:
+        if(!quit_.load(std::memory_order_acquire)){
+            armWakeup();
+        }
+        if(draining_.load(std::memory_order_acquire) && !drainStarted_){
+            startDrain();
+        }
+        return;
+    case kRecv:
+    case kSend:
+    case kShutdown:
+        break;
+    default:
+        // close和cancel的结果不需要处理
+        return;
+    }
+
+    auto it = connections_.find(data & kIdMask);
+    if(it == connections_.end()){
+        if(op == kRecv && (cqe->flags & IORING_CQE_F_BUFFER)){
+            returnBuffer(static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        return;
+    }
+    if(op == kRecv){
+        onRecv(it->second.get(), cqe);
+    }
+    else if(op == kSend){
+        onSend(it->second.get(), cqe);
+    }
+    else{
+        onShutdown(it->second.get());
+    }
+}
+
+void IoUringLoop::onAccept(io_uring_cqe *cqe){
+    // multishot accept在出错时结束，需要重新提交
+    bool ended = !(cqe->flags & IORING_CQE_F_MORE) && !quit_.load(std::memory_order_acquire) && !drainStarted_;
+    if(cqe->res == -EMFILE || cqe->res == -ENFILE){
+        // 立即重新提交会马上以同样的错误结束，等定时器在下一秒重试，期间新连接留在accept队列中
+        LOG_ERROR << "io_uring accept: " << strerror(-cqe->res) << ", retry in 1s";
+        acceptPaused_ = acceptPaused_ || ended;
+        return;
+    }
+    if(cqe->res == -EINVAL && ended){
+        // init()已经确认支持multishot accept，EINVAL说明监听socket本身不能再accept，不能悄悄地停止接受连接
+        LOG_FATAL << "io_uring accept on listener " << listenFd_ << ": " << strerror(-cqe->res);
+    }
+    if(ended){
+        armAccept();
+    }
+    if(cqe->res < 0){
+        if(cqe->res != -ECANCELED){
+            LOG_ERROR << "io_uring accept: " << strerror(-cqe->res);
+        }
+        return;
+    }
+    int fd = cqe->res;
+    std::string ip;
+    if(options_.limiter){
+        if(!peerIp(fd, &ip) || !options_.limiter->tryAcquire(ip)){
+            LOG_WARN << "Too many connections, reject " << ip;
+            ::close(fd);
+            return;
+        }
+    }
+
+    ConnectionPtr conn(new Connection);
+    conn->id = nextId_++;
+    conn->fd = fd;
+    conn->ip = ip;
+    conn->context.setMaxBodySize(options_.maxBodySize);
+    Connection *c = conn.get();
+    connections_.emplace(c->id, std::move(conn));
+    connectionCount_.store(connections_.size(), std::memory_order_relaxed);
+    setPhase(c, HttpContext::kTimeoutIdle);
+    armRecv(c);
+}
+
+void IoUringLoop::onRecv(Connection *conn, io_uring_cqe *cqe){
+    if(!(cqe->flags & IORING_CQE_F_MORE)){
+        conn->recvArmed = false;
+        --conn->inflight;
+    }
+    if(cqe->flags & IORING_CQE_F_BUFFER){
+        uint16_t bid = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        // 拷贝进连接自己的缓冲区后立即归还，半个请求也不会长期占用缓冲区环
+        if(cqe->res > 0 && !conn->closing && !conn->closeAfterSend){
+            conn->input.append(&bufferMemory_[bid * kBufferSize], cqe->res);
+        }
+        returnBuffer(bid);
+    }
+    if(conn->closing){
+        maybeDestroy(conn);
+        return;
+    }
+
+    if(cqe->res > 0){
+        processInput(conn);
+    }
+    else if(cqe->res == 0){
+        // 对端关闭了写方向，已经生成的响应发完再关闭
+        conn->peerClosed = true;
+        if(conn->output.readableBytes() == 0 && !conn->sendArmed){
+            closeConnection(conn);
+            return;
+        }
+        conn->closeAfterSend = true;
+    }
+    else if(cqe->res != -ENOBUFS && cqe->res != -ECANCELED){
+        closeConnection(conn);
+        return;
+    }
+    // 缓冲区环暂时用完（ENOBUFS）时multishot也会结束，这时已经归还了缓冲区，可以直接重新提交
+    if(!conn->recvArmed && !conn->paused && !conn->peerClosed){
+        armRecv(conn);
+    }
+}
+
+void IoUringLoop::onSend(Connection *conn, io_uring_cqe *cqe){
+    conn->sendArmed = false;
+    --conn->inflight;
+    if(conn->closing){
+        maybeDestroy(conn);
+        return;
+    }
+    if(cqe->res < 0){
+        if(cqe->res == -EINTR || cqe->res == -EAGAIN){
+            armSend(conn);
+        }
+        else{
+            closeConnection(conn);
+        }
+        return;
+    }
+    conn->sending.retrieve(cqe->res);
+    if(conn->paused && cqe->res > 0){
+        // 客户端还在读积压的响应，推迟空闲期限
+        conn->phase = HttpContext::kTimeoutNone;
+        setPhase(conn, HttpContext::kTimeoutIdle);
+    }
+    if(conn->sending.readableBytes() > 0 || conn->output.readableBytes() > 0){
+        // 没发完的部分，或者发送期间新产生的响应
+        armSend(conn);
+        return;
+    }
+
+    if(conn->closeAfterSend){
+        if(conn->peerClosed){
+            closeConnection(conn);
+            return;
+        }
+        // 和muduo的shutdown()一样只关闭写方向，等对端读完响应后关闭连接，
+        // 避免对端还有没读的数据时直接close触发RST，冲掉还在路上的响应
+        io_uring_sqe *sqe = getSqe();
+        io_uring_prep_shutdown(sqe, conn->fd, SHUT_WR);
+        io_uring_sqe_set_data64(sqe, userData(kShutdown, conn->id));
+        ++conn->inflight;
+        return;
+    }
+    if(conn->paused){
+        resume(conn);
+    }
+}
+
+void IoUringLoop::onShutdown(Connection *conn){
+    --conn->inflight;
+    if(conn->closing){
+        maybeDestroy(conn);
+    }
+}
+
+void IoUringLoop::onTimer(){
+    if(!quit_.load(std::memory_order_acquire)){
+        armTimer();
+        if(acceptPaused_ && !drainStarted_){
+            acceptPaused_ = false;
+            armAccept();
+        }
+    }
+    std::vector<uint64_t> expired;
+    for(auto &entry : connections_){
+        Connection *conn = entry.second.get();
+        if(!conn->closing && conn->deadline.valid() && conn->deadline < now_){
+            expired.push_back(entry.first);
+        }
+    }
+    for(uint64_t id : expired){
+        auto it = connections_.find(id);
+        if(it != connections_.end()){
+            closeConnection(it->second.get());
+        }
+    }
+}
+
+void IoUringLoop::startDrain(){
+    drainStarted_ = true;
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_cancel64(sqe, userData(kAccept, 0), 0);
+    io_uring_sqe_set_data64(sqe, userData(kCancel, 0));
+    // 被取消的accept持有自己的引用，这里可以直接关闭；交接过的socket在继任者中仍然有效
+    ::close(listenFd_);
+    listenFd_ = -1;
+
+    // 没有未完成请求的连接直接关闭，其余的在下一个响应之后关闭
+    std::vector<uint64_t> idle;
+    for(auto &entry : connections_){
+        Connection *conn = entry.second.get();
+        if(!conn->closing && !conn->closeAfterSend && !conn->sendArmed && conn->context.expectRequestLine()
+           && conn->input.readableBytes() == 0 && conn->output.readableBytes() == 0){
+            idle.push_back(entry.first);
+        }
+    }
+    for(uint64_t id : idle){
+        auto it = connections_.find(id);
+        if(it != connections_.end()){
+            closeConnection(it->second.get());
+        }
+    }
+}
+
+void IoUringLoop::processInput(Connection *conn){
+    HttpContext &context = conn->context;
+    try{
+        // 流水线请求逐个处理，直到剩下的数据不够一个完整请求
+        while(!conn->paused && !conn->closeAfterSend && conn->input.readableBytes() > 0){
+            if(!context.parseRequest(&conn->input, now_)){
+                conn->output.append(context.bodyTooLarge() ? "HTTP/1.1 413 Payload Too Large\r\nConnection: close\r\n\r\n"
+                                                           : "HTTP/1.1 400 Bad Request\r\n\r\n");
+                conn->closeAfterSend = true;
+                break;
+            }
+            if(!context.gotAll()){
+                break;
+            }
+            const HttpRequest &req = context.request();
+            const std::string &connection = req.getHeader("Connection");
+            bool close = ((connection == "close") || (req.getVersion() == "HTTP/1.0" && connection != "Keep-Alive"))
+                      || drainStarted_;
+            HttpResponse response(close);
+            requestCallback_(req, &response);
+            response.appendToBuffer(&conn->output);
+            if(response.colseConnection()){
+                conn->closeAfterSend = true;
+            }
+            context.reset();
+            conn->phase = HttpContext::kTimeoutNone;    // 下一个请求重新计时
+            if(conn->output.readableBytes() + conn->sending.readableBytes() >= options_.highWaterMark){
+                pause(conn);
+            }
+        }
+    }
+    catch(const std::exception &e){
+        LOG_ERROR << "Exception in io_uring processInput: " << e.what();
+        conn->output.append("HTTP/1.1 400 Bad Request\r\n\r\n");
+        conn->closeAfterSend = true;
+    }
+    if(conn->output.readableBytes() > 0){
+        dirty_.push_back(conn->id);
+    }
+
+    if(conn->closeAfterSend){
+        // 不再处理后续的数据
+        conn->input.retrieveAll();
+    }
+    if(conn->paused){
+        // 等待的是客户端读取响应，按空闲计时
+        setPhase(conn, HttpContext::kTimeoutIdle);
+    }
+    else if(context.expectBody()){
+        setPhase(conn, HttpContext::kTimeoutBody);
+    }
+    else if(!context.expectRequestLine() || conn->input.readableBytes() > 0){
+        setPhase(conn, HttpContext::kTimeoutHeaders);
+    }
+    else{
+        setPhase(conn, HttpContext::kTimeoutIdle);
+    }
+}
+
+void IoUringLoop::setPhase(Connection *conn, HttpContext::TimeoutPhase phase){
+    if(conn->phase == phase){
+        return;
+    }
+    conn->phase = phase;
+    int timeout = phase == HttpContext::kTimeoutIdle ? options_.idleTimeout
+                : phase == HttpContext::kTimeoutHeaders ? options_.headerTimeout
+                : options_.bodyTimeout;
+    conn->deadline = timeout > 0 ? muduo::addTime(now_, timeout) : muduo::Timestamp();
+}
+
+void IoUringLoop::pause(Connection *conn){
+    conn->paused = true;
+    if(conn->recvArmed){
+        // multishot recv被取消后以ECANCELED结束，恢复时重新提交
+        io_uring_sqe *sqe = getSqe();
+        io_uring_prep_cancel64(sqe, userData(kRecv, conn->id), 0);
+        io_uring_sqe_set_data64(sqe, userData(kCancel, conn->id));
+    }
+}
+
+void IoUringLoop::resume(Connection *conn){
+    conn->paused = false;
+    // 客户端读完了积压的响应，算作活动，各阶段从现在重新计时
+    conn->phase = HttpContext::kTimeoutNone;
+    // 暂停期间留在输入缓冲区中的请求
+    processInput(conn);
+    if(!conn->paused && !conn->recvArmed && !conn->peerClosed){
+        armRecv(conn);
+    }
+}
+
+void IoUringLoop::closeConnection(Connection *conn){
+    if(conn->closing){
+        return;
+    }
+    conn->closing = true;
+    if(conn->inflight > 0){
+        // 取消recv，以及卡在不读数据的客户端上的send
+        io_uring_sqe *sqe = getSqe();
+        io_uring_prep_cancel_fd(sqe, conn->fd, IORING_ASYNC_CANCEL_ALL);
+        io_uring_sqe_set_data64(sqe, userData(kCancel, conn->id));
+    }
+    maybeDestroy(conn);
+}
+
+void IoUringLoop::maybeDestroy(Connection *conn){
+    // 还有操作没结束时内核可能还在用连接的缓冲区，等它们的完成事件
+    if(conn->inflight > 0){
+        return;
+    }
+    io_uring_sqe *sqe = getSqe();
+    io_uring_prep_close(sqe, conn->fd);
+    io_uring_sqe_set_data64(sqe, userData(kClose, conn->id));
+    if(options_.limiter && !conn->ip.empty()){
+        options_.limiter->release(conn->ip);
+    }
+    connections_.erase(conn->id);
+    connectionCount_.store(connections_.size(), std::memory_order_relaxed);
+}
+
+void IoUringLoop::returnBuffer(uint16_t bid){
+    io_uring_buf_ring_add(bufferRing_, &bufferMemory_[bid * kBufferSize], kBufferSize, bid,
+                          io_uring_buf_ring_mask(kBufferCount), 0);
+    io_uring_buf_ring_advance(bufferRing_, 1);
+}
+
+IoUringServer::IoUringServer(const IoUringOptions &options, const RequestCallback &cb)
+    : options_(options)
+    , requestCallback_(cb)
+{
+}
+
+IoUringServer::~IoUringServer(){
+    stop();
+}
+
+bool IoUringServer::start(){
+    for(int i = 0; i < std::max(options_.numThreads, 1); ++i){
+        loops_.push_back(std::make_unique<IoUringLoop>(options_, requestCallback_, static_cast<size_t>(i)));
+        IoUringLoop *loop = loops_.back().get();
+        // ring要在使用它的线程中创建（SINGLE_ISSUER），初始化结果通过promise带回来
+        std::promise<bool> ready;
+        std::future<bool> initialized = ready.get_future();
+        threads_.emplace_back([loop, &ready](){
+            bool ok = loop->init();
+            ready.set_value(ok);
+            if(ok){
+                loop->loop();
+            }
+        });
+        if(!initialized.get()){
+            stop();
+            return false;
+        }
+        listenFds_.push_back(loop->listenFd());
+    }
+    return true;
+}
+
+void IoUringServer::drain(){
+    for(auto &loop : loops_){
+        loop->drain();
+    }
+}
+
+size_t IoUringServer::connectionCount() const{
+    size_t count = 0;
+    for(const auto &loop : loops_){
+        count += loop->connectionCount();
+    }
+    return count;
+}
+
+void IoUringServer::stop(){
+    for(auto &loop : loops_){
+        loop->quit();
+    }
+    for(std::thread &thread : threads_){
+        thread.join();
+    }
+    threads_.clear();
+    loops_.clear();
+    listenFds_.clear();
+}
+
+}
+}